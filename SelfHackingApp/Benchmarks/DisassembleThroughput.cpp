@@ -0,0 +1,141 @@
+// Throughput of HackUtils::disassemble called from several threads at once, through the shared disassembly cache. The cached
+// column asks for the same functions over and over, so nearly every call is a hit. The uncached column copies them to a new
+// offset each round, so every call decodes with the thread's own udis86 context and inserts into the cache. Every result has to
+// match the text from a single thread. Thread counts double up to at least 4 and the core count, or to the first argument.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HackUtils.h"
+#include "ImageDisassembler.h"
+#include "TestUtils.h"
+
+static const size_t MaxFunctions = 256;
+static const size_t MaxFunctionLength = 2048;
+static const int CachedRounds = 256;
+static const int UncachedRounds = 32;
+
+struct Throughput
+{
+	double callRate;
+	double byteRate;
+	int mismatches;
+};
+
+static Throughput measure(const std::vector<ImageDisassembler::FunctionDisassembly>& corpus, size_t corpusBytes, const std::vector<std::string>& references,
+	int threadCount, bool isCached)
+{
+	int rounds = isCached ? CachedRounds : UncachedRounds;
+	std::atomic<int> mismatches(0);
+	std::vector<std::thread> threads;
+	auto startTime = std::chrono::steady_clock::now();
+
+	for (int threadIndex = 0; threadIndex < threadCount; threadIndex++)
+	{
+		threads.push_back(std::thread([&]()
+		{
+			std::vector<unsigned char> buffer = std::vector<unsigned char>(MaxFunctionLength + rounds);
+
+			for (int round = 0; round < rounds; round++)
+			{
+				for (size_t index = 0; index < corpus.size(); index++)
+				{
+					void* code = corpus[index].address;
+
+					if (!isCached)
+					{
+						code = buffer.data() + round;
+						memcpy(code, corpus[index].address, corpus[index].length);
+					}
+
+					if (HackUtils::disassemble(code, (int)corpus[index].length, corpus[index].address) != references[index])
+					{
+						mismatches++;
+					}
+				}
+			}
+		}));
+	}
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	return Throughput{ (double)threadCount * rounds * corpus.size() / seconds, (double)threadCount * rounds * corpusBytes / seconds, mismatches };
+}
+
+int main(int argc, char** argv)
+{
+	// Functions of this program make up the corpus, so it is real compiler output
+	ImageDisassembler::ImageDisassembly image = ImageDisassembler::disassembleImage((void*)&main, 1);
+	std::vector<ImageDisassembler::FunctionDisassembly> corpus;
+	size_t corpusBytes = 0;
+
+	for (const ImageDisassembler::FunctionDisassembly& function : image.functions)
+	{
+		if (function.length >= 32 && function.length <= MaxFunctionLength && corpus.size() < MaxFunctions)
+		{
+			corpus.push_back(function);
+			corpusBytes += function.length;
+		}
+	}
+
+	if (corpus.size() < 2)
+	{
+		TestUtils::fail("no function symbols found, build without stripping");
+		return TestUtils::exitCode();
+	}
+
+	// Decoded at the address they run from, so the reference doesn't depend on where a thread copies the bytes to
+	std::vector<std::string> references;
+
+	for (const ImageDisassembler::FunctionDisassembly& function : corpus)
+	{
+		references.push_back(HackUtils::disassemble(function.address, (int)function.length, function.address));
+	}
+
+	int coreCount = (int)std::max(std::thread::hardware_concurrency(), 1u);
+	int maxThreads = argc > 1 ? std::max(atoi(argv[1]), 1) : std::max(coreCount, 4);
+	std::vector<int> threadCounts;
+
+	for (int threadCount = 1; threadCount < maxThreads; threadCount *= 2)
+	{
+		threadCounts.push_back(threadCount);
+	}
+
+	threadCounts.push_back(maxThreads);
+
+	std::cout << corpus.size() << " functions, " << corpusBytes << " bytes, " << coreCount << " cores" << std::endl;
+	std::cout << "threads   cached calls/s   scaling   uncached calls/s     MB/s   scaling" << std::endl;
+
+	Throughput singleThreadCached = Throughput();
+	Throughput singleThreadUncached = Throughput();
+
+	for (int threadCount : threadCounts)
+	{
+		Throughput cached = measure(corpus, corpusBytes, references, threadCount, true);
+		Throughput uncached = measure(corpus, corpusBytes, references, threadCount, false);
+
+		singleThreadCached = threadCount == 1 ? cached : singleThreadCached;
+		singleThreadUncached = threadCount == 1 ? uncached : singleThreadUncached;
+
+		std::cout << std::setw(7) << threadCount << std::setw(17) << (long long)cached.callRate << std::setw(9) << std::fixed << std::setprecision(2)
+			<< cached.callRate / singleThreadCached.callRate << "x" << std::setw(19) << (long long)uncached.callRate << std::setw(9) << std::setprecision(1)
+			<< uncached.byteRate / 1e6 << std::setw(9) << std::setprecision(2) << uncached.callRate / singleThreadUncached.callRate << "x" << std::endl;
+
+		TestUtils::expect(std::to_string(threadCount) + " threads give the single threaded text (" + std::to_string(cached.mismatches + uncached.mismatches) + " differ)",
+			cached.mismatches + uncached.mismatches == 0);
+	}
+
+	return TestUtils::exitCode();
+}
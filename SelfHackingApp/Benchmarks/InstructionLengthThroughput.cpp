@@ -0,0 +1,148 @@
+// Bytes per second walked by InstructionLength::getLength over the functions of this program, next to udis86's ud_decode walking the
+// same code and CodeRelocator laying out the same bytes in region sized pieces. The instruction counts aren't compared, udis86
+// doesn't know endbr64 and walks it as two instructions. InstructionLengthDifferential checks the lengths themselves.
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "CodeRelocator.h"
+#include "ImageDisassembler.h"
+#include "InstructionLength.h"
+#include "TestUtils.h"
+#include "External/libudis86/udis86.h"
+
+static const int Rounds = 64;
+
+// Keeps the walks from being optimized out
+static volatile long long Sink = 0;
+
+// Counts the bytes getLength couldn't decode
+static long long walkInstructionLength(const std::vector<ImageDisassembler::FunctionDisassembly>& corpus)
+{
+	long long invalidCount = 0;
+
+	for (const ImageDisassembler::FunctionDisassembly& function : corpus)
+	{
+		const unsigned char* code = (const unsigned char*)function.address;
+
+		for (size_t offset = 0; offset < function.length;)
+		{
+			int length = InstructionLength::getLength(code + offset, (int)std::min(function.length - offset, (size_t)InstructionLength::MaxLength));
+
+			invalidCount += length == 0 ? 1 : 0;
+			offset += length == 0 ? 1 : length;
+		}
+	}
+
+	return invalidCount;
+}
+
+static long long walkUdis86(const std::vector<ImageDisassembler::FunctionDisassembly>& corpus)
+{
+	long long instructionCount = 0;
+	ud_t ud_obj;
+
+	ud_init(&ud_obj);
+	ud_set_mode(&ud_obj, sizeof(void*) * 8);
+
+	for (const ImageDisassembler::FunctionDisassembly& function : corpus)
+	{
+		const unsigned char* code = (const unsigned char*)function.address;
+
+		for (size_t offset = 0; offset < function.length; instructionCount++)
+		{
+			ud_set_input_buffer(&ud_obj, code + offset, std::min(function.length - offset, (size_t)InstructionLength::MaxLength));
+
+			int length = (int)ud_decode(&ud_obj);
+
+			offset += length == 0 || ud_obj.mnemonic == UD_Iinvalid ? 1 : length;
+		}
+	}
+
+	return instructionCount;
+}
+
+// Region sized pieces, like the hackable regions hooks relocate
+static long long layoutRegions(const std::vector<ImageDisassembler::FunctionDisassembly>& corpus)
+{
+	long long relocatedSize = 0;
+
+	for (const ImageDisassembler::FunctionDisassembly& function : corpus)
+	{
+		const unsigned char* code = (const unsigned char*)function.address;
+		int offset = 0;
+
+		while (offset < (int)function.length)
+		{
+			int regionLength = InstructionLength::getCoveringLength(code + offset, 32);
+
+			if (regionLength == 0 || offset + regionLength > (int)function.length)
+			{
+				break;
+			}
+
+			relocatedSize += CodeRelocator::getRelocatedSize(code + offset, regionLength, true);
+			offset += regionLength;
+		}
+	}
+
+	return relocatedSize;
+}
+
+static double measure(long long (*walk)(const std::vector<ImageDisassembler::FunctionDisassembly>&), const std::vector<ImageDisassembler::FunctionDisassembly>& corpus,
+	size_t corpusBytes, long long* outResult)
+{
+	double bestSeconds = 0.0;
+
+	for (int round = 0; round < Rounds; round++)
+	{
+		auto startTime = std::chrono::steady_clock::now();
+
+		*outResult = walk(corpus);
+		Sink = *outResult;
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+		bestSeconds = round == 0 ? seconds : std::min(bestSeconds, seconds);
+	}
+
+	return (double)corpusBytes / bestSeconds;
+}
+
+int main()
+{
+	ImageDisassembler::ImageDisassembly image = ImageDisassembler::disassembleImage((void*)&main, 1);
+	std::vector<ImageDisassembler::FunctionDisassembly> corpus;
+	size_t corpusBytes = 0;
+
+	for (const ImageDisassembler::FunctionDisassembly& function : image.functions)
+	{
+		corpus.push_back(function);
+		corpusBytes += function.length;
+	}
+
+	if (corpus.empty())
+	{
+		TestUtils::fail("no function symbols found, build without stripping");
+		return TestUtils::exitCode();
+	}
+
+	long long invalidCount = 0;
+	long long udisInstructions = 0;
+	long long relocatedSize = 0;
+	double lengthRate = measure(walkInstructionLength, corpus, corpusBytes, &invalidCount);
+	double udisRate = measure(walkUdis86, corpus, corpusBytes, &udisInstructions);
+	double layoutRate = measure(layoutRegions, corpus, corpusBytes, &relocatedSize);
+
+	std::cout << corpus.size() << " functions, " << corpusBytes << " bytes, best of " << Rounds << " rounds" << std::endl << std::fixed << std::setprecision(1)
+		<< "  InstructionLength::getLength: " << std::setw(8) << lengthRate / 1e6 << " MB/s" << std::endl
+		<< "  udis86 ud_decode:             " << std::setw(8) << udisRate / 1e6 << " MB/s" << std::endl
+		<< "  CodeRelocator, 32 byte pieces:" << std::setw(8) << layoutRate / 1e6 << " MB/s" << std::endl;
+
+	TestUtils::expect("getLength decodes every instruction (" + std::to_string(invalidCount) + " invalid bytes)", invalidCount == 0);
+	TestUtils::expect("the pieces are laid out for relocation", relocatedSize > 0);
+
+	return TestUtils::exitCode();
+}
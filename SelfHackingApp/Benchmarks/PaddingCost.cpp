@@ -0,0 +1,164 @@
+// Cost of the padding left behind a short patch in a hot hackable. The same 'add ZAX, ZCX' patch runs padded with single 0x90 NOPs
+// and with HackableCode's own padding, which is long NOPs for the 24 byte region and a jmp over the gap for the 48 byte one.
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+#include "HackableCode.h"
+#include "TestUtils.h"
+
+static const int CallsPerRun = 10000000;
+static const int Runs = 5;
+
+// Keeps the calls from being optimized out
+static volatile int Sink = 0;
+
+NO_OPTIMIZE
+int hackableRoutineSmallGap(int value, int increment)
+{
+	static volatile int valueLocal;
+	static volatile int incrementLocal;
+
+	valueLocal = value;
+	incrementLocal = increment;
+
+	ASM_MOV_REG_VAR(ZAX, valueLocal);
+	ASM_MOV_REG_VAR(ZCX, incrementLocal);
+
+	HACKABLE_CODE_BEGIN()
+	ASM_NOP16()
+	ASM_NOP8()
+	HACKABLE_CODE_END();
+
+	ASM_MOV_VAR_REG(valueLocal, ZAX);
+
+	HACKABLES_STOP_SEARCH();
+
+	return valueLocal;
+}
+END_NO_OPTIMIZE
+
+NO_OPTIMIZE
+int hackableRoutineLargeGap(int value, int increment)
+{
+	static volatile int valueLocal;
+	static volatile int incrementLocal;
+
+	valueLocal = value;
+	incrementLocal = increment;
+
+	ASM_MOV_REG_VAR(ZAX, valueLocal);
+	ASM_MOV_REG_VAR(ZCX, incrementLocal);
+
+	HACKABLE_CODE_BEGIN()
+	ASM_NOP16()
+	ASM_NOP16()
+	ASM_NOP16()
+	HACKABLE_CODE_END();
+
+	ASM_MOV_VAR_REG(valueLocal, ZAX);
+
+	HACKABLES_STOP_SEARCH();
+
+	return valueLocal;
+}
+END_NO_OPTIMIZE
+
+// Best of several runs, in TSC ticks and nanoseconds per call
+static void measure(int (*routine)(int, int), double* outTicks, double* outNanoseconds)
+{
+	*outTicks = 0.0;
+	*outNanoseconds = 0.0;
+
+	for (int run = 0; run < Runs; run++)
+	{
+		auto startTime = std::chrono::steady_clock::now();
+		unsigned long long startTicks = __rdtsc();
+
+		for (int call = 0; call < CallsPerRun; call++)
+		{
+			Sink = routine(call, 1);
+		}
+
+		double ticks = (double)(__rdtsc() - startTicks) / CallsPerRun;
+		double nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - startTime).count() / CallsPerRun;
+
+		*outTicks = run == 0 ? ticks : std::min(*outTicks, ticks);
+		*outNanoseconds = run == 0 ? nanoseconds : std::min(*outNanoseconds, nanoseconds);
+	}
+}
+
+static void compare(const std::string& name, int (*routine)(int, int))
+{
+	auto functionPointer = routine;
+	std::vector<HackableCode*> hackables = HackableCode::create((void*&)functionPointer);
+	std::string patch = sizeof(void*) == 4 ? "add eax, ecx" : "add rax, rcx";
+
+	if (hackables.empty())
+	{
+		TestUtils::fail(name + " has no hackable section");
+		return;
+	}
+
+	HackableCode* hackableCode = hackables[0];
+	HackUtils::CompileResult compileResult = HackUtils::assemble(patch, hackableCode->getPointer());
+
+	if (compileResult.hasError)
+	{
+		TestUtils::fail("compiling the patch: " + compileResult.errorData.message);
+		return;
+	}
+
+	int gap = hackableCode->getOriginalLength() - compileResult.byteCount;
+	std::vector<unsigned char> singleNops = compileResult.compiledBytes;
+	double singleTicks = 0.0;
+	double singleNanoseconds = 0.0;
+	double paddedTicks = 0.0;
+	double paddedNanoseconds = 0.0;
+
+	singleNops.resize(hackableCode->getOriginalLength(), 0x90);
+
+	if (!TestUtils::expect(name + " runs the 0x90 padded patch", hackableCode->applyCustomCode(singleNops) && routine(5, 3) == 8))
+	{
+		return;
+	}
+
+	measure(routine, &singleTicks, &singleNanoseconds);
+
+	if (!TestUtils::expect(name + " runs the padded patch", hackableCode->applyCustomCode(patch) && routine(5, 3) == 8))
+	{
+		return;
+	}
+
+	// Writing ZAX is the point of the patch, so it is only reported, never printed
+	RegisterLiveness::RegisterSet liveClobbers = hackableCode->getLiveClobbers();
+
+	TestUtils::expect(name + " reports the intended write to " + RegisterLiveness::getRegisterNames(liveClobbers), liveClobbers.registers != 0 && !liveClobbers.flags);
+
+	measure(routine, &paddedTicks, &paddedNanoseconds);
+
+	std::cout << std::endl << name << ", " << gap << " byte gap, padded as:" << std::endl << HackUtils::disassemble((unsigned char*)hackableCode->getPointer() + compileResult.byteCount, gap);
+	std::cout << std::fixed << std::setprecision(2)
+		<< "  0x90 x " << gap << ": " << std::setw(7) << singleTicks << " ticks " << std::setw(7) << singleNanoseconds << " ns per call" << std::endl
+		<< "  padded:    " << std::setw(7) << paddedTicks << " ticks " << std::setw(7) << paddedNanoseconds << " ns per call" << std::endl
+		<< "  saved:     " << std::setw(7) << singleTicks - paddedTicks << " ticks " << std::setw(7) << singleNanoseconds - paddedNanoseconds << " ns per call" << std::endl;
+
+	hackableCode->restoreState();
+}
+
+int main()
+{
+	compare("hackableRoutineSmallGap", hackableRoutineSmallGap);
+	compare("hackableRoutineLargeGap", hackableRoutineLargeGap);
+
+	return TestUtils::exitCode();
+}
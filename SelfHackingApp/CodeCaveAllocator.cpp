@@ -0,0 +1,215 @@
+#include "CodeCaveAllocator.h"
+
+#include <cstdint>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+
+// Older libc headers predate the flag, kernels before 4.17 treat it as a plain hint which is checked for below
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+#endif
+
+#include "External/asmjit/asmjit.h"
+
+std::vector<CodeCaveAllocator::CavePool> CodeCaveAllocator::Pools = std::vector<CodeCaveAllocator::CavePool>();
+std::map<void*, CodeCaveAllocator::CaveBlock> CodeCaveAllocator::Blocks = std::map<void*, CodeCaveAllocator::CaveBlock>();
+std::mutex CodeCaveAllocator::AllocatorMutex;
+const size_t CodeCaveAllocator::PoolSize = 1024 * 1024;
+const size_t CodeCaveAllocator::MinCaveSize = 32;
+const size_t CodeCaveAllocator::MaxCaveSize = 64 * 1024;
+
+// Kept a little under 2GB so a rel32 from anywhere near the source instruction still lands
+static const unsigned long long MaxReach = 0x7FF00000ULL;
+
+CodeCaveAllocator::Result CodeCaveAllocator::allocate(void* nearAddress, size_t size, void** outAddress)
+{
+	*outAddress = nullptr;
+
+	if (size == 0 || size > CodeCaveAllocator::MaxCaveSize)
+	{
+		return Result::TooLarge;
+	}
+
+	int sizeClass = 0;
+
+	while ((CodeCaveAllocator::MinCaveSize << sizeClass) < size)
+	{
+		sizeClass++;
+	}
+
+	std::lock_guard<std::mutex> lock(CodeCaveAllocator::AllocatorMutex);
+
+	for (size_t poolIndex = 0; poolIndex < CodeCaveAllocator::Pools.size(); poolIndex++)
+	{
+		if (nearAddress != nullptr && !CodeCaveAllocator::isInReach(nearAddress, CodeCaveAllocator::Pools[poolIndex].start, CodeCaveAllocator::PoolSize))
+		{
+			continue;
+		}
+
+		void* block = CodeCaveAllocator::allocateFromPool(poolIndex, sizeClass);
+
+		if (block != nullptr)
+		{
+			CodeCaveAllocator::Blocks[block] = CaveBlock(poolIndex, sizeClass);
+			*outAddress = block;
+
+			return Result::Ok;
+		}
+	}
+
+	unsigned char* poolStart = CodeCaveAllocator::reservePool(nearAddress);
+
+	if (poolStart == nullptr)
+	{
+		return nearAddress != nullptr ? Result::OutOfReach : Result::OutOfMemory;
+	}
+
+	CavePool pool = CavePool();
+
+	pool.start = poolStart;
+
+	// One free list per size class, MinCaveSize up to MaxCaveSize
+	while ((CodeCaveAllocator::MinCaveSize << pool.freeBlocks.size()) <= CodeCaveAllocator::MaxCaveSize)
+	{
+		pool.freeBlocks.push_back(std::vector<void*>());
+	}
+
+	CodeCaveAllocator::Pools.push_back(pool);
+
+	void* block = CodeCaveAllocator::allocateFromPool(CodeCaveAllocator::Pools.size() - 1, sizeClass);
+
+	CodeCaveAllocator::Blocks[block] = CaveBlock(CodeCaveAllocator::Pools.size() - 1, sizeClass);
+	*outAddress = block;
+
+	return Result::Ok;
+}
+
+void CodeCaveAllocator::release(void* address)
+{
+	std::lock_guard<std::mutex> lock(CodeCaveAllocator::AllocatorMutex);
+	auto block = CodeCaveAllocator::Blocks.find(address);
+
+	if (block == CodeCaveAllocator::Blocks.end())
+	{
+		return;
+	}
+
+	// Pools are never unmapped, freed blocks are only reused by allocations of the same size class
+	CodeCaveAllocator::Pools[block->second.poolIndex].freeBlocks[block->second.sizeClass].push_back(address);
+	CodeCaveAllocator::Blocks.erase(block);
+}
+
+bool CodeCaveAllocator::isInReach(void* fromAddress, void* toAddress, size_t toLength)
+{
+	unsigned long long from = (unsigned long long)(uintptr_t)fromAddress;
+	unsigned long long toStart = (unsigned long long)(uintptr_t)toAddress;
+	unsigned long long toEnd = toStart + toLength;
+
+	// Both ends of the target have to be reachable for any jump into it to be
+	unsigned long long startDistance = toStart > from ? toStart - from : from - toStart;
+	unsigned long long endDistance = toEnd > from ? toEnd - from : from - toEnd;
+
+	return startDistance < MaxReach && endDistance < MaxReach;
+}
+
+void* CodeCaveAllocator::allocateFromPool(size_t poolIndex, int sizeClass)
+{
+	CavePool& pool = CodeCaveAllocator::Pools[poolIndex];
+	std::vector<void*>& freeBlocks = pool.freeBlocks[sizeClass];
+
+	if (!freeBlocks.empty())
+	{
+		void* block = freeBlocks.back();
+
+		freeBlocks.pop_back();
+
+		return block;
+	}
+
+	size_t blockSize = CodeCaveAllocator::MinCaveSize << sizeClass;
+	size_t alignment = blockSize < 64 ? blockSize : 64;
+	size_t offset = (pool.used + alignment - 1) & ~(alignment - 1);
+
+	if (offset + blockSize > CodeCaveAllocator::PoolSize)
+	{
+		return nullptr;
+	}
+
+	pool.used = offset + blockSize;
+
+	return pool.start + offset;
+}
+
+unsigned char* CodeCaveAllocator::reservePool(void* nearAddress)
+{
+	if (nearAddress == nullptr)
+	{
+		void* pool = nullptr;
+
+		if (asmjit::VirtMem::alloc(&pool, CodeCaveAllocator::PoolSize, asmjit::VirtMem::kAccessReadWrite | asmjit::VirtMem::kAccessExecute) != asmjit::kErrorOk)
+		{
+			return nullptr;
+		}
+
+		return (unsigned char*)pool;
+	}
+
+	// Pool starts have to be aligned to the allocation granularity (64KB on Windows) for the hint to be honored
+	unsigned long long granularity = asmjit::VirtMem::info().pageGranularity;
+	unsigned long long alignment = granularity > CodeCaveAllocator::PoolSize ? granularity : CodeCaveAllocator::PoolSize;
+	unsigned long long nearValue = (unsigned long long)(uintptr_t)nearAddress;
+	unsigned long long base = nearValue & ~(alignment - 1);
+
+	// Search outwards so the pool ends up as close as possible, the image itself is usually directly around the base
+	for (unsigned long long distance = alignment; distance < MaxReach; distance += alignment)
+	{
+		unsigned long long candidates[] = { base + distance, base - distance };
+
+		for (unsigned long long candidate : candidates)
+		{
+			// Skips the null page and wrap around below zero
+			if (candidate < alignment || candidate > ~0ULL - CodeCaveAllocator::PoolSize
+				|| !CodeCaveAllocator::isInReach(nearAddress, (void*)(uintptr_t)candidate, CodeCaveAllocator::PoolSize))
+			{
+				continue;
+			}
+
+			unsigned char* pool = CodeCaveAllocator::tryReservePoolAt(candidate);
+
+			if (pool != nullptr)
+			{
+				return pool;
+			}
+		}
+	}
+
+	return nullptr;
+}
+
+unsigned char* CodeCaveAllocator::tryReservePoolAt(unsigned long long address)
+{
+#ifdef _WIN32
+	// Fails outright if anything is already mapped in the range
+	return (unsigned char*)VirtualAlloc((LPVOID)(uintptr_t)address, CodeCaveAllocator::PoolSize, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+#else
+	void* pool = mmap((void*)(uintptr_t)address, CodeCaveAllocator::PoolSize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+	if (pool == MAP_FAILED)
+	{
+		return nullptr;
+	}
+
+	// Kernels without MAP_FIXED_NOREPLACE may place the mapping elsewhere instead of failing
+	if (pool != (void*)(uintptr_t)address)
+	{
+		munmap(pool, CodeCaveAllocator::PoolSize);
+		return nullptr;
+	}
+
+	return (unsigned char*)pool;
+#endif
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Executable memory for trampolines and relocated code that stays within jmp/call rel32 reach (+-2GB) of the code jumping into it.
+// Pools are reserved as close as possible to the requesting address and carved into power-of-two size classes, so many small caves
+// share a few pages. Allocations that can't be placed in reach fail with OutOfReach rather than quietly landing too far away.
+class CodeCaveAllocator
+{
+public:
+	enum class Result
+	{
+		Ok,
+		OutOfReach,
+		OutOfMemory,
+		TooLarge,
+	};
+
+	// A null nearAddress places the cave anywhere
+	static Result allocate(void* nearAddress, size_t size, void** outAddress);
+	static void release(void* address);
+	static bool isInReach(void* fromAddress, void* toAddress, size_t toLength);
+
+	static const size_t MaxCaveSize;
+
+private:
+	struct CavePool
+	{
+		unsigned char* start;
+		size_t used;
+		std::vector<std::vector<void*>> freeBlocks;
+
+		CavePool() : start(nullptr), used(0), freeBlocks() { }
+	};
+
+	struct CaveBlock
+	{
+		size_t poolIndex;
+		int sizeClass;
+
+		CaveBlock() : poolIndex(0), sizeClass(0) { }
+		CaveBlock(size_t poolIndex, int sizeClass) : poolIndex(poolIndex), sizeClass(sizeClass) { }
+	};
+
+	static void* allocateFromPool(size_t poolIndex, int sizeClass);
+	static unsigned char* reservePool(void* nearAddress);
+	static unsigned char* tryReservePoolAt(unsigned long long address);
+
+	static std::vector<CavePool> Pools;
+	static std::map<void*, CaveBlock> Blocks;
+	static std::mutex AllocatorMutex;
+	static const size_t PoolSize;
+	static const size_t MinCaveSize;
+};
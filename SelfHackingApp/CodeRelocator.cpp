@@ -0,0 +1,233 @@
+#include "CodeRelocator.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+
+#include "HackUtils.h"
+#include "InstructionLength.h"
+#include "StrUtils.h"
+
+bool CodeRelocator::relocate(const unsigned char* code, int length, void* originalAddress, void* newAddress, bool skipNops, std::vector<unsigned char>& outBytes)
+{
+	std::vector<RelocatedInstruction> instructions;
+	std::map<int, int> newOffsets = std::map<int, int>();
+	int relocatedSize = 0;
+
+	outBytes.clear();
+
+	if (!CodeRelocator::layout(code, length, skipNops, instructions, &relocatedSize))
+	{
+		return false;
+	}
+
+	// Branches may target any instruction start in the range, or its end which is where the relocated code ends too
+	for (const RelocatedInstruction& instruction : instructions)
+	{
+		newOffsets[instruction.originalOffset] = instruction.newOffset;
+	}
+
+	newOffsets[length] = relocatedSize;
+
+	long long originalBase = (long long)(uintptr_t)originalAddress;
+	long long newBase = (long long)(uintptr_t)newAddress;
+
+	for (const RelocatedInstruction& instruction : instructions)
+	{
+		const unsigned char* originalBytes = code + instruction.originalOffset;
+		long long newEnd = newBase + instruction.newOffset + instruction.newLength;
+
+		switch (instruction.kind)
+		{
+			case InstructionKind::Copy:
+			{
+				outBytes.insert(outBytes.end(), originalBytes, originalBytes + instruction.originalLength);
+				break;
+			}
+			case InstructionKind::RipRelative:
+			{
+				// Same length at the new address, so the displacement shifts by exactly how far the instruction moved
+				long long displacement = instruction.value + (originalBase + instruction.originalOffset) - (newBase + instruction.newOffset);
+
+				if (!CodeRelocator::fitsInt32(displacement))
+				{
+					std::cout << "rip-relative operand is out of reach after relocation" << std::endl;
+					return false;
+				}
+
+				int displacement32 = (int)displacement;
+				size_t displacementPosition = outBytes.size() + instruction.displacementOffset;
+
+				outBytes.insert(outBytes.end(), originalBytes, originalBytes + instruction.originalLength);
+				memcpy(outBytes.data() + displacementPosition, &displacement32, sizeof(displacement32));
+				break;
+			}
+			case InstructionKind::Call:
+			case InstructionKind::Jump:
+			case InstructionKind::ConditionalJump:
+			{
+				long long targetOffset = instruction.value - (long long)(uintptr_t)code;
+				long long target = originalBase + targetOffset;
+
+				if (targetOffset >= 0 && targetOffset <= length)
+				{
+					auto newOffset = newOffsets.find((int)targetOffset);
+
+					if (newOffset == newOffsets.end())
+					{
+						std::cout << "Branch into the middle of an instruction can't be relocated" << std::endl;
+						return false;
+					}
+
+					target = newBase + newOffset->second;
+				}
+
+				long long displacement = target - newEnd;
+
+				if (!CodeRelocator::fitsInt32(displacement))
+				{
+					std::cout << "Branch target is out of jmp rel32 range after relocation" << std::endl;
+					return false;
+				}
+
+				int displacement32 = (int)displacement;
+
+				if (instruction.kind == InstructionKind::ConditionalJump)
+				{
+					outBytes.push_back(0x0F);
+					outBytes.push_back((unsigned char)(0x80 | instruction.condition));
+				}
+				else
+				{
+					outBytes.push_back(instruction.kind == InstructionKind::Call ? 0xE8 : 0xE9);
+				}
+
+				outBytes.insert(outBytes.end(), (unsigned char*)&displacement32, (unsigned char*)&displacement32 + sizeof(displacement32));
+				break;
+			}
+			case InstructionKind::Skipped:
+			default:
+			{
+				break;
+			}
+		}
+	}
+
+	return true;
+}
+
+int CodeRelocator::getRelocatedSize(const unsigned char* code, int length, bool skipNops)
+{
+	std::vector<RelocatedInstruction> instructions;
+	int relocatedSize = 0;
+
+	return CodeRelocator::layout(code, length, skipNops, instructions, &relocatedSize) ? relocatedSize : -1;
+}
+
+bool CodeRelocator::layout(const unsigned char* code, int length, bool skipNops, std::vector<RelocatedInstruction>& outInstructions, int* outSize)
+{
+	int newOffset = 0;
+
+	outInstructions.clear();
+
+	// Only boundaries, branch immediates and rip-relative displacements matter here, so the length decoder is enough
+	for (int offset = 0; offset < length;)
+	{
+		const unsigned char* bytes = code + offset;
+		InstructionLength::Layout instructionLayout;
+		RelocatedInstruction instruction = RelocatedInstruction();
+
+		if (!InstructionLength::getLayout(bytes, length - offset, instructionLayout))
+		{
+			std::cout << "Unable to decode the instructions to relocate" << std::endl;
+			return false;
+		}
+
+		instruction.originalOffset = offset;
+		instruction.originalLength = instructionLayout.length;
+		instruction.newOffset = newOffset;
+		instruction.newLength = instructionLayout.length;
+
+		if (skipNops && instructionLayout.isNop)
+		{
+			instruction.kind = InstructionKind::Skipped;
+			instruction.newLength = 0;
+		}
+		else if (instructionLayout.isRelativeBranch)
+		{
+			unsigned char opcode = instructionLayout.opcode;
+
+			instruction.value = (long long)(uintptr_t)(bytes + instructionLayout.length)
+				+ CodeRelocator::readSigned(bytes + instructionLayout.immediateOffset, instructionLayout.immediateSize);
+
+			// Branch hint and bnd prefixes are dropped, the short forms are widened to rel32
+			if (instructionLayout.opcodeMap == 0 && opcode == 0xE8)
+			{
+				instruction.kind = InstructionKind::Call;
+				instruction.newLength = 5;
+			}
+			else if (instructionLayout.opcodeMap == 0 && (opcode == 0xE9 || opcode == 0xEB))
+			{
+				instruction.kind = InstructionKind::Jump;
+				instruction.newLength = 5;
+			}
+			else if ((instructionLayout.opcodeMap == 0 && (opcode & 0xF0) == 0x70) || (instructionLayout.opcodeMap == 1 && (opcode & 0xF0) == 0x80))
+			{
+				instruction.kind = InstructionKind::ConditionalJump;
+				instruction.condition = opcode & 0x0F;
+				instruction.newLength = 6;
+			}
+			else
+			{
+				std::cout << "Unable to relocate " << StrUtils::rtrim(HackUtils::disassemble((void*)bytes, instructionLayout.length), "\n")
+					<< ", it has no rel32 form" << std::endl;
+				return false;
+			}
+		}
+		else if (instructionLayout.isRipRelative)
+		{
+			instruction.kind = InstructionKind::RipRelative;
+			instruction.displacementOffset = instructionLayout.displacementOffset;
+			instruction.value = CodeRelocator::readSigned(bytes + instructionLayout.displacementOffset, instructionLayout.displacementSize);
+		}
+
+		offset += instructionLayout.length;
+		newOffset += instruction.newLength;
+		outInstructions.push_back(instruction);
+	}
+
+	*outSize = newOffset;
+
+	return true;
+}
+
+long long CodeRelocator::readSigned(const unsigned char* bytes, int size)
+{
+	switch (size)
+	{
+		case 1:
+		{
+			return (signed char)bytes[0];
+		}
+		case 2:
+		{
+			short value;
+
+			memcpy(&value, bytes, sizeof(value));
+			return value;
+		}
+		default:
+		{
+			int value;
+
+			memcpy(&value, bytes, sizeof(value));
+			return value;
+		}
+	}
+}
+
+bool CodeRelocator::fitsInt32(long long value)
+{
+	return value >= INT32_MIN && value <= INT32_MAX;
+}
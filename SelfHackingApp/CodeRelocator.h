@@ -0,0 +1,45 @@
+#pragma once
+#include <vector>
+
+// Copies instructions to another address so they still behave the same there. rip-relative displacements are adjusted, and
+// relative branches are re-encoded in their rel32 form, with targets inside the copied range mapped to where those instructions
+// land. Branches with no rel32 form (loop, jecxz, xbegin) and anything pushed out of rel32 reach fail the relocation.
+class CodeRelocator
+{
+public:
+	// code can be a saved copy, originalAddress is where it actually ran. NOPs are dropped with skipNops, since hackable regions
+	// are padded with them to leave room for patches.
+	static bool relocate(const unsigned char* code, int length, void* originalAddress, void* newAddress, bool skipNops, std::vector<unsigned char>& outBytes);
+
+	// The relocated size doesn't depend on the destination, -1 if the code can't be relocated
+	static int getRelocatedSize(const unsigned char* code, int length, bool skipNops);
+
+private:
+	enum class InstructionKind
+	{
+		Copy,
+		RipRelative,
+		Call,
+		Jump,
+		ConditionalJump,
+		Skipped,
+	};
+
+	struct RelocatedInstruction
+	{
+		InstructionKind kind;
+		int originalOffset;
+		int originalLength;
+		int newOffset;
+		int newLength;
+		int displacementOffset;
+		int condition;
+		long long value;
+
+		RelocatedInstruction() : kind(InstructionKind::Copy), originalOffset(0), originalLength(0), newOffset(0), newLength(0), displacementOffset(0), condition(0), value(0) { }
+	};
+
+	static bool layout(const unsigned char* code, int length, bool skipNops, std::vector<RelocatedInstruction>& outInstructions, int* outSize);
+	static long long readSigned(const unsigned char* bytes, int size);
+	static bool fitsInt32(long long value);
+};
@@ -0,0 +1,1291 @@
+#include "DebugLocals.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+std::map<std::string, DebugLocals::ModuleIndex> DebugLocals::ModuleIndexes = std::map<std::string, DebugLocals::ModuleIndex>();
+std::mutex DebugLocals::IndexMutex;
+
+DebugLocals::LocalLocation DebugLocals::findLocal(std::string name, void* address)
+{
+	std::lock_guard<std::mutex> lock(DebugLocals::IndexMutex);
+
+	unsigned long long loadBias = 0;
+	const unsigned char* ehFrameHeader = nullptr;
+	ModuleIndex* moduleIndex = name.empty() ? nullptr : DebugLocals::getModuleIndex(address, &loadBias, &ehFrameHeader);
+
+	if (moduleIndex == nullptr)
+	{
+		return LocalLocation();
+	}
+
+	unsigned long long pc = (unsigned long long)address - loadBias;
+
+	// Functions are sorted by start address, so the enclosing one is the last that starts at or before pc
+	auto function = std::upper_bound(moduleIndex->functions.begin(), moduleIndex->functions.end(), pc, [](unsigned long long pc, const DebugFunction& next)
+	{
+		return pc < next.lowPc;
+	});
+
+	if (function == moduleIndex->functions.begin() || pc >= (--function)->highPc)
+	{
+		return LocalLocation();
+	}
+
+	const DebugLocal* bestLocal = nullptr;
+
+	for (size_t index = function->localsBegin; index < function->localsEnd; index++)
+	{
+		const DebugLocal& local = moduleIndex->locals[index];
+
+		if (local.nameLength != name.size() || pc < local.rangeStart || pc >= local.rangeEnd || moduleIndex->names.compare(local.nameOffset, local.nameLength, name) != 0)
+		{
+			continue;
+		}
+
+		// Shadowed names resolve to the innermost scope
+		if (bestLocal == nullptr || local.rangeEnd - local.rangeStart < bestLocal->rangeEnd - bestLocal->rangeStart)
+		{
+			bestLocal = &local;
+		}
+	}
+
+	if (bestLocal == nullptr)
+	{
+		return LocalLocation();
+	}
+
+	std::string baseRegister = "";
+	long long offset = bestLocal->offset;
+
+	switch (bestLocal->kind)
+	{
+		case LocationKind::Register:
+		{
+			std::string registerName = DebugLocals::getRegisterName(bestLocal->registerId, bestLocal->byteSize);
+
+			return registerName.empty() ? LocalLocation() : LocalLocation(LocalLocation::Kind::Register, registerName, bestLocal->byteSize);
+		}
+		case LocationKind::RegisterOffset:
+		{
+			baseRegister = DebugLocals::getRegisterName(bestLocal->registerId, sizeof(void*));
+			break;
+		}
+		case LocationKind::FrameOffset:
+		default:
+		{
+			int cfaRegisterId = 0;
+			long long cfaOffset = 0;
+
+			// The CFA is rsp-relative until (unless) a frame pointer is set up, so it has to be evaluated at this exact address
+			if (function->frameBaseKind == FrameBaseKind::CallFrameAddress && DebugLocals::findCallFrameAddress(ehFrameHeader, (unsigned long long)address, &cfaRegisterId, &cfaOffset))
+			{
+				baseRegister = DebugLocals::getRegisterName(cfaRegisterId, sizeof(void*));
+				offset += cfaOffset;
+			}
+			else if (function->frameBaseKind == FrameBaseKind::RegisterOffset)
+			{
+				baseRegister = DebugLocals::getRegisterName(function->frameBaseRegisterId, sizeof(void*));
+				offset += function->frameBaseOffset;
+			}
+
+			break;
+		}
+	}
+
+	if (baseRegister.empty())
+	{
+		return LocalLocation();
+	}
+
+	std::string operand = baseRegister + (offset == 0 ? "" : (offset < 0 ? "-" + std::to_string(-offset) : "+" + std::to_string(offset)));
+
+	return LocalLocation(LocalLocation::Kind::Memory, operand, bestLocal->byteSize);
+}
+
+std::string DebugLocals::getRegisterName(int registerId, int byteSize)
+{
+	// DWARF register numbering differs between x86 and x64
+	static const char* Registers64[] = { "rax", "rdx", "rcx", "rbx", "rsi", "rdi", "rbp", "rsp", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" };
+	static const char* Registers64As32[] = { "eax", "edx", "ecx", "ebx", "esi", "edi", "ebp", "esp", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" };
+	static const char* Registers32[] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi" };
+
+	if (sizeof(void*) == 8 && registerId >= 0 && registerId < 16)
+	{
+		return byteSize == 8 ? Registers64[registerId] : (byteSize == 4 ? Registers64As32[registerId] : "");
+	}
+	else if (sizeof(void*) == 4 && registerId >= 0 && registerId < 8)
+	{
+		return byteSize == 4 ? Registers32[registerId] : "";
+	}
+
+	return "";
+}
+
+#ifdef __linux__
+namespace
+{
+	struct DwarfSection
+	{
+		const unsigned char* data;
+		size_t size;
+
+		DwarfSection() : data(nullptr), size(0) { }
+	};
+
+	struct DwarfSections
+	{
+		DwarfSection info;
+		DwarfSection abbrev;
+		DwarfSection str;
+		DwarfSection lineStr;
+		DwarfSection strOffsets;
+		DwarfSection addr;
+		DwarfSection loc;
+		DwarfSection locLists;
+	};
+
+	struct DwarfReader
+	{
+		const unsigned char* data;
+		size_t size;
+		size_t offset;
+		bool failed;
+
+		DwarfReader(const DwarfSection& section, size_t offset) : data(section.data), size(section.size), offset(offset), failed(offset > section.size) { }
+
+		bool isAtEnd()
+		{
+			return this->failed || this->offset >= this->size;
+		}
+
+		unsigned long long readFixed(int byteCount)
+		{
+			if (this->failed || this->offset + byteCount > this->size)
+			{
+				this->failed = true;
+				return 0;
+			}
+
+			unsigned long long value = 0;
+
+			for (int index = 0; index < byteCount; index++)
+			{
+				value |= (unsigned long long)this->data[this->offset + index] << (index * 8);
+			}
+
+			this->offset += byteCount;
+
+			return value;
+		}
+
+		unsigned long long readUleb()
+		{
+			unsigned long long value = 0;
+
+			for (int shift = 0; !this->failed; shift += 7)
+			{
+				unsigned char next = (unsigned char)this->readFixed(1);
+
+				value |= shift < 64 ? (unsigned long long)(next & 0x7F) << shift : 0;
+
+				if ((next & 0x80) == 0)
+				{
+					break;
+				}
+			}
+
+			return value;
+		}
+
+		long long readSleb()
+		{
+			unsigned long long value = 0;
+			int shift = 0;
+			unsigned char next = 0;
+
+			do
+			{
+				next = (unsigned char)this->readFixed(1);
+				value |= shift < 64 ? (unsigned long long)(next & 0x7F) << shift : 0;
+				shift += 7;
+			} while ((next & 0x80) != 0 && !this->failed);
+
+			if (shift < 64 && (next & 0x40) != 0)
+			{
+				value |= ~0ULL << shift;
+			}
+
+			return (long long)value;
+		}
+
+		const char* readString()
+		{
+			const void* terminator = this->failed ? nullptr : memchr(this->data + this->offset, 0, this->size - this->offset);
+
+			if (terminator == nullptr)
+			{
+				this->failed = true;
+				return "";
+			}
+
+			const char* value = (const char*)(this->data + this->offset);
+
+			this->offset = (const unsigned char*)terminator - this->data + 1;
+
+			return value;
+		}
+
+		void skip(size_t count)
+		{
+			this->failed |= this->offset + count > this->size;
+			this->offset = this->failed ? this->size : this->offset + count;
+		}
+	};
+
+	struct DwarfUnit
+	{
+		size_t offset;
+		int version;
+		int addressSize;
+		unsigned long long baseAddress;
+		unsigned long long strOffsetsBase;
+		unsigned long long addrBase;
+		unsigned long long locListsBase;
+	};
+
+	struct DwarfAttributeSpec
+	{
+		unsigned long long name;
+		unsigned long long form;
+		long long implicitConst;
+	};
+
+	struct DwarfAbbrev
+	{
+		unsigned long long tag;
+		bool hasChildren;
+		std::vector<DwarfAttributeSpec> attributes;
+	};
+
+	struct DwarfValue
+	{
+		enum class Kind
+		{
+			None,
+			Constant,
+			Reference,
+			Address,
+			AddressIndex,
+			String,
+			LineString,
+			StringIndex,
+			Block,
+			SectionOffset,
+			LocListIndex,
+		};
+
+		Kind kind;
+		unsigned long long value;
+		const unsigned char* block;
+		size_t blockSize;
+		const char* string;
+
+		DwarfValue() : kind(Kind::None), value(0), block(nullptr), blockSize(0), string(nullptr) { }
+	};
+
+	struct DwarfScope
+	{
+		long long functionIndex;
+		unsigned long long rangeStart;
+		unsigned long long rangeEnd;
+	};
+
+	struct DwarfDieInfo
+	{
+		std::string name;
+		unsigned long long typeRef;
+		unsigned long long origin;
+		int byteSize;
+	};
+
+	struct PendingVariable
+	{
+		long long functionIndex;
+		DwarfDieInfo info;
+	};
+
+	struct PendingLocation
+	{
+		size_t variableIndex;
+		unsigned long long rangeStart;
+		unsigned long long rangeEnd;
+		int kind;
+		int registerId;
+		long long offset;
+	};
+
+	enum
+	{
+		DW_TAG_compile_unit = 0x11,
+		DW_TAG_partial_unit = 0x3c,
+		DW_TAG_subprogram = 0x2e,
+		DW_TAG_lexical_block = 0x0b,
+		DW_TAG_inlined_subroutine = 0x1d,
+		DW_TAG_variable = 0x34,
+		DW_TAG_formal_parameter = 0x05,
+		DW_TAG_pointer_type = 0x0f,
+		DW_TAG_reference_type = 0x10,
+		DW_TAG_rvalue_reference_type = 0x42,
+
+		DW_AT_location = 0x02,
+		DW_AT_name = 0x03,
+		DW_AT_byte_size = 0x0b,
+		DW_AT_low_pc = 0x11,
+		DW_AT_high_pc = 0x12,
+		DW_AT_abstract_origin = 0x31,
+		DW_AT_frame_base = 0x40,
+		DW_AT_type = 0x49,
+		DW_AT_str_offsets_base = 0x72,
+		DW_AT_addr_base = 0x73,
+		DW_AT_loclists_base = 0x8c,
+	};
+
+	DwarfValue readValue(DwarfReader& reader, unsigned long long form, long long implicitConst, const DwarfUnit& unit)
+	{
+		DwarfValue value = DwarfValue();
+
+		switch (form)
+		{
+			case 0x01: value.kind = DwarfValue::Kind::Address; value.value = reader.readFixed(unit.addressSize); break;
+			case 0x0b: value.kind = DwarfValue::Kind::Constant; value.value = reader.readFixed(1); break;
+			case 0x05: value.kind = DwarfValue::Kind::Constant; value.value = reader.readFixed(2); break;
+			case 0x06: value.kind = unit.version < 4 ? DwarfValue::Kind::SectionOffset : DwarfValue::Kind::Constant; value.value = reader.readFixed(4); break;
+			case 0x07: value.kind = unit.version < 4 ? DwarfValue::Kind::SectionOffset : DwarfValue::Kind::Constant; value.value = reader.readFixed(8); break;
+			case 0x1e: reader.skip(16); break;
+			case 0x0d: value.kind = DwarfValue::Kind::Constant; value.value = (unsigned long long)reader.readSleb(); break;
+			case 0x0f: value.kind = DwarfValue::Kind::Constant; value.value = reader.readUleb(); break;
+			case 0x21: value.kind = DwarfValue::Kind::Constant; value.value = (unsigned long long)implicitConst; break;
+			case 0x0c: value.kind = DwarfValue::Kind::Constant; value.value = reader.readFixed(1); break;
+			case 0x19: value.kind = DwarfValue::Kind::Constant; value.value = 1; break;
+			case 0x08: value.kind = DwarfValue::Kind::String; value.string = reader.readString(); break;
+			case 0x0e: value.kind = DwarfValue::Kind::String; value.value = reader.readFixed(4); break;
+			case 0x1f: value.kind = DwarfValue::Kind::LineString; value.value = reader.readFixed(4); break;
+			case 0x1a: case 0x1f02: value.kind = DwarfValue::Kind::StringIndex; value.value = reader.readUleb(); break;
+			case 0x25: value.kind = DwarfValue::Kind::StringIndex; value.value = reader.readFixed(1); break;
+			case 0x26: value.kind = DwarfValue::Kind::StringIndex; value.value = reader.readFixed(2); break;
+			case 0x27: value.kind = DwarfValue::Kind::StringIndex; value.value = reader.readFixed(3); break;
+			case 0x28: value.kind = DwarfValue::Kind::StringIndex; value.value = reader.readFixed(4); break;
+			case 0x1b: case 0x1f01: value.kind = DwarfValue::Kind::AddressIndex; value.value = reader.readUleb(); break;
+			case 0x29: value.kind = DwarfValue::Kind::AddressIndex; value.value = reader.readFixed(1); break;
+			case 0x2a: value.kind = DwarfValue::Kind::AddressIndex; value.value = reader.readFixed(2); break;
+			case 0x2b: value.kind = DwarfValue::Kind::AddressIndex; value.value = reader.readFixed(3); break;
+			case 0x2c: value.kind = DwarfValue::Kind::AddressIndex; value.value = reader.readFixed(4); break;
+			case 0x11: value.kind = DwarfValue::Kind::Reference; value.value = unit.offset + reader.readFixed(1); break;
+			case 0x12: value.kind = DwarfValue::Kind::Reference; value.value = unit.offset + reader.readFixed(2); break;
+			case 0x13: value.kind = DwarfValue::Kind::Reference; value.value = unit.offset + reader.readFixed(4); break;
+			case 0x14: value.kind = DwarfValue::Kind::Reference; value.value = unit.offset + reader.readFixed(8); break;
+			case 0x15: value.kind = DwarfValue::Kind::Reference; value.value = unit.offset + reader.readUleb(); break;
+			case 0x10: value.kind = DwarfValue::Kind::Reference; value.value = reader.readFixed(unit.version == 2 ? unit.addressSize : 4); break;
+			case 0x17: value.kind = DwarfValue::Kind::SectionOffset; value.value = reader.readFixed(4); break;
+			case 0x22: value.kind = DwarfValue::Kind::LocListIndex; value.value = reader.readUleb(); break;
+			case 0x23: reader.readUleb(); break;
+			case 0x1c: case 0x1d: case 0x1f20: case 0x1f21: reader.skip(4); break;
+			case 0x20: case 0x24: reader.skip(8); break;
+			case 0x0a: value.blockSize = (size_t)reader.readFixed(1); break;
+			case 0x03: value.blockSize = (size_t)reader.readFixed(2); break;
+			case 0x04: value.blockSize = (size_t)reader.readFixed(4); break;
+			case 0x09: case 0x18: value.blockSize = (size_t)reader.readUleb(); break;
+			case 0x16: return readValue(reader, reader.readUleb(), implicitConst, unit);
+			default: reader.failed = true; break;
+		}
+
+		// Block forms
+		if (form == 0x0a || form == 0x03 || form == 0x04 || form == 0x09 || form == 0x18)
+		{
+			value.kind = DwarfValue::Kind::Block;
+			value.block = reader.failed ? nullptr : reader.data + reader.offset;
+			reader.skip(value.blockSize);
+		}
+
+		return value;
+	}
+
+	const char* resolveString(const DwarfValue& value, const DwarfUnit& unit, const DwarfSections& sections)
+	{
+		if (value.kind == DwarfValue::Kind::String && value.string != nullptr)
+		{
+			return value.string;
+		}
+
+		unsigned long long stringOffset = value.value;
+
+		if (value.kind == DwarfValue::Kind::StringIndex)
+		{
+			DwarfReader offsetReader = DwarfReader(sections.strOffsets, (size_t)(unit.strOffsetsBase + value.value * 4));
+
+			stringOffset = offsetReader.readFixed(4);
+
+			if (offsetReader.failed)
+			{
+				return "";
+			}
+		}
+		else if (value.kind != DwarfValue::Kind::String && value.kind != DwarfValue::Kind::LineString)
+		{
+			return "";
+		}
+
+		const DwarfSection& section = value.kind == DwarfValue::Kind::LineString ? sections.lineStr : sections.str;
+
+		if (stringOffset >= section.size || memchr(section.data + stringOffset, 0, section.size - stringOffset) == nullptr)
+		{
+			return "";
+		}
+
+		return (const char*)(section.data + stringOffset);
+	}
+
+	unsigned long long resolveAddress(unsigned long long index, const DwarfUnit& unit, const DwarfSections& sections)
+	{
+		DwarfReader addressReader = DwarfReader(sections.addr, (size_t)(unit.addrBase + index * unit.addressSize));
+
+		return addressReader.readFixed(unit.addressSize);
+	}
+
+	// Only single-operation locations are used, anything composite (pieces, stack values, entry values) can't be named in an operand
+	bool decodeLocation(const unsigned char* expression, size_t size, PendingLocation& location)
+	{
+		DwarfSection section = DwarfSection();
+
+		section.data = expression;
+		section.size = size;
+
+		DwarfReader reader = DwarfReader(section, 0);
+		unsigned char op = (unsigned char)reader.readFixed(1);
+
+		if (op == 0x91)
+		{
+			location.kind = 0;
+			location.offset = reader.readSleb();
+		}
+		else if (op >= 0x50 && op <= 0x6F)
+		{
+			location.kind = 1;
+			location.registerId = op - 0x50;
+		}
+		else if (op == 0x90)
+		{
+			location.kind = 1;
+			location.registerId = (int)reader.readUleb();
+		}
+		else if (op >= 0x70 && op <= 0x8F)
+		{
+			location.kind = 2;
+			location.registerId = op - 0x70;
+			location.offset = reader.readSleb();
+		}
+		else if (op == 0x92)
+		{
+			location.kind = 2;
+			location.registerId = (int)reader.readUleb();
+			location.offset = reader.readSleb();
+		}
+		else
+		{
+			return false;
+		}
+
+		return !reader.failed && reader.offset == size;
+	}
+
+	void readLocationList(unsigned long long listOffset, const DwarfUnit& unit, const DwarfSections& sections, const DwarfScope& scope,
+		size_t variableIndex, std::vector<PendingLocation>& locations)
+	{
+		unsigned long long baseAddress = unit.baseAddress;
+		unsigned long long maxAddress = unit.addressSize == 8 ? ~0ULL : 0xFFFFFFFFULL;
+		DwarfReader reader = DwarfReader(unit.version < 5 ? sections.loc : sections.locLists, (size_t)listOffset);
+
+		while (!reader.isAtEnd())
+		{
+			unsigned long long rangeStart = 0;
+			unsigned long long rangeEnd = 0;
+
+			if (unit.version < 5)
+			{
+				rangeStart = reader.readFixed(unit.addressSize);
+				rangeEnd = reader.readFixed(unit.addressSize);
+
+				if (rangeStart == 0 && rangeEnd == 0)
+				{
+					break;
+				}
+				else if (rangeStart == maxAddress)
+				{
+					baseAddress = rangeEnd;
+					continue;
+				}
+
+				rangeStart += baseAddress;
+				rangeEnd += baseAddress;
+			}
+			else
+			{
+				unsigned char entryKind = (unsigned char)reader.readFixed(1);
+
+				switch (entryKind)
+				{
+					case 0x00: return;
+					case 0x01: baseAddress = resolveAddress(reader.readUleb(), unit, sections); continue;
+					case 0x02: rangeStart = resolveAddress(reader.readUleb(), unit, sections); rangeEnd = resolveAddress(reader.readUleb(), unit, sections); break;
+					case 0x03: rangeStart = resolveAddress(reader.readUleb(), unit, sections); rangeEnd = rangeStart + reader.readUleb(); break;
+					case 0x04: rangeStart = baseAddress + reader.readUleb(); rangeEnd = baseAddress + reader.readUleb(); break;
+					case 0x05: rangeStart = scope.rangeStart; rangeEnd = scope.rangeEnd; break;
+					case 0x06: baseAddress = reader.readFixed(unit.addressSize); continue;
+					case 0x07: rangeStart = reader.readFixed(unit.addressSize); rangeEnd = reader.readFixed(unit.addressSize); break;
+					case 0x08: rangeStart = reader.readFixed(unit.addressSize); rangeEnd = rangeStart + reader.readUleb(); break;
+					default: return;
+				}
+			}
+
+			size_t expressionSize = (size_t)(unit.version < 5 ? reader.readFixed(2) : reader.readUleb());
+			const unsigned char* expression = reader.data + std::min(reader.offset, reader.size);
+
+			reader.skip(expressionSize);
+
+			PendingLocation location = PendingLocation();
+
+			location.variableIndex = variableIndex;
+			location.rangeStart = rangeStart;
+			location.rangeEnd = rangeEnd;
+
+			if (!reader.failed && rangeStart < rangeEnd && decodeLocation(expression, expressionSize, location))
+			{
+				locations.push_back(location);
+			}
+		}
+	}
+
+	std::map<unsigned long long, DwarfAbbrev> readAbbrevTable(const DwarfSections& sections, size_t abbrevOffset)
+	{
+		std::map<unsigned long long, DwarfAbbrev> abbrevs = std::map<unsigned long long, DwarfAbbrev>();
+		DwarfReader reader = DwarfReader(sections.abbrev, abbrevOffset);
+
+		for (unsigned long long code = reader.readUleb(); code != 0 && !reader.failed; code = reader.readUleb())
+		{
+			DwarfAbbrev abbrev = DwarfAbbrev();
+
+			abbrev.tag = reader.readUleb();
+			abbrev.hasChildren = reader.readFixed(1) != 0;
+
+			for (;;)
+			{
+				DwarfAttributeSpec spec = DwarfAttributeSpec();
+
+				spec.name = reader.readUleb();
+				spec.form = reader.readUleb();
+				spec.implicitConst = spec.form == 0x21 ? reader.readSleb() : 0;
+
+				if ((spec.name == 0 && spec.form == 0) || reader.failed)
+				{
+					break;
+				}
+
+				abbrev.attributes.push_back(spec);
+			}
+
+			abbrevs[code] = abbrev;
+		}
+
+		return abbrevs;
+	}
+
+	unsigned long long readEncodedPointer(DwarfReader& reader, unsigned char encoding, unsigned long long dataBase)
+	{
+		unsigned long long fieldAddress = (unsigned long long)(reader.data + reader.offset);
+		unsigned long long value = 0;
+
+		switch (encoding & 0x0F)
+		{
+			case 0x00: value = reader.readFixed(sizeof(void*)); break;
+			case 0x01: value = reader.readUleb(); break;
+			case 0x02: value = reader.readFixed(2); break;
+			case 0x03: value = reader.readFixed(4); break;
+			case 0x04: case 0x0C: value = reader.readFixed(8); break;
+			case 0x09: value = (unsigned long long)reader.readSleb(); break;
+			case 0x0A: value = (unsigned long long)(long long)(short)reader.readFixed(2); break;
+			case 0x0B: value = (unsigned long long)(long long)(int)reader.readFixed(4); break;
+			default: reader.failed = true; return 0;
+		}
+
+		switch (encoding & 0x70)
+		{
+			case 0x00: return value;
+			case 0x10: return value + fieldAddress;
+			case 0x30: return value + dataBase;
+			default: reader.failed = true; return 0;
+		}
+	}
+
+	struct CfaRule
+	{
+		int registerId;
+		long long offset;
+		bool isValid;
+	};
+
+	// Runs call frame instructions up to (and including) the row for targetAddress, tracking only the CFA rule
+	bool runCallFrameProgram(DwarfReader& reader, size_t end, unsigned long long codeAlign, long long dataAlign, unsigned char fdeEncoding,
+		unsigned long long& location, unsigned long long targetAddress, CfaRule& rule, std::vector<CfaRule>& savedRules)
+	{
+		while (reader.offset < end && !reader.failed)
+		{
+			unsigned char op = (unsigned char)reader.readFixed(1);
+			unsigned long long advance = 0;
+
+			// The high two bits carry the opcode (and the low six the operand) for advance_loc, offset and restore
+			if ((op & 0xC0) == 0x40)
+			{
+				advance = (op & 0x3F) * codeAlign;
+			}
+			else if ((op & 0xC0) == 0x80)
+			{
+				reader.readUleb();
+			}
+			else if ((op & 0xC0) == 0x00)
+			{
+				switch (op)
+				{
+					case 0x00: break;
+					case 0x01: advance = readEncodedPointer(reader, fdeEncoding, 0) - location; break;
+					case 0x02: advance = reader.readFixed(1) * codeAlign; break;
+					case 0x03: advance = reader.readFixed(2) * codeAlign; break;
+					case 0x04: advance = reader.readFixed(4) * codeAlign; break;
+					case 0x05: case 0x09: case 0x14: case 0x2F: reader.readUleb(); reader.readUleb(); break;
+					case 0x06: case 0x07: case 0x08: case 0x2E: reader.readUleb(); break;
+					case 0x0A: savedRules.push_back(rule); break;
+					case 0x0B: if (!savedRules.empty()) { rule = savedRules.back(); savedRules.pop_back(); } break;
+					case 0x0C: rule.registerId = (int)reader.readUleb(); rule.offset = (long long)reader.readUleb(); rule.isValid = true; break;
+					case 0x0D: rule.registerId = (int)reader.readUleb(); break;
+					case 0x0E: rule.offset = (long long)reader.readUleb(); break;
+					case 0x0F: reader.skip((size_t)reader.readUleb()); rule.isValid = false; break;
+					case 0x10: case 0x16: reader.readUleb(); reader.skip((size_t)reader.readUleb()); break;
+					case 0x11: case 0x15: reader.readUleb(); reader.readSleb(); break;
+					case 0x12: rule.registerId = (int)reader.readUleb(); rule.offset = reader.readSleb() * dataAlign; rule.isValid = true; break;
+					case 0x13: rule.offset = reader.readSleb() * dataAlign; break;
+					default: reader.failed = true; break;
+				}
+			}
+
+			if (advance != 0 && location + advance > targetAddress)
+			{
+				return false;
+			}
+
+			location += advance;
+		}
+
+		return !reader.failed;
+	}
+}
+#endif
+
+bool DebugLocals::findCallFrameAddress(const unsigned char* ehFrameHeader, unsigned long long address, int* registerId, long long* offset)
+{
+#ifdef __linux__
+	if (ehFrameHeader == nullptr)
+	{
+		return false;
+	}
+
+	// The loaded .eh_frame_hdr holds a sorted (pc, fde) table, so the FDE lookup is a binary search over live memory
+	DwarfSection memory = DwarfSection();
+
+	memory.data = ehFrameHeader;
+	memory.size = (size_t)-1 - (size_t)ehFrameHeader;
+
+	DwarfReader headerReader = DwarfReader(memory, 0);
+	unsigned char version = (unsigned char)headerReader.readFixed(1);
+	unsigned char framePointerEncoding = (unsigned char)headerReader.readFixed(1);
+	unsigned char countEncoding = (unsigned char)headerReader.readFixed(1);
+	unsigned char tableEncoding = (unsigned char)headerReader.readFixed(1);
+
+	// Linkers always emit datarel sdata4 tables
+	if (version != 1 || tableEncoding != 0x3B || countEncoding == 0xFF)
+	{
+		return false;
+	}
+
+	readEncodedPointer(headerReader, framePointerEncoding, (unsigned long long)ehFrameHeader);
+
+	unsigned long long fdeCount = readEncodedPointer(headerReader, countEncoding, (unsigned long long)ehFrameHeader);
+	const int* table = (const int*)(ehFrameHeader + headerReader.offset);
+	unsigned long long low = 0;
+	unsigned long long high = fdeCount;
+
+	while (low < high)
+	{
+		unsigned long long middle = (low + high) / 2;
+
+		if ((unsigned long long)ehFrameHeader + (long long)table[middle * 2] <= address)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+
+	if (low == 0 || headerReader.failed)
+	{
+		return false;
+	}
+
+	memory.data = ehFrameHeader + table[(low - 1) * 2 + 1];
+	memory.size = (size_t)-1 - (size_t)memory.data;
+
+	DwarfReader fdeReader = DwarfReader(memory, 0);
+	size_t fdeEnd = (size_t)fdeReader.readFixed(4) + 4;
+	unsigned long long ciePointer = fdeReader.readFixed(4);
+
+	if (fdeEnd == 0xFFFFFFFF + 4ULL || ciePointer == 0)
+	{
+		return false;
+	}
+
+	DwarfSection cieMemory = DwarfSection();
+
+	cieMemory.data = memory.data + 4 - ciePointer;
+	cieMemory.size = (size_t)-1 - (size_t)cieMemory.data;
+
+	DwarfReader cieReader = DwarfReader(cieMemory, 0);
+	size_t cieEnd = (size_t)cieReader.readFixed(4) + 4;
+
+	cieReader.readFixed(4);
+
+	unsigned char cieVersion = (unsigned char)cieReader.readFixed(1);
+	std::string augmentation = cieReader.readString();
+
+	if (cieVersion >= 4)
+	{
+		cieReader.readFixed(2);
+	}
+
+	unsigned long long codeAlign = cieReader.readUleb();
+	long long dataAlign = cieReader.readSleb();
+	unsigned char fdeEncoding = 0;
+
+	if (cieVersion == 1)
+	{
+		cieReader.readFixed(1);
+	}
+	else
+	{
+		cieReader.readUleb();
+	}
+
+	if (!augmentation.empty() && augmentation[0] == 'z')
+	{
+		size_t augmentationEnd = (size_t)cieReader.readUleb();
+
+		augmentationEnd += cieReader.offset;
+
+		for (size_t index = 1; index < augmentation.size(); index++)
+		{
+			if (augmentation[index] == 'R')
+			{
+				fdeEncoding = (unsigned char)cieReader.readFixed(1);
+			}
+			else if (augmentation[index] == 'P')
+			{
+				readEncodedPointer(cieReader, (unsigned char)cieReader.readFixed(1) & 0x7F, 0);
+			}
+			else if (augmentation[index] == 'L')
+			{
+				cieReader.readFixed(1);
+			}
+		}
+
+		cieReader.offset = augmentationEnd;
+	}
+	else if (!augmentation.empty())
+	{
+		return false;
+	}
+
+	unsigned long long location = readEncodedPointer(fdeReader, fdeEncoding, 0);
+	unsigned long long range = readEncodedPointer(fdeReader, fdeEncoding & 0x0F, 0);
+
+	if (address < location || address >= location + range)
+	{
+		return false;
+	}
+
+	if (!augmentation.empty())
+	{
+		fdeReader.skip((size_t)fdeReader.readUleb());
+	}
+
+	CfaRule rule = CfaRule();
+	std::vector<CfaRule> savedRules = std::vector<CfaRule>();
+
+	rule.isValid = false;
+
+	runCallFrameProgram(cieReader, cieEnd, codeAlign, dataAlign, fdeEncoding, location, address, rule, savedRules);
+	runCallFrameProgram(fdeReader, fdeEnd, codeAlign, dataAlign, fdeEncoding, location, address, rule, savedRules);
+
+	if (!rule.isValid || cieReader.failed || fdeReader.failed)
+	{
+		return false;
+	}
+
+	*registerId = rule.registerId;
+	*offset = rule.offset;
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+DebugLocals::ModuleIndex* DebugLocals::getModuleIndex(void* address, unsigned long long* loadBias, const unsigned char** ehFrameHeader)
+{
+#ifdef __linux__
+	struct ModuleSearch
+	{
+		unsigned long long address;
+		std::string path;
+		unsigned long long loadBias;
+		const unsigned char* ehFrameHeader;
+		bool found;
+	};
+
+	ModuleSearch search = ModuleSearch();
+
+	search.address = (unsigned long long)address;
+	search.ehFrameHeader = nullptr;
+	search.found = false;
+
+	dl_iterate_phdr([](struct dl_phdr_info* info, size_t, void* data) -> int
+	{
+		ModuleSearch* search = (ModuleSearch*)data;
+		const unsigned char* ehFrameHeader = nullptr;
+
+		for (int index = 0; index < info->dlpi_phnum; index++)
+		{
+			const ElfW(Phdr)& header = info->dlpi_phdr[index];
+			unsigned long long segmentStart = info->dlpi_addr + header.p_vaddr;
+
+			ehFrameHeader = header.p_type == PT_GNU_EH_FRAME ? (const unsigned char*)segmentStart : ehFrameHeader;
+
+			if (header.p_type == PT_LOAD && search->address >= segmentStart && search->address < segmentStart + header.p_memsz)
+			{
+				search->path = (info->dlpi_name == nullptr || info->dlpi_name[0] == '\0') ? "/proc/self/exe" : info->dlpi_name;
+				search->loadBias = info->dlpi_addr;
+				search->found = true;
+			}
+		}
+
+		search->ehFrameHeader = search->found ? ehFrameHeader : nullptr;
+
+		return search->found ? 1 : 0;
+	}, &search);
+
+	if (!search.found)
+	{
+		return nullptr;
+	}
+
+	*loadBias = search.loadBias;
+	*ehFrameHeader = search.ehFrameHeader;
+
+	if (DebugLocals::ModuleIndexes.find(search.path) == DebugLocals::ModuleIndexes.end())
+	{
+		DebugLocals::buildModuleIndex(search.path, &DebugLocals::ModuleIndexes[search.path]);
+	}
+
+	return &DebugLocals::ModuleIndexes[search.path];
+#else
+	return nullptr;
+#endif
+}
+
+void DebugLocals::buildModuleIndex(std::string modulePath, ModuleIndex* moduleIndex)
+{
+#ifdef __linux__
+	int fileDescriptor = open(modulePath.c_str(), O_RDONLY);
+	struct stat fileStat;
+
+	if (fileDescriptor < 0)
+	{
+		return;
+	}
+
+	void* image = (fstat(fileDescriptor, &fileStat) == 0 && fileStat.st_size >= (off_t)sizeof(ElfW(Ehdr)))
+		? mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0) : MAP_FAILED;
+
+	close(fileDescriptor);
+
+	if (image == MAP_FAILED)
+	{
+		return;
+	}
+
+	const unsigned char* imageBytes = (const unsigned char*)image;
+	const ElfW(Ehdr)* header = (const ElfW(Ehdr)*)image;
+	size_t imageSize = (size_t)fileStat.st_size;
+	DwarfSections sections = DwarfSections();
+
+	if (memcmp(imageBytes, ELFMAG, SELFMAG) == 0 && header->e_shoff != 0 && header->e_shstrndx < header->e_shnum
+		&& header->e_shoff + (unsigned long long)header->e_shnum * sizeof(ElfW(Shdr)) <= imageSize)
+	{
+		const ElfW(Shdr)* sectionHeaders = (const ElfW(Shdr)*)(imageBytes + header->e_shoff);
+		const ElfW(Shdr)& nameSection = sectionHeaders[header->e_shstrndx];
+
+		for (int index = 0; index < header->e_shnum && nameSection.sh_offset + nameSection.sh_size <= imageSize; index++)
+		{
+			const ElfW(Shdr)& section = sectionHeaders[index];
+
+			// Compressed (SHF_COMPRESSED) debug sections are not supported
+			if (section.sh_name >= nameSection.sh_size || section.sh_offset + section.sh_size > imageSize || (section.sh_flags & SHF_COMPRESSED) != 0)
+			{
+				continue;
+			}
+
+			std::string sectionName = std::string((const char*)(imageBytes + nameSection.sh_offset + section.sh_name));
+			DwarfSection dwarfSection = DwarfSection();
+
+			dwarfSection.data = imageBytes + section.sh_offset;
+			dwarfSection.size = section.sh_size;
+
+			if (sectionName == ".debug_info") sections.info = dwarfSection;
+			else if (sectionName == ".debug_abbrev") sections.abbrev = dwarfSection;
+			else if (sectionName == ".debug_str") sections.str = dwarfSection;
+			else if (sectionName == ".debug_line_str") sections.lineStr = dwarfSection;
+			else if (sectionName == ".debug_str_offsets") sections.strOffsets = dwarfSection;
+			else if (sectionName == ".debug_addr") sections.addr = dwarfSection;
+			else if (sectionName == ".debug_loc") sections.loc = dwarfSection;
+			else if (sectionName == ".debug_loclists") sections.locLists = dwarfSection;
+		}
+	}
+
+	std::unordered_map<unsigned long long, DwarfDieInfo> dieInfos = std::unordered_map<unsigned long long, DwarfDieInfo>();
+	std::map<size_t, std::map<unsigned long long, DwarfAbbrev>> abbrevTables = std::map<size_t, std::map<unsigned long long, DwarfAbbrev>>();
+	std::vector<PendingVariable> variables = std::vector<PendingVariable>();
+	std::vector<PendingLocation> locations = std::vector<PendingLocation>();
+	DwarfReader unitReader = DwarfReader(sections.info, 0);
+
+	while (!unitReader.isAtEnd())
+	{
+		DwarfUnit unit = DwarfUnit();
+
+		unit.offset = unitReader.offset;
+
+		unsigned long long unitLength = unitReader.readFixed(4);
+
+		// 64-bit DWARF is not supported
+		if (unitLength >= 0xFFFFFFF0ULL || unitReader.failed)
+		{
+			break;
+		}
+
+		size_t unitEnd = unitReader.offset + (size_t)unitLength;
+		size_t abbrevOffset = 0;
+		unsigned char unitType = 1;
+
+		unit.version = (int)unitReader.readFixed(2);
+
+		if (unit.version >= 5)
+		{
+			unitType = (unsigned char)unitReader.readFixed(1);
+			unit.addressSize = (int)unitReader.readFixed(1);
+			abbrevOffset = (size_t)unitReader.readFixed(4);
+		}
+		else
+		{
+			abbrevOffset = (size_t)unitReader.readFixed(4);
+			unit.addressSize = (int)unitReader.readFixed(1);
+		}
+
+		// Only full/partial compile units carry function bodies
+		if (unit.version < 2 || unit.version > 5 || (unitType != 1 && unitType != 3) || (unit.addressSize != 4 && unit.addressSize != 8))
+		{
+			unitReader.offset = unitEnd;
+			continue;
+		}
+
+		unit.strOffsetsBase = 8;
+		unit.addrBase = 8;
+		unit.locListsBase = 12;
+
+		if (abbrevTables.find(abbrevOffset) == abbrevTables.end())
+		{
+			abbrevTables[abbrevOffset] = readAbbrevTable(sections, abbrevOffset);
+		}
+
+		const std::map<unsigned long long, DwarfAbbrev>& abbrevs = abbrevTables[abbrevOffset];
+		std::vector<DwarfScope> scopes = std::vector<DwarfScope>();
+		DwarfReader dieReader = DwarfReader(sections.info, unitReader.offset);
+
+		dieReader.size = std::min(unitEnd, sections.info.size);
+
+		while (!dieReader.isAtEnd())
+		{
+			unsigned long long dieOffset = dieReader.offset;
+			unsigned long long code = dieReader.readUleb();
+
+			if (code == 0)
+			{
+				if (!scopes.empty())
+				{
+					scopes.pop_back();
+				}
+
+				continue;
+			}
+
+			auto abbrev = abbrevs.find(code);
+
+			if (abbrev == abbrevs.end())
+			{
+				break;
+			}
+
+			DwarfValue name, lowPc, highPc, location, frameBase, type, byteSize, origin;
+
+			for (auto spec : abbrev->second.attributes)
+			{
+				DwarfValue value = readValue(dieReader, spec.form, spec.implicitConst, unit);
+
+				switch (spec.name)
+				{
+					case DW_AT_name: name = value; break;
+					case DW_AT_low_pc: lowPc = value; break;
+					case DW_AT_high_pc: highPc = value; break;
+					case DW_AT_location: location = value; break;
+					case DW_AT_frame_base: frameBase = value; break;
+					case DW_AT_type: type = value; break;
+					case DW_AT_byte_size: byteSize = value; break;
+					case DW_AT_abstract_origin: origin = value; break;
+					case DW_AT_str_offsets_base: unit.strOffsetsBase = value.value; break;
+					case DW_AT_addr_base: unit.addrBase = value.value; break;
+					case DW_AT_loclists_base: unit.locListsBase = value.value; break;
+					default: break;
+				}
+			}
+
+			unsigned long long tag = abbrev->second.tag;
+			DwarfScope parentScope = scopes.empty() ? DwarfScope{ -1, 0, 0 } : scopes.back();
+			DwarfScope scope = parentScope;
+			bool hasRange = lowPc.kind != DwarfValue::Kind::None && highPc.kind != DwarfValue::Kind::None;
+			unsigned long long rangeStart = lowPc.kind == DwarfValue::Kind::AddressIndex ? resolveAddress(lowPc.value, unit, sections) : lowPc.value;
+			unsigned long long rangeEnd = highPc.kind == DwarfValue::Kind::AddressIndex ? resolveAddress(highPc.value, unit, sections) : highPc.value;
+
+			// A constant high_pc is a length rather than an address
+			rangeEnd = highPc.kind == DwarfValue::Kind::Constant ? rangeStart + rangeEnd : rangeEnd;
+
+			if (tag == DW_TAG_compile_unit || tag == DW_TAG_partial_unit)
+			{
+				unit.baseAddress = rangeStart;
+			}
+			else if (tag == DW_TAG_subprogram)
+			{
+				scope.functionIndex = -1;
+
+				if (hasRange)
+				{
+					DebugFunction function = DebugFunction();
+					DwarfSection expression = DwarfSection();
+
+					expression.data = frameBase.block;
+					expression.size = frameBase.blockSize;
+
+					DwarfReader frameBaseReader = DwarfReader(expression, 0);
+					unsigned char op = frameBase.kind == DwarfValue::Kind::Block ? (unsigned char)frameBaseReader.readFixed(1) : 0;
+
+					function.lowPc = rangeStart;
+					function.highPc = rangeEnd;
+
+					if (op == 0x9C)
+					{
+						function.frameBaseKind = FrameBaseKind::CallFrameAddress;
+					}
+					else if (op >= 0x50 && op <= 0x6F)
+					{
+						function.frameBaseKind = FrameBaseKind::RegisterOffset;
+						function.frameBaseRegisterId = op - 0x50;
+					}
+					else if (op >= 0x70 && op <= 0x8F)
+					{
+						function.frameBaseKind = FrameBaseKind::RegisterOffset;
+						function.frameBaseRegisterId = op - 0x70;
+						function.frameBaseOffset = frameBaseReader.readSleb();
+					}
+
+					scope.functionIndex = (long long)moduleIndex->functions.size();
+					scope.rangeStart = rangeStart;
+					scope.rangeEnd = rangeEnd;
+					moduleIndex->functions.push_back(function);
+				}
+			}
+			else if ((tag == DW_TAG_lexical_block || tag == DW_TAG_inlined_subroutine) && hasRange)
+			{
+				scope.rangeStart = rangeStart;
+				scope.rangeEnd = rangeEnd;
+			}
+
+			// Names and types are kept for every DIE so that abstract origins and type chains can be followed once all units are read
+			if (name.kind != DwarfValue::Kind::None || type.kind != DwarfValue::Kind::None || byteSize.kind != DwarfValue::Kind::None || origin.kind != DwarfValue::Kind::None)
+			{
+				DwarfDieInfo dieInfo = DwarfDieInfo();
+				bool isPointer = tag == DW_TAG_pointer_type || tag == DW_TAG_reference_type || tag == DW_TAG_rvalue_reference_type;
+
+				dieInfo.name = (tag == DW_TAG_variable || tag == DW_TAG_formal_parameter) ? resolveString(name, unit, sections) : "";
+				dieInfo.typeRef = type.kind == DwarfValue::Kind::Reference ? type.value : 0;
+				dieInfo.origin = origin.kind == DwarfValue::Kind::Reference ? origin.value : 0;
+				dieInfo.byteSize = (byteSize.kind == DwarfValue::Kind::Constant || byteSize.kind == DwarfValue::Kind::SectionOffset) ? (int)byteSize.value : (isPointer ? unit.addressSize : 0);
+				dieInfos[dieOffset] = dieInfo;
+
+				if ((tag == DW_TAG_variable || tag == DW_TAG_formal_parameter) && parentScope.functionIndex >= 0 && location.kind != DwarfValue::Kind::None)
+				{
+					PendingVariable variable = PendingVariable();
+
+					variable.functionIndex = parentScope.functionIndex;
+					variable.info = dieInfo;
+					variables.push_back(variable);
+
+					if (location.kind == DwarfValue::Kind::Block)
+					{
+						PendingLocation pendingLocation = PendingLocation();
+
+						pendingLocation.variableIndex = variables.size() - 1;
+						pendingLocation.rangeStart = parentScope.rangeStart;
+						pendingLocation.rangeEnd = parentScope.rangeEnd;
+
+						if (decodeLocation(location.block, location.blockSize, pendingLocation))
+						{
+							locations.push_back(pendingLocation);
+						}
+					}
+					else if (location.kind == DwarfValue::Kind::SectionOffset)
+					{
+						readLocationList(location.value, unit, sections, parentScope, variables.size() - 1, locations);
+					}
+					else if (location.kind == DwarfValue::Kind::LocListIndex)
+					{
+						DwarfReader offsetReader = DwarfReader(sections.locLists, (size_t)(unit.locListsBase + location.value * 4));
+						unsigned long long listOffset = offsetReader.readFixed(4);
+
+						if (!offsetReader.failed)
+						{
+							readLocationList(unit.locListsBase + listOffset, unit, sections, parentScope, variables.size() - 1, locations);
+						}
+					}
+				}
+			}
+
+			if (abbrev->second.hasChildren)
+			{
+				scopes.push_back(scope);
+			}
+		}
+
+		unitReader.offset = unitEnd;
+	}
+
+	munmap(image, fileStat.st_size);
+
+	// Fill in names and sizes from abstract origins (inlined or out-of-line copies) and type chains
+	std::vector<unsigned int> nameOffsets = std::vector<unsigned int>();
+
+	for (auto& variable : variables)
+	{
+		for (int hop = 0; hop < 8 && variable.info.origin != 0 && (variable.info.name.empty() || variable.info.typeRef == 0); hop++)
+		{
+			auto originInfo = dieInfos.find(variable.info.origin);
+
+			if (originInfo == dieInfos.end())
+			{
+				break;
+			}
+
+			variable.info.name = variable.info.name.empty() ? originInfo->second.name : variable.info.name;
+			variable.info.typeRef = variable.info.typeRef == 0 ? originInfo->second.typeRef : variable.info.typeRef;
+			variable.info.origin = originInfo->second.origin;
+		}
+
+		for (int hop = 0; hop < 16 && variable.info.byteSize == 0 && variable.info.typeRef != 0; hop++)
+		{
+			auto typeInfo = dieInfos.find(variable.info.typeRef);
+
+			if (typeInfo == dieInfos.end())
+			{
+				break;
+			}
+
+			variable.info.byteSize = typeInfo->second.byteSize;
+			variable.info.typeRef = typeInfo->second.typeRef;
+		}
+
+		nameOffsets.push_back((unsigned int)moduleIndex->names.size());
+		moduleIndex->names += variable.info.name;
+	}
+
+	// Group locals by function so each function owns a contiguous slice
+	std::stable_sort(locations.begin(), locations.end(), [&](const PendingLocation& left, const PendingLocation& right)
+	{
+		return variables[left.variableIndex].functionIndex < variables[right.variableIndex].functionIndex;
+	});
+
+	for (auto& function : moduleIndex->functions)
+	{
+		function.localsBegin = function.localsEnd = 0;
+	}
+
+	for (auto location : locations)
+	{
+		const PendingVariable& variable = variables[location.variableIndex];
+
+		if (variable.info.name.empty())
+		{
+			continue;
+		}
+
+		DebugLocal local = DebugLocal();
+		DebugFunction& function = moduleIndex->functions[(size_t)variable.functionIndex];
+
+		local.nameOffset = nameOffsets[location.variableIndex];
+		local.nameLength = (unsigned int)variable.info.name.size();
+		local.rangeStart = location.rangeStart;
+		local.rangeEnd = location.rangeEnd;
+		local.kind = location.kind == 0 ? LocationKind::FrameOffset : (location.kind == 1 ? LocationKind::Register : LocationKind::RegisterOffset);
+		local.registerId = location.registerId;
+		local.offset = location.offset;
+		local.byteSize = variable.info.byteSize;
+
+		if (function.localsEnd == 0)
+		{
+			function.localsBegin = moduleIndex->locals.size();
+		}
+
+		moduleIndex->locals.push_back(local);
+		function.localsEnd = moduleIndex->locals.size();
+	}
+
+	std::sort(moduleIndex->functions.begin(), moduleIndex->functions.end(), [](const DebugFunction& left, const DebugFunction& right)
+	{
+		return left.lowPc < right.lowPc;
+	});
+#endif
+}
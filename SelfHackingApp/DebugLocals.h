@@ -0,0 +1,91 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Maps the names of a function's locals and parameters to where they live at a given address, using the DWARF info of the
+// module containing that address. This lets patches write 'sub [health], 10' against the function's real locals.
+// Each module's .debug_info is parsed once into a compact per-function index. Stack locals are addressed from the CFA in effect at
+// the given address (read from the live .eh_frame), so they resolve with or without a frame pointer. Windows (PDB) builds always report no location.
+class DebugLocals
+{
+public:
+	struct LocalLocation
+	{
+		enum class Kind
+		{
+			None,
+			Register,
+			Memory,
+		};
+
+		Kind kind;
+
+		// Register name (ie 'ebx') or memory operand without brackets (ie 'rbp-20')
+		std::string operand;
+		int byteSize;
+
+		LocalLocation() : kind(Kind::None), operand(""), byteSize(0) { }
+		LocalLocation(Kind kind, std::string operand, int byteSize) : kind(kind), operand(operand), byteSize(byteSize) { }
+	};
+
+	static LocalLocation findLocal(std::string name, void* address);
+
+private:
+	enum class LocationKind
+	{
+		FrameOffset,
+		Register,
+		RegisterOffset,
+	};
+
+	enum class FrameBaseKind
+	{
+		Unknown,
+		CallFrameAddress,
+		RegisterOffset,
+	};
+
+	struct DebugLocal
+	{
+		unsigned int nameOffset;
+		unsigned int nameLength;
+		unsigned long long rangeStart;
+		unsigned long long rangeEnd;
+		LocationKind kind;
+		int registerId;
+		long long offset;
+		int byteSize;
+
+		DebugLocal() : nameOffset(0), nameLength(0), rangeStart(0), rangeEnd(0), kind(LocationKind::FrameOffset), registerId(0), offset(0), byteSize(0) { }
+	};
+
+	struct DebugFunction
+	{
+		unsigned long long lowPc;
+		unsigned long long highPc;
+		FrameBaseKind frameBaseKind;
+		int frameBaseRegisterId;
+		long long frameBaseOffset;
+		size_t localsBegin;
+		size_t localsEnd;
+
+		DebugFunction() : lowPc(0), highPc(0), frameBaseKind(FrameBaseKind::Unknown), frameBaseRegisterId(0), frameBaseOffset(0), localsBegin(0), localsEnd(0) { }
+	};
+
+	struct ModuleIndex
+	{
+		std::vector<DebugFunction> functions;
+		std::vector<DebugLocal> locals;
+		std::string names;
+	};
+
+	static ModuleIndex* getModuleIndex(void* address, unsigned long long* loadBias, const unsigned char** ehFrameHeader);
+	static bool findCallFrameAddress(const unsigned char* ehFrameHeader, unsigned long long address, int* registerId, long long* offset);
+	static void buildModuleIndex(std::string modulePath, ModuleIndex* moduleIndex);
+	static std::string getRegisterName(int registerId, int byteSize);
+
+	static std::map<std::string, ModuleIndex> ModuleIndexes;
+	static std::mutex IndexMutex;
+};
@@ -1,409 +1,1140 @@
 #include "HackUtils.h"
 
 #include <algorithm>
+#include <atomic>
 #include <bitset>
+#include <cctype>
+#include <cstdlib>
 #include <iomanip>
-#include <regex>
 #include <sstream>
+#include <thread>
 
 #if __GNUC__ || __clang__
 #include <unistd.h>
 #include <sys/mman.h>
 #endif
 
+#ifdef _WIN32
+#include <io.h>
+#endif
+
+#if _MSC_VER
+#include <intrin.h>
+#include <nmmintrin.h>
+#define CRC32C_TARGET
+#elif __x86_64__ || __i386__
+#include <nmmintrin.h>
+#define CRC32C_TARGET __attribute__((target("sse4.2")))
+#endif
+
+#include "DebugLocals.h"
+#include "PeepholeOptimizer.h"
 #include "StrUtils.h"
+#include "SymbolTable.h"
 #include "External/asmjit/asmjit.h"
 #include "External/asmtk/asmtk.h"
 #include "External/libudis86/udis86.h"
 
+// The Intel translator below reads the prefix flags and register names udis86 keeps internal
+extern "C"
+{
+#include "External/libudis86/decode.h"
+#include "External/libudis86/syn.h"
+}
+
 using namespace asmjit;
 using namespace asmtk;
 
-void HackUtils::setAllMemoryPermissions(void* address, int length)
+HackUtils::DisassemblyCacheShard HackUtils::DisassemblyCacheShards[HackUtils::DisassemblyCacheShardCount];
+const int HackUtils::MaxCachedLength = 4096;
+const int HackUtils::MaxDisassemblyCacheEntries = 4096;
+
+static CRC32C_TARGET unsigned int crc32cHardware(const unsigned char* data, int length)
 {
-#ifdef _WIN32
-	DWORD old;
-	VirtualProtect(address, length, PAGE_EXECUTE_READWRITE, &old);
-#else
-	// Unix requires changing memory protection on the start of the page, not just the address
-	size_t pageSize = sysconf(_SC_PAGESIZE);
-	void* pageStart = (void*)((unsigned long)address & -pageSize);
-	int newLength = (int)((unsigned long)address + length - (unsigned long)pageStart);
+	unsigned int crc = 0xFFFFFFFF;
+	int index = 0;
 
-	mprotect(pageStart, newLength, PROT_READ | PROT_WRITE | PROT_EXEC);
+#if _WIN64 || __x86_64__
+	unsigned long long wideCrc = crc;
+
+	for (; index + 8 <= length; index += 8)
+	{
+		unsigned long long next;
+
+		memcpy(&next, data + index, sizeof(next));
+		wideCrc = _mm_crc32_u64(wideCrc, next);
+	}
+
+	crc = (unsigned int)wideCrc;
 #endif
-}
 
-void HackUtils::writeMemory(void* to, void* from, int length)
-{
-	HackUtils::setAllMemoryPermissions(to, length);
-	HackUtils::setAllMemoryPermissions(from, length);
+	for (; index + 4 <= length; index += 4)
+	{
+		unsigned int next;
 
-	memcpy(to, from, length);
+		memcpy(&next, data + index, sizeof(next));
+		crc = _mm_crc32_u32(crc, next);
+	}
+
+	for (; index < length; index++)
+	{
+		crc = _mm_crc32_u8(crc, data[index]);
+	}
+
+	return ~crc;
 }
 
-std::string HackUtils::preProcessAssembly(std::string assembly)
+static unsigned int crc32cSoftware(const unsigned char* data, int length)
 {
-	std::string processedAssembly = "";
+	unsigned int crc = 0xFFFFFFFF;
 
-	auto floatParser = [&](std::string const& match)
+	for (int index = 0; index < length; index++)
 	{
-		std::string matchTrimmed = StrUtils::rtrim(match, "f");
-		std::istringstream iss(matchTrimmed);
-		float parsedFloat;
+		crc ^= data[index];
 
-		if (iss >> parsedFloat)
+		for (int bit = 0; bit < 8; bit++)
 		{
-			int floatAsRawIntBytes = *(int*)(&parsedFloat);
-			processedAssembly += HackUtils::toHex(floatAsRawIntBytes, true);
+			crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
 		}
-		else
+	}
+
+	return ~crc;
+}
+
+// CRC32C of a code region, using the SSE4.2 crc32 instruction when the CPU has it (a 64 byte region is 8 instructions)
+static unsigned int crc32c(const unsigned char* data, int length)
+{
+#if _MSC_VER
+	static const bool hasHardwareCrc = []()
+	{
+		int cpuInfo[4];
+
+		__cpuid(cpuInfo, 1);
+
+		return (cpuInfo[2] & (1 << 20)) != 0;
+	}();
+#else
+	static const bool hasHardwareCrc = __builtin_cpu_supports("sse4.2");
+#endif
+
+	return hasHardwareCrc ? crc32cHardware(data, length) : crc32cSoftware(data, length);
+}
+
+// Whether the snippet defines 'name:' itself, not counting longer names that merely end in it
+static bool definesLabel(const std::string& assembly, const std::string& name)
+{
+	for (size_t next = assembly.find(name + ":"); next != std::string::npos; next = assembly.find(name + ":", next + 1))
+	{
+		if (next == 0 || (!std::isalnum((unsigned char)assembly[next - 1]) && assembly[next - 1] != '_'))
 		{
-			processedAssembly += match;
+			return true;
 		}
-	};
+	}
 
-	std::regex reg("[-]?[0-9]*\\.[0-9]+f");
-	std::sregex_token_iterator begin(assembly.begin(), assembly.end(), reg, { -1, 0 }), end;
-	std::for_each(begin, end, floatParser);
+	return false;
+}
 
-	// Convert to normalized comment formats
-	processedAssembly = StrUtils::replaceAll(processedAssembly, "//", ";");
+// Bare operands that name a global or function (ie 'call applyBuff') resolve to the symbol's address. asmtk passes in a
+// default Label operand and only creates the named label if the operand comes back empty, so misses have to reset it.
+// Labels defined later in the snippet (ie 'jz exit ... exit:') aren't bound yet when their first use is parsed, so they
+// are looked for in the input first and win over symbols of the same name.
+static Error ASMJIT_CDECL resolveUnknownSymbol(AsmParser* parser, Operand* out, const char* name, size_t size)
+{
+	std::string assembly = std::string(parser->input(), (const char*)parser->_tokenizer._end);
+	void* address = definesLabel(assembly, std::string(name, size)) ? nullptr : SymbolTable::resolveSymbol(name, size);
+
+	if (address != nullptr)
+	{
+		*out = Imm((uint64_t)address);
+	}
+	else
+	{
+		out->reset();
+	}
 
-	return processedAssembly;
+	return kErrorOk;
 }
 
-HackUtils::CompileResult HackUtils::assemble(std::string assembly, void* addressStart)
+// Kept in the opaque data of every decoder translateIntelDecimal is set on. Lines are written into text, which grows to fit, so
+// long symbol names are never cut off at the end of udis86's own 128 byte buffer. next/end feed decoders that stream their input.
+struct TranslatorState
 {
-	CompileResult compileResult;
+	std::string text;
+	const unsigned char* next;
+	const unsigned char* end;
 
-	CodeInfo ci(sizeof(void*) == 4 ? ArchInfo::kIdX86 : ArchInfo::kIdX64);
-	CodeHolder code;
-	code.init(ci);
+	TranslatorState() : text(""), next(nullptr), end(nullptr) { }
+};
 
-	// Attach X86Assembler `code`.
-	x86::Assembler a(&code);
+static void appendUnsigned(std::string& text, unsigned long long value)
+{
+	char digits[20];
+	int digitCount = 0;
 
-	// Create AsmParser that will emit to X86Assembler.
-	AsmParser p(&a);
+	do
+	{
+		digits[digitCount++] = (char)('0' + value % 10);
+		value /= 10;
+	} while (value != 0);
 
-	// Parse the assembly.
-	assembly = preProcessAssembly(assembly);
-	Error err = p.parse(assembly.c_str());
+	while (digitCount > 0)
+	{
+		text += digits[--digitCount];
+	}
+}
 
-	// Error handling (use asmjit::ErrorHandler for more robust error handling).
-	if (err)
+static void appendSigned(std::string& text, long long value, bool withPlus)
+{
+	if (value < 0)
 	{
-		compileResult.hasError = true;
-		compileResult.errorData.lineNumber = 0;
+		text += '-';
+	}
+	else if (withPlus)
+	{
+		text += '+';
+	}
 
-		switch ((CompileResult::ErrorId) err)
-		{
-		case CompileResult::ErrorId::Ok:
+	appendUnsigned(text, value < 0 ? 0ull - (unsigned long long)value : (unsigned long long)value);
+}
+
+static void appendSizeCast(ud_t* ud, const ud_operand& operand, std::string& text)
+{
+	text += ud->br_far ? "far " : "";
+
+	switch (operand.size)
+	{
+		case 8: text += "byte "; break;
+		case 16: text += "word "; break;
+		case 32: text += "dword "; break;
+		case 64: text += "qword "; break;
+		case 80: text += "tword "; break;
+		case 128: text += "oword "; break;
+		case 256: text += "yword "; break;
+		default: break;
+	}
+}
+
+// Same text as udis86's gen_operand() in syn-intel.c, with immediates, displacements and addresses in decimal
+static void appendIntelOperand(ud_t* ud, const ud_operand& operand, bool withCast, std::string& text)
+{
+	switch (operand.type)
+	{
+		case UD_OP_REG:
 		{
-			compileResult.errorData.message = "OK";
+			text += ud_reg_tab[operand.base - UD_R_AL];
 			break;
 		}
-		case CompileResult::ErrorId::NoHeapMemory:
+		case UD_OP_MEM:
 		{
-			compileResult.errorData.message = "No heap memory";
+			if (withCast)
+			{
+				appendSizeCast(ud, operand, text);
+			}
+
+			text += "[";
+
+			if (ud->pfx_seg)
+			{
+				text += std::string(ud_reg_tab[ud->pfx_seg - UD_R_AL]) + ":";
+			}
+
+			if (operand.base)
+			{
+				text += ud_reg_tab[operand.base - UD_R_AL];
+			}
+
+			if (operand.index)
+			{
+				text += std::string(operand.base != UD_NONE ? "+" : "") + ud_reg_tab[operand.index - UD_R_AL];
+
+				if (operand.scale)
+				{
+					text += "*";
+					appendUnsigned(text, operand.scale);
+				}
+			}
+
+			// Absolute offsets are unsigned, displacements from a register are signed
+			if (operand.offset != 0 && operand.base == UD_NONE && operand.index == UD_NONE)
+			{
+				appendUnsigned(text, operand.offset == 16 ? operand.lval.uword : (operand.offset == 32 ? operand.lval.udword : operand.lval.uqword));
+			}
+			else if (operand.offset != 0)
+			{
+				long long displacement = operand.offset == 8 ? operand.lval.sbyte : (operand.offset == 16 ? operand.lval.sword : operand.lval.sdword);
+
+				if (displacement != 0)
+				{
+					appendSigned(text, displacement, true);
+				}
+			}
+
+			text += "]";
 			break;
 		}
-		case CompileResult::ErrorId::NoVirtualMemory:
+		case UD_OP_IMM:
 		{
-			compileResult.errorData.message = "No virtual memory";
+			unsigned long long value = 0;
+
+			// Sign-extended to the operand size, as udis86 prints them
+			if (operand._oprcode == OP_sI && operand.size != ud->opr_mode)
+			{
+				value = (unsigned long long)(operand.size == 8 ? (long long)operand.lval.sbyte : (long long)operand.lval.sdword);
+				value &= ud->opr_mode < 64 ? (1ull << ud->opr_mode) - 1ull : ~0ull;
+			}
+			else
+			{
+				value = operand.size == 8 ? operand.lval.ubyte : (operand.size == 16 ? operand.lval.uword : (operand.size == 32 ? operand.lval.udword : operand.lval.uqword));
+			}
+
+			appendUnsigned(text, value);
 			break;
 		}
-		case CompileResult::ErrorId::InvalidArgument:
+		case UD_OP_JIMM:
 		{
-			compileResult.errorData.message = "Invalid argument";
+			unsigned long long target = ud_syn_rel_target(ud, const_cast<ud_operand*>(&operand));
+			int64_t functionOffset = 0;
+			const char* functionName = ud->sym_resolver == nullptr ? nullptr : ud->sym_resolver(ud, target, &functionOffset);
+
+			if (functionName == nullptr)
+			{
+				appendUnsigned(text, target);
+			}
+			else
+			{
+				text += functionName;
+
+				if (functionOffset != 0)
+				{
+					appendSigned(text, functionOffset, true);
+				}
+			}
+
 			break;
 		}
-		case CompileResult::ErrorId::InvalidState:
+		case UD_OP_PTR:
 		{
-			compileResult.errorData.message = "Invalid state";
+			text += operand.size == 32 ? "word " : "dword ";
+			appendUnsigned(text, operand.lval.ptr.seg);
+			text += ":";
+			appendUnsigned(text, operand.size == 32 ? operand.lval.ptr.off & 0xFFFF : operand.lval.ptr.off);
 			break;
 		}
-		case CompileResult::ErrorId::InvalidArchitecture:
+		case UD_OP_CONST:
 		{
-			compileResult.errorData.message = "Invalid architecture";
+			if (withCast)
+			{
+				appendSizeCast(ud, operand, text);
+			}
+
+			appendSigned(text, (int)operand.lval.udword, false);
 			break;
 		}
-		case CompileResult::ErrorId::NotInitialized:
+		default:
 		{
-			compileResult.errorData.message = "Not initialized";
 			break;
 		}
-		case CompileResult::ErrorId::AlreadyInitialized:
+	}
+}
+
+// Intel syntax like ud_translate_intel, but every number is written in decimal as it is formatted, so disassembly needs no
+// post-processing pass
+static void translateIntelDecimal(ud_t* ud)
+{
+	std::string& text = ((TranslatorState*)ud_get_user_opaque_data(ud))->text;
+	const ud_operand* operands = ud->operand;
+
+	text.clear();
+
+	if (!P_OSO(ud->itab_entry->prefix) && ud->pfx_opr)
+	{
+		text += ud->dis_mode == 16 ? "o32 " : "o16 ";
+	}
+
+	if (!P_ASO(ud->itab_entry->prefix) && ud->pfx_adr)
+	{
+		text += ud->dis_mode == 32 ? "a16 " : "a32 ";
+	}
+
+	if (ud->pfx_seg && operands[0].type != UD_OP_MEM && operands[1].type != UD_OP_MEM)
+	{
+		text += std::string(ud_reg_tab[ud->pfx_seg - UD_R_AL]) + " ";
+	}
+
+	text += ud->pfx_lock ? "lock " : "";
+	text += ud->pfx_rep ? "rep " : (ud->pfx_repe ? "repe " : (ud->pfx_repne ? "repne " : ""));
+	text += ud_lookup_mnemonic(ud->mnemonic);
+
+	for (int operandIndex = 0; operandIndex < 4 && operands[operandIndex].type != UD_NONE; operandIndex++)
+	{
+		const ud_operand& operand = operands[operandIndex];
+		bool withCast = false;
+
+		// Sizes are spelled out wherever the other operands don't already give them away
+		if (operandIndex == 0 && operand.type == UD_OP_MEM)
 		{
-			compileResult.errorData.message = "Already initialized";
-			break;
+			bool isShiftByCl = operands[1].type == UD_OP_REG && operands[1].base == UD_R_CL && (ud->mnemonic == UD_Ircl || ud->mnemonic == UD_Irol
+				|| ud->mnemonic == UD_Iror || ud->mnemonic == UD_Ircr || ud->mnemonic == UD_Ishl || ud->mnemonic == UD_Ishr || ud->mnemonic == UD_Isar);
+
+			withCast = operands[1].type == UD_OP_IMM || operands[1].type == UD_OP_CONST || operands[1].type == UD_NONE || operand.size != operands[1].size || isShiftByCl;
 		}
-		case CompileResult::ErrorId::FeatureNotEnabled:
+		else if (operandIndex == 1 && operand.type == UD_OP_MEM)
 		{
-			compileResult.errorData.message = "Feature not enabled";
-			break;
+			withCast = operands[0].size != operand.size && !ud_opr_is_sreg(&operands[0]);
 		}
-		case CompileResult::ErrorId::SlotOccupied:
+		else if (operandIndex == 2 && operand.type == UD_OP_MEM)
 		{
-			compileResult.errorData.message = "Slot occupied";
-			break;
+			withCast = operands[1].size != operand.size;
 		}
-		case CompileResult::ErrorId::NoCodeGenerated:
+
+		text += operandIndex == 0 ? " " : ", ";
+		appendIntelOperand(ud, operand, withCast, text);
+	}
+
+	// ud_insn_asm() returns the decoder's buffer, so point it at the text, which may have moved as it grew
+	ud_set_asm_buffer(ud, &text[0], text.size() + 1);
+	ud->asm_buf_fill = text.size();
+}
+
+// Names call/jmp targets after the function containing them, ie 'call applyBuff' or 'jmp updatePlayer+18'
+static const char* resolveBranchTarget(struct ud*, uint64_t address, int64_t* offset)
+{
+	long long functionOffset = 0;
+	const char* functionName = SymbolTable::findFunction((void*)address, &functionOffset);
+
+	*offset = functionOffset;
+
+	return functionName;
+}
+
+void HackUtils::setAllMemoryPermissions(void* address, int length)
+{
+#ifdef _WIN32
+	DWORD old;
+	VirtualProtect(address, length, PAGE_EXECUTE_READWRITE, &old);
+#else
+	// Unix requires changing memory protection on the start of the page, not just the address
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	void* pageStart = (void*)((unsigned long)address & -pageSize);
+	int newLength = (int)((unsigned long)address + length - (unsigned long)pageStart);
+
+	mprotect(pageStart, newLength, PROT_READ | PROT_WRITE | PROT_EXEC);
+#endif
+}
+
+void HackUtils::writeMemory(void* to, void* from, int length)
+{
+	HackUtils::setAllMemoryPermissions(to, length);
+	HackUtils::setAllMemoryPermissions(from, length);
+
+	memcpy(to, from, length);
+
+	HackUtils::invalidateDisassemblyCache(to, length);
+}
+
+bool HackUtils::writeMemoryAtomic(void* to, const void* from, int length)
+{
+	unsigned long long* word = (unsigned long long*)((uintptr_t)to & ~(uintptr_t)7);
+	int wordOffset = (int)((uintptr_t)to & 7);
+
+	// Only writes that fit in one aligned 8 byte word can be done as a single store, so no thread ever sees a partial write
+	if (length <= 0 || wordOffset + length > (int)sizeof(*word))
+	{
+		return false;
+	}
+
+	HackUtils::setAllMemoryPermissions(word, sizeof(*word));
+
+	unsigned long long value = *word;
+
+	memcpy((unsigned char*)&value + wordOffset, from, length);
+
+#if _MSC_VER
+	InterlockedExchange64((volatile long long*)word, (long long)value);
+#else
+	__atomic_store_n(word, value, __ATOMIC_SEQ_CST);
+#endif
+
+	HackUtils::invalidateDisassemblyCache(to, length);
+
+	return true;
+}
+
+void HackUtils::invalidateDisassemblyCache(void* address, int length)
+{
+	unsigned long long writeStart = (unsigned long long)address;
+	unsigned long long writeEnd = writeStart + length;
+	unsigned long long searchStart = writeStart < (unsigned long long)HackUtils::MaxCachedLength ? 0 : writeStart - HackUtils::MaxCachedLength;
+
+	// Writes are rare next to lookups, so they visit every shard. Entries are ordered by address, so only those starting within
+	// MaxCachedLength before the write can overlap it.
+	for (DisassemblyCacheShard& shard : HackUtils::DisassemblyCacheShards)
+	{
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto next = shard.entries.lower_bound(std::make_tuple(searchStart, 0, 0ULL, false));
+
+		while (next != shard.entries.end() && std::get<0>(next->first) < writeEnd)
 		{
-			compileResult.errorData.message = "No code generated";
-			break;
+			if (std::get<0>(next->first) + std::get<1>(next->first) > writeStart)
+			{
+				shard.recentUses.erase(next->second.recentUse);
+				next = shard.entries.erase(next);
+			}
+			else
+			{
+				++next;
+			}
 		}
-		case CompileResult::ErrorId::CodeTooLarge:
+	}
+}
+
+HackUtils::DisassemblyCacheShard& HackUtils::getDisassemblyCacheShard(void* address)
+{
+	// Functions are 16 byte aligned, so the low bits would put them all in the same shard
+	return HackUtils::DisassemblyCacheShards[((uintptr_t)address >> 4) % HackUtils::DisassemblyCacheShardCount];
+}
+
+std::string HackUtils::preProcessAssembly(std::string assembly, void* addressStart)
+{
+	assembly = HackUtils::resolveMemorySymbols(assembly, addressStart);
+
+	// Float literals are the only thing the scan below rewrites, so skip it entirely when there can't be any
+	if (assembly.find('.') == std::string::npos)
+	{
+		return StrUtils::replaceAll(assembly, "//", ";");
+	}
+
+	// Scanned by hand rather than with a regex, constructing one costs more than assembling the whole patch
+	std::string processedAssembly = "";
+	size_t copiedEnd = 0;
+
+	for (size_t dot = assembly.find('.'); dot != std::string::npos; dot = assembly.find('.', dot + 1))
+	{
+		// Matches -?[0-9]*\.[0-9]+f
+		size_t fractionEnd = dot + 1;
+
+		while (fractionEnd < assembly.size() && std::isdigit((unsigned char)assembly[fractionEnd]))
 		{
-			compileResult.errorData.message = "Code too large";
-			break;
+			fractionEnd++;
 		}
-		case CompileResult::ErrorId::InvalidLabel:
+
+		if (fractionEnd == dot + 1 || fractionEnd == assembly.size() || assembly[fractionEnd] != 'f')
 		{
-			compileResult.errorData.message = "Invalid label";
-			break;
+			continue;
 		}
-		case CompileResult::ErrorId::LabelIndexOverflow:
+
+		size_t literalStart = dot;
+
+		while (literalStart > copiedEnd && std::isdigit((unsigned char)assembly[literalStart - 1]))
 		{
-			compileResult.errorData.message = "Label index overflow";
-			break;
+			literalStart--;
 		}
-		case CompileResult::ErrorId::LabelAlreadyBound:
+
+		literalStart -= literalStart > copiedEnd && assembly[literalStart - 1] == '-' ? 1 : 0;
+
+		float parsedFloat = std::strtof(assembly.substr(literalStart, fractionEnd - literalStart).c_str(), nullptr);
+		int floatAsRawIntBytes = *(int*)(&parsedFloat);
+
+		processedAssembly += assembly.substr(copiedEnd, literalStart - copiedEnd) + HackUtils::toHex(floatAsRawIntBytes, true);
+		copiedEnd = fractionEnd + 1;
+		dot = fractionEnd;
+	}
+
+	processedAssembly += assembly.substr(copiedEnd);
+
+	// Convert to normalized comment formats
+	return StrUtils::replaceAll(processedAssembly, "//", ";");
+}
+
+std::string HackUtils::resolveMemorySymbols(std::string assembly, void* addressStart)
+{
+	if (assembly.find('[') == std::string::npos)
+	{
+		return assembly;
+	}
+
+	// asmtk only accepts registers and labels inside brackets, so locals and symbols there are swapped for registers/addresses before parsing
+	std::string resolvedAssembly = "";
+	bool isInMemoryOperand = false;
+
+	for (size_t index = 0; index < assembly.size();)
+	{
+		char next = assembly[index];
+		size_t tokenEnd = index + 1;
+
+		// Identifiers and numbers are read whole, so the 'x1F' in '0x1F' is never taken for an identifier
+		if (std::isalnum((unsigned char)next) || next == '_')
 		{
-			compileResult.errorData.message = "Label already bound";
-			break;
+			while (tokenEnd < assembly.size() && (std::isalnum((unsigned char)assembly[tokenEnd]) || assembly[tokenEnd] == '_'))
+			{
+				tokenEnd++;
+			}
 		}
-		case CompileResult::ErrorId::LabelAlreadyDefined:
-		{
-			compileResult.errorData.message = "Label already defined";
-			break;
-		}
-		case CompileResult::ErrorId::LabelNameTooLong:
-		{
-			compileResult.errorData.message = "Label name too long";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidLabelName:
-		{
-			compileResult.errorData.message = "Invalid label name";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidParentLabel:
-		{
-			compileResult.errorData.message = "Invalid parent label";
-			break;
-		}
-		case CompileResult::ErrorId::NonLocalLabelCantHaveParent:
-		{
-			compileResult.errorData.message = "Non local label can't have parent";
-			break;
-		}
-		case CompileResult::ErrorId::RelocationIndexOverflow:
-		{
-			compileResult.errorData.message = "Relocation index overflow";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidRelocationEntry:
-		{
-			compileResult.errorData.message = "Invalid relocation entry";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidInstruction:
-		{
-			compileResult.errorData.message = "Invalid instruction";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidRegisterType:
-		{
-			compileResult.errorData.message = "Invalid register type";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidRegisterKind:
-		{
-			compileResult.errorData.message = "Invalid register kind";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidRegisterPhysicalId:
-		{
-			compileResult.errorData.message = "Invalid physical id";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidRegisterVirtualId:
-		{
-			compileResult.errorData.message = "Invalid register virutal id";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidPrefixCombination:
-		{
-			compileResult.errorData.message = "Invalid prefix combination";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidLockPrefix:
-		{
-			compileResult.errorData.message = "Invalid lock prefix";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidXAcquirePrefix:
-		{
-			compileResult.errorData.message = "Invalid x acquire prefix";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidXReleasePrefix:
-		{
-			compileResult.errorData.message = "Invalid x release prefix";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidRepPrefix:
-		{
-			compileResult.errorData.message = "Invalid rep prefix";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidRexPrefix:
-		{
-			compileResult.errorData.message = "Invalid rex prefix";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidMask:
-		{
-			compileResult.errorData.message = "Invalid mask";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidUseSingle:
-		{
-			compileResult.errorData.message = "Invalid use single";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidUseDouble:
-		{
-			compileResult.errorData.message = "Invalid use double";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidBroadcast:
-		{
-			compileResult.errorData.message = "Invalid broadcast";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidOption:
-		{
-			compileResult.errorData.message = "Invalid option";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidAddress:
-		{
-			compileResult.errorData.message = "Invalid address";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidAddressIndex:
-		{
-			compileResult.errorData.message = "Invalid address index";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidAddressScale:
-		{
-			compileResult.errorData.message = "Invalid address scale";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidUseOf64BitAddress:
-		{
-			compileResult.errorData.message = "Invalid use of 64 bit address";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidDisplacement:
-		{
-			compileResult.errorData.message = "Invalid displacement";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidSegment:
-		{
-			compileResult.errorData.message = "Invalid segment";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidImmediateValue:
-		{
-			compileResult.errorData.message = "Invalid immediate value";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidOperandSize:
-		{
-			compileResult.errorData.message = "Invalid operand size";
-			break;
-		}
-		case CompileResult::ErrorId::AmbiguousOperandSize:
-		{
-			compileResult.errorData.message = "Ambiguous operand size";
-			break;
-		}
-		case CompileResult::ErrorId::OperandSizeMismatch:
-		{
-			compileResult.errorData.message = "Operand size mismatch";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidTypeInfo:
-		{
-			compileResult.errorData.message = "Invalid type info";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidUseOf8BitRegister:
-		{
-			compileResult.errorData.message = "Invalud use of 8 bit register";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidUseOf64BitRegister:
-		{
-			compileResult.errorData.message = "Invalid use of 64 bit register";
-			break;
-		}
-		case CompileResult::ErrorId::InvalidUseOf80BitFloat:
-		{
-			compileResult.errorData.message = "Invalid use of 80 bit float";
-			break;
-		}
-		case CompileResult::ErrorId::NotConsecutiveRegisters:
-		{
-			compileResult.errorData.message = "Not consecutive registers";
-			break;
-		}
-		case CompileResult::ErrorId::NoPhysicalRegisters:
-		{
-			compileResult.errorData.message = "No physical registers";
-			break;
-		}
-		case CompileResult::ErrorId::OverlappedRegisters:
+
+		std::string token = assembly.substr(index, tokenEnd - index);
+
+		isInMemoryOperand = next == '[' || (isInMemoryOperand && next != ']' && next != '\n');
+
+		// Labels defined in the snippet itself win over locals and symbols of the same name
+		bool isSymbolCandidate = isInMemoryOperand && (std::isalpha((unsigned char)next) || next == '_') && !HackUtils::isRegisterName(token) && !definesLabel(assembly, token);
+		DebugLocals::LocalLocation local = isSymbolCandidate && addressStart != nullptr ? DebugLocals::findLocal(token, addressStart) : DebugLocals::LocalLocation();
+
+		if (local.kind != DebugLocals::LocalLocation::Kind::None && HackUtils::isWholeMemoryOperand(assembly, index, tokenEnd))
 		{
-			compileResult.errorData.message = "Overlapped registers";
-			break;
+			// '[local]' becomes the register holding it, or a sized stack operand (the size isn't otherwise known for 'sub [health], 10')
+			resolvedAssembly.erase(resolvedAssembly.rfind('['));
+
+			size_t operandStart = resolvedAssembly.find_last_of(",\n");
+			operandStart = operandStart == std::string::npos ? 0 : operandStart + 1;
+			std::string operandPrefix = resolvedAssembly.substr(operandStart);
+			std::transform(operandPrefix.begin(), operandPrefix.end(), operandPrefix.begin(), ::tolower);
+			size_t ptrStart = operandPrefix.rfind("ptr");
+			bool hasSize = ptrStart != std::string::npos && ptrStart > 0;
+
+			if (local.kind == DebugLocals::LocalLocation::Kind::Register)
+			{
+				if (hasSize)
+				{
+					size_t sizeEnd = operandPrefix.find_last_not_of(" \t", ptrStart - 1);
+					size_t sizeStart = sizeEnd == std::string::npos ? std::string::npos : operandPrefix.find_last_of(" \t", sizeEnd);
+
+					resolvedAssembly.erase(operandStart + (sizeStart == std::string::npos ? 0 : sizeStart + 1));
+				}
+
+				resolvedAssembly += local.operand;
+			}
+			else
+			{
+				resolvedAssembly += (hasSize ? "" : HackUtils::getSizeKeyword(local.byteSize)) + "[" + local.operand + "]";
+			}
+
+			index = assembly.find(']', tokenEnd) + 1;
+			isInMemoryOperand = false;
+			continue;
 		}
-		case CompileResult::ErrorId::OverlappingRegisterAndArgsRegister:
+
+		void* address = local.kind == DebugLocals::LocalLocation::Kind::Memory ? nullptr : (isSymbolCandidate ? SymbolTable::resolveSymbol(token) : nullptr);
+
+		resolvedAssembly += local.kind == DebugLocals::LocalLocation::Kind::Memory ? local.operand : (address == nullptr ? token : std::to_string((unsigned long long)address));
+		index = tokenEnd;
+	}
+
+	return resolvedAssembly;
+}
+
+bool HackUtils::isWholeMemoryOperand(const std::string& assembly, size_t tokenStart, size_t tokenEnd)
+{
+	size_t before = assembly.find_last_not_of(" \t", tokenStart - 1);
+	size_t after = assembly.find_first_not_of(" \t", tokenEnd);
+
+	return before != std::string::npos && assembly[before] == '[' && after != std::string::npos && assembly[after] == ']';
+}
+
+std::string HackUtils::getSizeKeyword(int byteSize)
+{
+	switch (byteSize)
+	{
+		case 1: return "byte ptr ";
+		case 2: return "word ptr ";
+		case 4: return "dword ptr ";
+		case 8: return "qword ptr ";
+		default: return "";
+	}
+}
+
+bool HackUtils::isRegisterName(std::string name)
+{
+	std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+	static const std::vector<std::string> LegacyRegisters = { "ax", "bx", "cx", "dx", "si", "di", "sp", "bp" };
+
+	for (auto legacyRegister : LegacyRegisters)
+	{
+		if (name == legacyRegister || name == "e" + legacyRegister || name == "r" + legacyRegister)
 		{
-			compileResult.errorData.message = "Overlapping register and args register";
-			break;
+			return true;
 		}
-		case CompileResult::ErrorId::UnknownError:
-		default:
+	}
+
+	// r8-r15 with an optional d/w/b suffix, plus the vector registers used by vsib addressing
+	size_t numberStart = name.find_first_of("0123456789");
+
+	if (numberStart != std::string::npos && (name.substr(0, numberStart) == "r" || name.substr(0, numberStart) == "xmm"
+		|| name.substr(0, numberStart) == "ymm" || name.substr(0, numberStart) == "zmm"))
+	{
+		size_t numberEnd = name.find_first_not_of("0123456789", numberStart);
+
+		return numberEnd == std::string::npos || (name.substr(0, numberStart) == "r" && numberEnd + 1 == name.size() && std::string("dwb").find(name[numberEnd]) != std::string::npos);
+	}
+
+	return name == "rip" || name == "eip" || name == "cs" || name == "ds" || name == "es" || name == "fs" || name == "gs" || name == "ss";
+}
+
+HackUtils::CompileResult HackUtils::assemble(std::string assembly, void* addressStart)
+{
+	CompileResult compileResult;
+
+	// A known base address lets asmjit encode 'jmp/call <address>' relative to where the code will actually run
+	CodeInfo ci(sizeof(void*) == 4 ? ArchInfo::kIdX86 : ArchInfo::kIdX64, 0, addressStart == nullptr ? Globals::kNoBaseAddress : (uint64_t)addressStart);
+	CodeHolder code;
+	code.init(ci);
+
+	// Attach X86Assembler `code`.
+	x86::Assembler a(&code);
+
+	// Create AsmParser that will emit to X86Assembler.
+	AsmParser p(&a);
+	p.setUnknownSymbolHandler(resolveUnknownSymbol);
+
+	// Parse the assembly.
+	assembly = preProcessAssembly(assembly, addressStart);
+	Error err = p.parse(assembly.c_str());
+
+	// Error handling (use asmjit::ErrorHandler for more robust error handling).
+	if (err)
+	{
+		compileResult.hasError = true;
+		compileResult.errorData.lineNumber = HackUtils::getLineNumber(assembly, p.currentCommandOffset());
+
+		compileResult.errorData.message = HackUtils::getCompileErrorMessage((CompileResult::ErrorId)err);
+
+		return compileResult;
+	}
+
+	if (HackUtils::hasUndefinedLabels(code, compileResult))
+	{
+		return compileResult;
+	}
+
+	// Now you can print the code, which is stored in the first section (.text).
+	CodeBuffer& buffer = code.sectionById(0)->buffer();
+	uint8_t* bufferData = buffer.data();
+
+	compileResult.hasError = false;
+	compileResult.errorData.lineNumber = 0;
+	compileResult.byteCount = buffer.size();
+	compileResult.compiledBytes = std::vector<unsigned char>();
+
+	for (int index = 0; index < compileResult.byteCount; index++)
+	{
+		compileResult.compiledBytes.push_back(bufferData[index]);
+	}
+
+	return compileResult;
+}
+
+HackUtils::CompileResult HackUtils::assembleOptimized(std::string assembly, void* addressStart, bool flagsLiveAtEnd, std::vector<PeepholeRewrite>& outRewrites)
+{
+	CompileResult compileResult;
+
+	CodeInfo ci(sizeof(void*) == 4 ? ArchInfo::kIdX86 : ArchInfo::kIdX64, 0, addressStart == nullptr ? Globals::kNoBaseAddress : (uint64_t)addressStart);
+	CodeHolder code;
+	code.init(ci);
+
+	// Parsed into a node list first so the peephole pass can rewrite it before anything is encoded
+	x86::Builder b(&code);
+
+	AsmParser p(&b);
+	p.setUnknownSymbolHandler(resolveUnknownSymbol);
+
+	assembly = preProcessAssembly(assembly, addressStart);
+	Error err = p.parse(assembly.c_str());
+
+	outRewrites.clear();
+	compileResult.compiledBytes = std::vector<unsigned char>();
+
+	if (err)
+	{
+		compileResult.hasError = true;
+		compileResult.byteCount = 0;
+		compileResult.errorData.lineNumber = HackUtils::getLineNumber(assembly, p.currentCommandOffset());
+		compileResult.errorData.message = HackUtils::getCompileErrorMessage((CompileResult::ErrorId)err);
+
+		return compileResult;
+	}
+
+	PeepholeOptimizer::optimize(b, flagsLiveAtEnd, outRewrites);
+
+	x86::Assembler a(&code);
+	err = b.serialize(&a);
+
+	// Lines are gone by now, encoding errors can't be traced back to one
+	if (err)
+	{
+		compileResult.hasError = true;
+		compileResult.byteCount = 0;
+		compileResult.errorData.lineNumber = 0;
+		compileResult.errorData.message = HackUtils::getCompileErrorMessage((CompileResult::ErrorId)err);
+
+		return compileResult;
+	}
+
+	if (HackUtils::hasUndefinedLabels(code, compileResult))
+	{
+		return compileResult;
+	}
+
+	CodeBuffer& buffer = code.sectionById(0)->buffer();
+
+	compileResult.hasError = false;
+	compileResult.errorData.lineNumber = 0;
+	compileResult.byteCount = (int)buffer.size();
+	compileResult.compiledBytes = std::vector<unsigned char>(buffer.data(), buffer.data() + buffer.size());
+
+	return compileResult;
+}
+
+HackUtils::CompileResult HackUtils::validate(std::string assembly, void* addressStart)
+{
+	CompileResult compileResult;
+
+	// Called on every keystroke, so each thread keeps one holder and assembler and only resets them. Nothing reads the encoded
+	// bytes, only the size of the buffer.
+	thread_local CodeHolder code;
+	thread_local x86::Assembler a;
+
+	CodeInfo ci(sizeof(void*) == 4 ? ArchInfo::kIdX86 : ArchInfo::kIdX64, 0, addressStart == nullptr ? Globals::kNoBaseAddress : (uint64_t)addressStart);
+	code.reset();
+	code.init(ci);
+	code.attach(&a);
+
+	// Strict validation runs every instruction through InstAPI::validate() before it is encoded
+	a.addEmitterOptions(BaseEmitter::kOptionStrictValidation);
+
+	AsmParser p(&a);
+	p.setUnknownSymbolHandler(resolveUnknownSymbol);
+
+	// Symbols, locals and float literals all change the encoding, so the preprocessing can't be skipped. It returns early
+	// when there is nothing for it to rewrite.
+	assembly = preProcessAssembly(assembly, addressStart);
+	Error err = p.parse(assembly.c_str());
+
+	compileResult.compiledBytes = std::vector<unsigned char>();
+
+	if (err)
+	{
+		compileResult.hasError = true;
+		compileResult.byteCount = 0;
+		compileResult.errorData.lineNumber = HackUtils::getLineNumber(assembly, p.currentCommandOffset());
+		compileResult.errorData.message = HackUtils::getCompileErrorMessage((CompileResult::ErrorId)err);
+
+		return compileResult;
+	}
+
+	if (HackUtils::hasUndefinedLabels(code, compileResult))
+	{
+		return compileResult;
+	}
+
+	compileResult.hasError = false;
+	compileResult.byteCount = (int)code.sectionById(0)->buffer().size();
+	compileResult.errorData.lineNumber = 0;
+	compileResult.errorData.message = "";
+
+	return compileResult;
+}
+
+bool HackUtils::hasUndefinedLabels(CodeHolder& code, CompileResult& compileResult)
+{
+	// Names that aren't registers, symbols or labels defined in the snippet become labels that are never bound. asmjit leaves
+	// their branches unpatched rather than failing, so they would silently jump to the next instruction.
+	if (!code.hasUnresolvedLinks())
+	{
+		return false;
+	}
+
+	compileResult.hasError = true;
+	compileResult.byteCount = 0;
+	compileResult.compiledBytes.clear();
+	compileResult.errorData.lineNumber = 0;
+	compileResult.errorData.message = HackUtils::getCompileErrorMessage(CompileResult::ErrorId::InvalidLabel);
+
+	return true;
+}
+
+std::vector<HackUtils::CompileResult> HackUtils::assembleBatch(const std::vector<AssemblyJob>& jobs)
+{
+	std::vector<CompileResult> compileResults = std::vector<CompileResult>(jobs.size());
+	std::atomic<size_t> nextJobIndex(0);
+
+	// Each call to assemble() owns its CodeHolder/Assembler/AsmParser, so workers share nothing but the job counter
+	auto worker = [&]()
+	{
+		for (size_t index = nextJobIndex++; index < jobs.size(); index = nextJobIndex++)
 		{
-			compileResult.errorData.message = "Unknown error";
-			break;
-		}
+			compileResults[index] = HackUtils::assemble(jobs[index].assembly, jobs[index].addressStart);
 		}
+	};
 
-		return compileResult;
+	size_t threadCount = std::min((size_t)std::max(std::thread::hardware_concurrency(), 1u), jobs.size());
+
+	if (threadCount <= 1)
+	{
+		worker();
+
+		return compileResults;
 	}
 
-	// Now you can print the code, which is stored in the first section (.text).
-	CodeBuffer& buffer = code.sectionById(0)->buffer();
-	uint8_t* bufferData = buffer.data();
+	std::vector<std::thread> workers = std::vector<std::thread>();
 
-	compileResult.hasError = false;
-	compileResult.byteCount = buffer.size();
-	compileResult.compiledBytes = std::vector<unsigned char>();
+	// The calling thread works through the queue as well
+	for (size_t index = 1; index < threadCount; index++)
+	{
+		workers.push_back(std::thread(worker));
+	}
 
-	for (int index = 0; index < compileResult.byteCount; index++)
+	worker();
+
+	for (auto& next : workers)
 	{
-		compileResult.compiledBytes.push_back(bufferData[index]);
+		next.join();
 	}
 
-	return compileResult;
+	return compileResults;
+}
+
+std::string HackUtils::getCompileErrorMessage(CompileResult::ErrorId errorId)
+{
+	switch (errorId)
+	{
+	case CompileResult::ErrorId::Ok:
+	{
+		return "OK";
+	}
+	case CompileResult::ErrorId::NoHeapMemory:
+	{
+		return "No heap memory";
+	}
+	case CompileResult::ErrorId::NoVirtualMemory:
+	{
+		return "No virtual memory";
+	}
+	case CompileResult::ErrorId::InvalidArgument:
+	{
+		return "Invalid argument";
+	}
+	case CompileResult::ErrorId::InvalidState:
+	{
+		return "Invalid state";
+	}
+	case CompileResult::ErrorId::InvalidArchitecture:
+	{
+		return "Invalid architecture";
+	}
+	case CompileResult::ErrorId::NotInitialized:
+	{
+		return "Not initialized";
+	}
+	case CompileResult::ErrorId::AlreadyInitialized:
+	{
+		return "Already initialized";
+	}
+	case CompileResult::ErrorId::FeatureNotEnabled:
+	{
+		return "Feature not enabled";
+	}
+	case CompileResult::ErrorId::SlotOccupied:
+	{
+		return "Slot occupied";
+	}
+	case CompileResult::ErrorId::NoCodeGenerated:
+	{
+		return "No code generated";
+	}
+	case CompileResult::ErrorId::CodeTooLarge:
+	{
+		return "Code too large";
+	}
+	case CompileResult::ErrorId::InvalidLabel:
+	{
+		return "Invalid label";
+	}
+	case CompileResult::ErrorId::LabelIndexOverflow:
+	{
+		return "Label index overflow";
+	}
+	case CompileResult::ErrorId::LabelAlreadyBound:
+	{
+		return "Label already bound";
+	}
+	case CompileResult::ErrorId::LabelAlreadyDefined:
+	{
+		return "Label already defined";
+	}
+	case CompileResult::ErrorId::LabelNameTooLong:
+	{
+		return "Label name too long";
+	}
+	case CompileResult::ErrorId::InvalidLabelName:
+	{
+		return "Invalid label name";
+	}
+	case CompileResult::ErrorId::InvalidParentLabel:
+	{
+		return "Invalid parent label";
+	}
+	case CompileResult::ErrorId::NonLocalLabelCantHaveParent:
+	{
+		return "Non local label can't have parent";
+	}
+	case CompileResult::ErrorId::RelocationIndexOverflow:
+	{
+		return "Relocation index overflow";
+	}
+	case CompileResult::ErrorId::InvalidRelocationEntry:
+	{
+		return "Invalid relocation entry";
+	}
+	case CompileResult::ErrorId::InvalidInstruction:
+	{
+		return "Invalid instruction";
+	}
+	case CompileResult::ErrorId::InvalidRegisterType:
+	{
+		return "Invalid register type";
+	}
+	case CompileResult::ErrorId::InvalidRegisterKind:
+	{
+		return "Invalid register kind";
+	}
+	case CompileResult::ErrorId::InvalidRegisterPhysicalId:
+	{
+		return "Invalid physical id";
+	}
+	case CompileResult::ErrorId::InvalidRegisterVirtualId:
+	{
+		return "Invalid register virutal id";
+	}
+	case CompileResult::ErrorId::InvalidPrefixCombination:
+	{
+		return "Invalid prefix combination";
+	}
+	case CompileResult::ErrorId::InvalidLockPrefix:
+	{
+		return "Invalid lock prefix";
+	}
+	case CompileResult::ErrorId::InvalidXAcquirePrefix:
+	{
+		return "Invalid x acquire prefix";
+	}
+	case CompileResult::ErrorId::InvalidXReleasePrefix:
+	{
+		return "Invalid x release prefix";
+	}
+	case CompileResult::ErrorId::InvalidRepPrefix:
+	{
+		return "Invalid rep prefix";
+	}
+	case CompileResult::ErrorId::InvalidRexPrefix:
+	{
+		return "Invalid rex prefix";
+	}
+	case CompileResult::ErrorId::InvalidMask:
+	{
+		return "Invalid mask";
+	}
+	case CompileResult::ErrorId::InvalidUseSingle:
+	{
+		return "Invalid use single";
+	}
+	case CompileResult::ErrorId::InvalidUseDouble:
+	{
+		return "Invalid use double";
+	}
+	case CompileResult::ErrorId::InvalidBroadcast:
+	{
+		return "Invalid broadcast";
+	}
+	case CompileResult::ErrorId::InvalidOption:
+	{
+		return "Invalid option";
+	}
+	case CompileResult::ErrorId::InvalidAddress:
+	{
+		return "Invalid address";
+	}
+	case CompileResult::ErrorId::InvalidAddressIndex:
+	{
+		return "Invalid address index";
+	}
+	case CompileResult::ErrorId::InvalidAddressScale:
+	{
+		return "Invalid address scale";
+	}
+	case CompileResult::ErrorId::InvalidUseOf64BitAddress:
+	{
+		return "Invalid use of 64 bit address";
+	}
+	case CompileResult::ErrorId::InvalidDisplacement:
+	{
+		return "Invalid displacement";
+	}
+	case CompileResult::ErrorId::InvalidSegment:
+	{
+		return "Invalid segment";
+	}
+	case CompileResult::ErrorId::InvalidImmediateValue:
+	{
+		return "Invalid immediate value";
+	}
+	case CompileResult::ErrorId::InvalidOperandSize:
+	{
+		return "Invalid operand size";
+	}
+	case CompileResult::ErrorId::AmbiguousOperandSize:
+	{
+		return "Ambiguous operand size";
+	}
+	case CompileResult::ErrorId::OperandSizeMismatch:
+	{
+		return "Operand size mismatch";
+	}
+	case CompileResult::ErrorId::InvalidTypeInfo:
+	{
+		return "Invalid type info";
+	}
+	case CompileResult::ErrorId::InvalidUseOf8BitRegister:
+	{
+		return "Invalud use of 8 bit register";
+	}
+	case CompileResult::ErrorId::InvalidUseOf64BitRegister:
+	{
+		return "Invalid use of 64 bit register";
+	}
+	case CompileResult::ErrorId::InvalidUseOf80BitFloat:
+	{
+		return "Invalid use of 80 bit float";
+	}
+	case CompileResult::ErrorId::NotConsecutiveRegisters:
+	{
+		return "Not consecutive registers";
+	}
+	case CompileResult::ErrorId::NoPhysicalRegisters:
+	{
+		return "No physical registers";
+	}
+	case CompileResult::ErrorId::OverlappedRegisters:
+	{
+		return "Overlapped registers";
+	}
+	case CompileResult::ErrorId::OverlappingRegisterAndArgsRegister:
+	{
+		return "Overlapping register and args register";
+	}
+	case CompileResult::ErrorId::UnknownError:
+	default:
+	{
+		return "Unknown error";
+	}
+	}
+}
+
+int HackUtils::getLineNumber(const std::string& assembly, size_t offset)
+{
+	offset = std::min(offset, assembly.size());
+
+	// Preprocessing never adds or removes newlines, so this lines up with the caller's source
+	return 1 + (int)std::count(assembly.begin(), assembly.begin() + offset, '\n');
 }
 
 void* HackUtils::resolveVTableAddress(void* address)
@@ -421,10 +1152,12 @@ void* HackUtils::resolveVTableAddress(void* address)
 	return address;
 }
 
-std::string HackUtils::disassemble(void* address, int length)
+std::string HackUtils::disassemble(void* address, int length, void* runtimeAddress, bool withSymbols)
 {
-	static ud_t ud_obj;
-	static bool initialized = false;
+	// One decoder per thread, so concurrent callers never share decoder state
+	thread_local TranslatorState translatorState;
+	thread_local ud_t ud_obj;
+	thread_local bool initialized = false;
 
 	if (address == nullptr)
 	{
@@ -436,19 +1169,52 @@ std::string HackUtils::disassemble(void* address, int length)
 		return "";
 	}
 
-	// Only initialize the disassembler once
+	// Writes through writeMemory drop overlapping entries, the checksum catches anything written by other means
+	bool isCached = length <= HackUtils::MaxCachedLength;
+	unsigned int checksum = isCached ? crc32c((unsigned char*)address, length) : 0;
+	DisassemblyCacheKey cacheKey = std::make_tuple((unsigned long long)address, length, (unsigned long long)runtimeAddress, withSymbols);
+	DisassemblyCacheShard& shard = HackUtils::getDisassemblyCacheShard(address);
+
+	if (isCached)
+	{
+		std::shared_ptr<const std::string> cachedText = nullptr;
+
+		// The text is shared rather than copied under the lock, so the lock is only held for the lookup
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			auto cachedDisassembly = shard.entries.find(cacheKey);
+
+			if (cachedDisassembly != shard.entries.end() && cachedDisassembly->second.checksum == checksum)
+			{
+				shard.recentUses.splice(shard.recentUses.begin(), shard.recentUses, cachedDisassembly->second.recentUse);
+				cachedText = cachedDisassembly->second.text;
+			}
+		}
+
+		if (cachedText != nullptr)
+		{
+			return *cachedText;
+		}
+	}
+
+	// Only initialize the disassembler once per thread
 	if (!initialized)
 	{
 		ud_init(&ud_obj);
 		ud_set_mode(&ud_obj, sizeof(void*) * 8);
-		ud_set_syntax(&ud_obj, UD_SYN_INTEL);
+		ud_set_syntax(&ud_obj, translateIntelDecimal);
+		ud_set_user_opaque_data(&ud_obj, &translatorState);
 
 		initialized = true;
 	}
 
-	ud_set_pc(&ud_obj, (uint64_t)address);
+	// Copies of code are decoded as if they were at the address they run from, so branch targets come out right
+	ud_set_pc(&ud_obj, (uint64_t)(runtimeAddress == nullptr ? address : runtimeAddress));
 	ud_set_input_buffer(&ud_obj, (unsigned char*)address, length);
 
+	// Off by default, since callers like resolveVTableAddress parse the raw branch targets back out of the text
+	ud_set_sym_resolver(&ud_obj, withSymbols ? resolveBranchTarget : nullptr);
+
 	std::string instructions = "";
 
 	while (ud_disassemble(&ud_obj))
@@ -457,40 +1223,252 @@ std::string HackUtils::disassemble(void* address, int length)
 		instructions += "\n";
 	}
 
-	return HackUtils::preProcess(instructions);
+	// Longer regions are rare and better streamed through disassembleToSink, they would only push hackables out of the cache
+	if (!isCached)
+	{
+		return instructions;
+	}
+
+	std::shared_ptr<const std::string> text = std::make_shared<const std::string>(instructions);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	auto cachedDisassembly = shard.entries.find(cacheKey);
+
+	if (cachedDisassembly != shard.entries.end())
+	{
+		// Another thread decoded the same region meanwhile, or the bytes changed without going through writeMemory
+		shard.recentUses.splice(shard.recentUses.begin(), shard.recentUses, cachedDisassembly->second.recentUse);
+		cachedDisassembly->second.checksum = checksum;
+		cachedDisassembly->second.text = text;
+
+		return instructions;
+	}
+
+	// Only the least recently used entry goes when the shard is full
+	if ((int)shard.entries.size() >= HackUtils::MaxDisassemblyCacheEntries / HackUtils::DisassemblyCacheShardCount)
+	{
+		shard.entries.erase(shard.recentUses.back());
+		shard.recentUses.pop_back();
+	}
+
+	shard.recentUses.push_front(cacheKey);
+	shard.entries[cacheKey] = CachedDisassembly(checksum, text, shard.recentUses.begin());
+
+	return instructions;
 }
 
-std::string HackUtils::preProcess(std::string instructions)
+void HackUtils::disassembleToSink(void* address, size_t length, const DisassemblySink& sink, size_t batchSize, bool withSymbols)
 {
-	const std::string regExpStr = "0x([0-9]|[a-f]|[A-F])+";
-	const std::regex regExp = std::regex(regExpStr);
+	if (address == nullptr || length == 0)
+	{
+		return;
+	}
+
+	TranslatorState translatorState;
+	ud_t ud_obj;
+
+	translatorState.next = (const unsigned char*)address;
+	translatorState.end = (const unsigned char*)address + length;
 
-	if (!StrUtils::isRegexSubMatch(instructions, regExpStr))
+	ud_init(&ud_obj);
+	ud_set_mode(&ud_obj, sizeof(void*) * 8);
+	ud_set_syntax(&ud_obj, translateIntelDecimal);
+	ud_set_sym_resolver(&ud_obj, withSymbols ? resolveBranchTarget : nullptr);
+	ud_set_pc(&ud_obj, (uint64_t)address);
+
+	// Bytes are pulled one at a time through the hook, so the region never needs to fit a single input buffer
+	ud_set_user_opaque_data(&ud_obj, &translatorState);
+	ud_set_input_hook(&ud_obj, [](ud_t* ud) -> int
 	{
-		return instructions;
+		TranslatorState* input = (TranslatorState*)ud_get_user_opaque_data(ud);
+
+		return input->next < input->end ? *input->next++ : UD_EOI;
+	});
+
+	// Text is batched into one fixed window, so memory stays constant however large the region is. A batch size of 0 sends each line on its own.
+	std::string window = "";
+
+	window.reserve(batchSize + 256);
+
+	while (ud_disassemble(&ud_obj))
+	{
+		window += ud_insn_asm(&ud_obj);
+		window += "\n";
+
+		if (window.size() >= batchSize)
+		{
+			if (!sink(window.data(), window.size()))
+			{
+				return;
+			}
+
+			window.clear();
+		}
 	}
 
-	std::string result = "";
-	std::sregex_token_iterator begin = std::sregex_token_iterator(instructions.begin(), instructions.end(), regExp, { -1, 0 });
-	std::sregex_token_iterator end = std::sregex_token_iterator();
+	if (!window.empty())
+	{
+		sink(window.data(), window.size());
+	}
+}
 
-	std::for_each(begin, end, [&](std::string const& next)
+HackUtils::DisassemblySink HackUtils::createFileSink(int fileDescriptor)
+{
+	return [=](const char* text, size_t length)
+	{
+		// Writes may be partial on pipes and sockets
+		while (length > 0)
 		{
-			std::istringstream iss(next);
+#ifdef _WIN32
+			int written = _write(fileDescriptor, text, (unsigned int)length);
+#else
+			ssize_t written = write(fileDescriptor, text, length);
+#endif
 
-			if (StrUtils::isHexNumber(next))
+			if (written <= 0)
 			{
-				result += std::to_string(StrUtils::hexToInt(next));
+				return false;
 			}
-			else
+
+			text += written;
+			length -= written;
+		}
+
+		return true;
+	};
+}
+
+void HackUtils::decode(void* address, int length, std::vector<DecodedInstruction>& outInstructions)
+{
+	// No translator is set, so ud_decode never formats any text
+	thread_local ud_t decoder;
+	thread_local bool initialized = false;
+
+	outInstructions.clear();
+
+	if (address == nullptr || length <= 0)
+	{
+		return;
+	}
+
+	if (!initialized)
+	{
+		ud_init(&decoder);
+		ud_set_mode(&decoder, sizeof(void*) * 8);
+		ud_set_syntax(&decoder, nullptr);
+
+		initialized = true;
+	}
+
+	ud_set_pc(&decoder, (uint64_t)address);
+	ud_set_input_buffer(&decoder, (unsigned char*)address, length);
+
+	// Records are written into the caller's vector, which keeps its capacity between calls
+	outInstructions.reserve(length / 3 + 1);
+
+	for (unsigned int instructionLength = ud_decode(&decoder); instructionLength > 0; instructionLength = ud_decode(&decoder))
+	{
+		outInstructions.emplace_back();
+
+		DecodedInstruction& instruction = outInstructions.back();
+
+		instruction.address = (void*)(uintptr_t)ud_insn_off(&decoder);
+		instruction.mnemonic = (unsigned short)ud_insn_mnemonic(&decoder);
+		instruction.length = (unsigned char)instructionLength;
+
+		for (int operandIndex = 0; operandIndex < 4 && decoder.operand[operandIndex].type != UD_NONE; operandIndex++)
+		{
+			const ud_operand& operand = decoder.operand[operandIndex];
+			DecodedOperand& decodedOperand = instruction.operands[operandIndex];
+			int valueBits = operand.type == UD_OP_MEM ? operand.offset : operand.size;
+
+			decodedOperand.type = (unsigned short)operand.type;
+			decodedOperand.base = (unsigned short)operand.base;
+			decodedOperand.index = (unsigned short)operand.index;
+			decodedOperand.scale = operand.scale;
+			decodedOperand.size = (unsigned char)operand.size;
+			decodedOperand.value = 0;
+
+			// lval is only written for operands that carry a value, registers leave whatever the last decode put there
+			switch (operand.type)
 			{
-				result += next;
+				case UD_OP_IMM:
+				case UD_OP_JIMM:
+				case UD_OP_MEM:
+				{
+					decodedOperand.value = valueBits == 8 ? operand.lval.sbyte : (valueBits == 16 ? operand.lval.sword : (valueBits == 32 ? operand.lval.sdword : (valueBits == 64 ? operand.lval.sqword : 0)));
+
+					if (operand.type == UD_OP_JIMM)
+					{
+						decodedOperand.value += (long long)ud_insn_off(&decoder) + instructionLength;
+					}
+
+					break;
+				}
+				case UD_OP_PTR:
+				{
+					decodedOperand.value = operand.size == 32 ? operand.lval.ptr.off & 0xFFFF : operand.lval.ptr.off;
+					break;
+				}
+				case UD_OP_CONST:
+				{
+					// The implicit 1 of shifts and 3 of int3, udis86 only sets the low byte of the latter
+					decodedOperand.value = operand.lval.sbyte;
+					break;
+				}
+				default:
+				{
+					break;
+				}
 			}
-		});
+
+			instruction.operandCount++;
+		}
+	}
+}
+
+std::string HackUtils::getInstructionText(const DecodedInstruction& instruction)
+{
+	// Text is only rendered on request, by decoding the one instruction again with the Intel translator
+	std::string text = HackUtils::disassemble(instruction.address, instruction.length);
+
+	return StrUtils::rtrim(text, "\n");
+}
+
+std::string HackUtils::preProcess(std::string instructions)
+{
+	std::string result = "";
+
+	result.reserve(instructions.size());
+	HackUtils::appendDecimalLiterals(instructions.c_str(), result);
 
 	return result;
 }
 
+void HackUtils::appendDecimalLiterals(const char* text, std::string& outText)
+{
+	for (const char* next = text; *next != '\0';)
+	{
+		bool isHexLiteral = next[0] == '0' && (next[1] == 'x' || next[1] == 'X') && std::isxdigit((unsigned char)next[2])
+			&& (next == text || !(std::isalnum((unsigned char)next[-1]) || next[-1] == '_'));
+
+		if (!isHexLiteral)
+		{
+			outText += *next++;
+			continue;
+		}
+
+		// Parsed as unsigned 64-bit, so addresses and large immediates are no longer clamped to INT_MAX
+		unsigned long long value = 0;
+
+		for (next += 2; std::isxdigit((unsigned char)*next); next++)
+		{
+			value = value * 16 + (std::isdigit((unsigned char)*next) ? *next - '0' : (std::tolower((unsigned char)*next) - 'a' + 10));
+		}
+
+		appendUnsigned(outText, value);
+	}
+}
+
 std::string HackUtils::toHex(int value, bool prefix)
 {
 	std::stringstream stream;
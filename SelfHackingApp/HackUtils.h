@@ -1,10 +1,21 @@
 #pragma once
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <tuple>
 #include <typeinfo>
 #include <vector>
 
 class LocalizedString;
 
+namespace asmjit
+{
+	class CodeHolder;
+}
+
 class HackUtils
 {
 public:
@@ -97,13 +108,114 @@ public:
 		int byteCount;
 	};
 
+	struct AssemblyJob
+	{
+		std::string assembly;
+		void* addressStart;
+
+		AssemblyJob() : assembly(""), addressStart(nullptr) { }
+		AssemblyJob(std::string assembly, void* addressStart) : assembly(assembly), addressStart(addressStart) { }
+	};
+
+	// One change made by the peephole pass over a patch. Cycles are a latency estimate, bytes can be negative when a slow
+	// sequence is swapped for a longer but faster one.
+	struct PeepholeRewrite
+	{
+		std::string before;
+		std::string after;
+		int bytesSaved;
+		int cyclesSaved;
+
+		PeepholeRewrite() : before(""), after(""), bytesSaved(0), cyclesSaved(0) { }
+	};
+
+	// Compact decode of an instruction without any text formatting. Kinds, registers and mnemonics are the raw udis86 enum values
+	// (ud_type / ud_mnemonic_code). 'value' is the sign-extended immediate, the memory displacement, the absolute branch target or an implicit
+	// constant, and zero for registers.
+	struct DecodedOperand
+	{
+		unsigned short type;
+		unsigned short base;
+		unsigned short index;
+		unsigned char scale;
+		unsigned char size;
+		long long value;
+
+		DecodedOperand() : type(0), base(0), index(0), scale(0), size(0), value(0) { }
+	};
+
+	struct DecodedInstruction
+	{
+		void* address;
+		unsigned short mnemonic;
+		unsigned char length;
+		unsigned char operandCount;
+		DecodedOperand operands[4];
+
+		DecodedInstruction() : address(nullptr), mnemonic(0), length(0), operandCount(0), operands() { }
+	};
+
 	static void setAllMemoryPermissions(void* address, int length);
 	static void writeMemory(void* to, void* from, int length);
-	static std::string preProcessAssembly(std::string assembly);
+	static bool writeMemoryAtomic(void* to, const void* from, int length);
+	static std::string preProcessAssembly(std::string assembly, void* addressStart = nullptr);
 	static HackUtils::CompileResult assemble(std::string assembly, void* addressStart);
+	// Same as assemble() but runs PeepholeOptimizer over the parsed instructions first, flagsLiveAtEnd keeps it from
+	// clobbering flags the code after the patch still reads
+	static HackUtils::CompileResult assembleOptimized(std::string assembly, void* addressStart, bool flagsLiveAtEnd, std::vector<PeepholeRewrite>& outRewrites);
+	static std::vector<HackUtils::CompileResult> assembleBatch(const std::vector<AssemblyJob>& jobs);
+	static HackUtils::CompileResult validate(std::string assembly, void* addressStart);
 	static void* resolveVTableAddress(void* address);
-	static std::string disassemble(void* address, int length);
+	// Receives whole lines of disassembly, returning false stops the stream
+	typedef std::function<bool(const char* text, size_t length)> DisassemblySink;
+
+	static std::string disassemble(void* address, int length, void* runtimeAddress = nullptr, bool withSymbols = false);
+	static void disassembleToSink(void* address, size_t length, const DisassemblySink& sink, size_t batchSize = 64 * 1024, bool withSymbols = false);
+	static DisassemblySink createFileSink(int fileDescriptor);
+	static void decode(void* address, int length, std::vector<DecodedInstruction>& outInstructions);
+	static std::string getInstructionText(const DecodedInstruction& instruction);
 	static std::string preProcess(std::string instructions);
+	static void appendDecimalLiterals(const char* text, std::string& outText);
 	static std::string toHex(int value, bool prefix = false);
 	static void* intToPointer(std::string intString, void* fallback = nullptr);
+
+private:
+	// Keyed by (address, length, runtime address, with symbols)
+	typedef std::tuple<unsigned long long, int, unsigned long long, bool> DisassemblyCacheKey;
+
+	struct CachedDisassembly
+	{
+		unsigned int checksum;
+		std::shared_ptr<const std::string> text;
+		std::list<DisassemblyCacheKey>::iterator recentUse;
+
+		CachedDisassembly() : checksum(0), text(nullptr), recentUse() { }
+		CachedDisassembly(unsigned int checksum, std::shared_ptr<const std::string> text, std::list<DisassemblyCacheKey>::iterator recentUse)
+			: checksum(checksum), text(text), recentUse(recentUse) { }
+	};
+
+	// One lock per shard, held only to look up, insert or evict. Entries are ordered by address so writes can find the ones they
+	// overlap, and recentUses runs from most to least recently used.
+	struct DisassemblyCacheShard
+	{
+		std::mutex mutex;
+		std::map<DisassemblyCacheKey, CachedDisassembly> entries;
+		std::list<DisassemblyCacheKey> recentUses;
+	};
+
+	static void invalidateDisassemblyCache(void* address, int length);
+	static std::string resolveMemorySymbols(std::string assembly, void* addressStart);
+	static bool isWholeMemoryOperand(const std::string& assembly, size_t tokenStart, size_t tokenEnd);
+	static std::string getSizeKeyword(int byteSize);
+	static bool isRegisterName(std::string name);
+	static bool hasUndefinedLabels(asmjit::CodeHolder& code, CompileResult& compileResult);
+	static std::string getCompileErrorMessage(CompileResult::ErrorId errorId);
+	static int getLineNumber(const std::string& assembly, size_t offset);
+
+	static DisassemblyCacheShard& getDisassemblyCacheShard(void* address);
+
+	static const int DisassemblyCacheShardCount = 16;
+	static DisassemblyCacheShard DisassemblyCacheShards[DisassemblyCacheShardCount];
+	static const int MaxCachedLength;
+	static const int MaxDisassemblyCacheEntries;
 };
@@ -1,10 +1,17 @@
 #include "HackableCode.h"
 
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 
+#include "CodeCaveAllocator.h"
+#include "CodeRelocator.h"
+#include "HackableExpression.h"
 #include "HackUtils.h"
+#include "InstructionLength.h"
 
 HackableCode::MarkerMap HackableCode::MarkerCache = HackableCode::MarkerMap();
+std::map<void*, std::shared_ptr<const std::string>> HackableCode::OriginalAssemblyCache = std::map<void*, std::shared_ptr<const std::string>>();
 
 // Note: all tags are assumed to start with a different byte and have the same length
 const unsigned char HackableCode::StartTagSignature[] = { 0x57, 0x6A, 0x45, 0xBF, 0xDE, 0xC0, 0xED, 0xFE, 0x5F, 0x5F };
@@ -21,23 +28,45 @@ HackableCode::HackableCode(void* codeStart, void* codeEnd)
 	this->codePointer = (unsigned char*)codeStart;
 	this->codeEndPointer = (unsigned char*)codeEnd;
 	this->originalCodeLength = (int)((unsigned long)codeEnd - (unsigned long)codeStart);
-	this->originalCodeCopy = std::vector<unsigned char>();
-	this->originalAssemblyString = HackUtils::disassemble(codeStart, this->originalCodeLength);
-	this->assemblyString = this->originalAssemblyString;
+	this->originalCodeCopy = std::vector<unsigned char>((unsigned char*)codeStart, (unsigned char*)codeEnd);
+	this->originalAssemblyString = nullptr;
+	this->assemblyString = nullptr;
+	this->overflowCave = nullptr;
+	this->isLivenessComputed = false;
+	this->liveAtStart = RegisterLiveness::getAllRegisters();
+	this->liveAtEnd = RegisterLiveness::getAllRegisters();
+	this->peepholeRewrites = std::vector<HackUtils::PeepholeRewrite>();
+	this->liveClobbers = RegisterLiveness::RegisterSet();
 }
 
 HackableCode::~HackableCode()
 {
 }
 
-std::string HackableCode::getAssemblyString()
+const std::string& HackableCode::getAssemblyString()
 {
-	return this->assemblyString;
+	// Until the first patch the current text is the original text
+	return this->assemblyString == nullptr ? this->getOriginalAssemblyString() : *this->assemblyString;
 }
 
-std::string HackableCode::getOriginalAssemblyString()
+const std::string& HackableCode::getOriginalAssemblyString()
 {
-	return this->originalAssemblyString;
+	if (this->originalAssemblyString == nullptr)
+	{
+		auto cachedAssembly = HackableCode::OriginalAssemblyCache.find(this->codePointer);
+
+		// Disassemble the saved copy rather than live memory, which may have been patched since construction
+		if (cachedAssembly == HackableCode::OriginalAssemblyCache.end())
+		{
+			std::string originalAssembly = HackUtils::disassemble(this->originalCodeCopy.data(), this->originalCodeLength, this->codePointer);
+
+			cachedAssembly = HackableCode::OriginalAssemblyCache.emplace(this->codePointer, std::make_shared<const std::string>(originalAssembly)).first;
+		}
+
+		this->originalAssemblyString = cachedAssembly->second;
+	}
+
+	return *this->originalAssemblyString;
 }
 
 void* HackableCode::getPointer()
@@ -52,17 +81,18 @@ int HackableCode::getOriginalLength()
 
 bool HackableCode::applyCustomCode(std::string newAssembly)
 {
-	this->assemblyString = newAssembly;
+	this->setAssemblyString(newAssembly);
+	this->computeLiveness();
 
 	if (this->codePointer == nullptr)
 	{
 		return false;
 	}
 
-	HackUtils::CompileResult compileResult = HackUtils::assemble(this->assemblyString, this->codePointer);
+	HackUtils::CompileResult compileResult = HackUtils::assembleOptimized(newAssembly, this->codePointer, this->liveAtEnd.flags, this->peepholeRewrites);
 
 	// Try to compile code
-	if (compileResult.hasError || compileResult.byteCount > this->originalCodeLength)
+	if (compileResult.hasError)
 	{
 		std::cout << compileResult.errorData.message << std::endl;
 
@@ -70,23 +100,373 @@ bool HackableCode::applyCustomCode(std::string newAssembly)
 		return false;
 	}
 
-	int unfilledBytes = this->originalCodeLength - compileResult.byteCount;
+	this->liveClobbers = this->findLiveClobbers(compileResult.compiledBytes);
+
+	// Patches that don't fit run from a code cave instead, reached through a jmp written over the region
+	if ((int)compileResult.compiledBytes.size() > this->originalCodeLength)
+	{
+		return this->applyOverflowCode([&](void* caveAddress)
+		{
+			return HackUtils::assembleOptimized(newAssembly, caveAddress, this->liveAtEnd.flags, this->peepholeRewrites);
+		}, compileResult.compiledBytes.size());
+	}
+
+	if (!this->writeCustomBytes(compileResult.compiledBytes))
+	{
+		return false;
+	}
+
+	this->releaseOverflowCave();
+
+	return true;
+}
+
+bool HackableCode::applyExpression(std::string expression)
+{
+	this->setAssemblyString(expression);
+	this->computeLiveness();
+
+	if (this->codePointer == nullptr)
+	{
+		return false;
+	}
+
+	// Only registers live after the region are kept intact, the rest are free for the allocator
+	HackUtils::CompileResult compileResult = HackableExpression::compile(expression, this->codePointer, this->liveAtEnd);
+
+	this->liveClobbers = RegisterLiveness::RegisterSet();
+
+	if (compileResult.hasError)
+	{
+		std::cout << compileResult.errorData.message << std::endl;
+		return false;
+	}
+
+	// Expressions compile to straight-line code that only addresses registers and register-relative locals, with no branches or
+	// rip-relative operands, so it is position-independent by construction and runs unchanged from wherever the cave lands
+	if ((int)compileResult.compiledBytes.size() > this->originalCodeLength)
+	{
+		return this->applyOverflowCode([&](void*) { return compileResult; }, compileResult.compiledBytes.size());
+	}
+
+	if (!this->writeCustomBytes(compileResult.compiledBytes))
+	{
+		return false;
+	}
+
+	this->releaseOverflowCave();
+
+	return true;
+}
+
+bool HackableCode::applyHook(std::string hookAssembly, HookPosition position)
+{
+	bool runsBefore = position == HookPosition::Before;
+
+	this->setAssemblyString(runsBefore ? hookAssembly + "\n" + this->getOriginalAssemblyString() : this->getOriginalAssemblyString() + "\n" + hookAssembly);
+	this->computeLiveness();
+
+	if (this->codePointer == nullptr)
+	{
+		return false;
+	}
+
+	// Relocated branches always take their rel32 form, so the size is known before the cave is
+	int relocatedSize = CodeRelocator::getRelocatedSize(this->originalCodeCopy.data(), this->originalCodeLength, true);
+
+	if (relocatedSize < 0)
+	{
+		return false;
+	}
+
+	// A hook that runs first is followed by the original instructions, which may still read the flags live at the start
+	bool flagsLive = runsBefore ? this->liveAtStart.flags : this->liveAtEnd.flags;
+	HackUtils::CompileResult compileResult = HackUtils::assembleOptimized(hookAssembly, this->codePointer, flagsLive, this->peepholeRewrites);
+
+	if (compileResult.hasError)
+	{
+		std::cout << compileResult.errorData.message << std::endl;
+		return false;
+	}
+
+	// Run after the original code the hook sees exactly the state a replacement patch would, run before it the original code
+	// overwrites whatever the hook leaves behind
+	this->liveClobbers = runsBefore ? RegisterLiveness::RegisterSet() : this->findLiveClobbers(compileResult.compiledBytes);
+
+	// Hooks always run from a cave, the region only holds the jump into it
+	return this->applyOverflowCode([&](void* caveAddress)
+	{
+		unsigned char* cave = (unsigned char*)caveAddress;
+		HackUtils::CompileResult hookResult = HackUtils::assembleOptimized(hookAssembly, runsBefore ? cave : cave + relocatedSize, flagsLive, this->peepholeRewrites);
+		std::vector<unsigned char> relocatedBytes = std::vector<unsigned char>();
+
+		if (hookResult.hasError)
+		{
+			return hookResult;
+		}
+
+		if (!CodeRelocator::relocate(this->originalCodeCopy.data(), this->originalCodeLength, this->codePointer,
+			runsBefore ? cave + hookResult.compiledBytes.size() : cave, true, relocatedBytes))
+		{
+			hookResult.hasError = true;
+			hookResult.errorData.message = "Unable to relocate the original instructions of the hackable region";
+
+			return hookResult;
+		}
+
+		hookResult.compiledBytes.insert(runsBefore ? hookResult.compiledBytes.end() : hookResult.compiledBytes.begin(), relocatedBytes.begin(), relocatedBytes.end());
+		hookResult.byteCount = (int)hookResult.compiledBytes.size();
 
-	// Fill remaining bytes with NOPs
-	for (int index = 0; index < unfilledBytes; index++)
+		return hookResult;
+	}, compileResult.compiledBytes.size() + relocatedSize);
+}
+
+bool HackableCode::applyCustomCode(std::vector<unsigned char> newBytes)
+{
+	if (this->codePointer == nullptr || !this->writeCustomBytes(newBytes))
 	{
-		const unsigned char nop = 0x90;
-		compileResult.compiledBytes.push_back(nop);
+		return false;
 	}
 
-	HackUtils::writeMemory(this->codePointer, compileResult.compiledBytes.data(), compileResult.compiledBytes.size());
+	// Pre-encoded bytes have no source text, so show what actually landed in the region
+	this->setAssemblyString(HackUtils::disassemble(this->codePointer, (int)newBytes.size()));
+	this->releaseOverflowCave();
+	this->liveClobbers = RegisterLiveness::RegisterSet();
 
 	return true;
 }
 
 void HackableCode::restoreState()
 {
+	// The analysis reads the live region, so it runs ahead of every write to it
+	this->computeLiveness();
+
 	HackUtils::writeMemory(this->codePointer, this->originalCodeCopy.data(), this->originalCodeCopy.size());
+
+	this->releaseOverflowCave();
+	this->peepholeRewrites.clear();
+	this->liveClobbers = RegisterLiveness::RegisterSet();
+}
+
+const std::vector<HackUtils::PeepholeRewrite>& HackableCode::getPeepholeRewrites()
+{
+	return this->peepholeRewrites;
+}
+
+RegisterLiveness::RegisterSet HackableCode::getLiveClobbers()
+{
+	return this->liveClobbers;
+}
+
+RegisterLiveness::RegisterSet HackableCode::getFreeRegistersAtStart()
+{
+	this->computeLiveness();
+
+	return RegisterLiveness::getFreeRegisters(this->liveAtStart);
+}
+
+RegisterLiveness::RegisterSet HackableCode::getFreeRegistersAtEnd()
+{
+	this->computeLiveness();
+
+	return RegisterLiveness::getFreeRegisters(this->liveAtEnd);
+}
+
+void HackableCode::computeLiveness()
+{
+	if (this->isLivenessComputed)
+	{
+		return;
+	}
+
+	std::vector<RegisterLiveness::RegisterSet> liveSets;
+
+	// The analysis decodes the live function, so it has to run before any patch replaces the region. Every path that writes the
+	// region goes through writeCustomBytes, applyOverflowCode or restoreState, which all call this first.
+	RegisterLiveness::findLiveRegisters({ this->codePointer, this->codeEndPointer }, liveSets);
+
+	this->liveAtStart = liveSets[0];
+	this->liveAtEnd = liveSets[1];
+	this->isLivenessComputed = true;
+}
+
+RegisterLiveness::RegisterSet HackableCode::findLiveClobbers(std::vector<unsigned char>& newBytes)
+{
+	this->computeLiveness();
+
+	// Changing what the original code already changes is the point of a hack, so only registers it left alone are reported
+	RegisterLiveness::RegisterSet written = RegisterLiveness::getWrittenRegisters(newBytes.data(), (int)newBytes.size());
+	RegisterLiveness::RegisterSet originalWritten = RegisterLiveness::getWrittenRegisters(this->originalCodeCopy.data(), this->originalCodeLength);
+	return RegisterLiveness::RegisterSet(
+		written.registers & this->liveAtEnd.registers & ~originalWritten.registers,
+		written.flags && this->liveAtEnd.flags && !originalWritten.flags);
+}
+
+bool HackableCode::writeCustomBytes(std::vector<unsigned char> newBytes)
+{
+	this->computeLiveness();
+
+	if ((int)newBytes.size() > this->originalCodeLength)
+	{
+		// Fail the activation
+		return false;
+	}
+
+	HackableCode::appendPadding(newBytes, this->originalCodeLength - (int)newBytes.size());
+
+	HackUtils::writeMemory(this->codePointer, newBytes.data(), newBytes.size());
+
+	return true;
+}
+
+bool HackableCode::applyOverflowCode(const std::function<HackUtils::CompileResult(void* caveAddress)>& compileAt, size_t estimatedSize)
+{
+	const int jumpSize = 5;
+	const int absoluteJumpSize = 14;
+
+	this->computeLiveness();
+
+	if (this->originalCodeLength < jumpSize)
+	{
+		std::cout << "Hack is too large for the hackable region, which is too small to jump to a code cave" << std::endl;
+		return false;
+	}
+
+	// Branches may encode differently at the cave's address, so leave some slack over the first pass size
+	size_t caveSize = estimatedSize + absoluteJumpSize + 16;
+	void* cave = nullptr;
+	CodeCaveAllocator::Result allocateResult = CodeCaveAllocator::allocate(this->codePointer, caveSize, &cave);
+
+	// Out of rel32 reach still works, just with a 14 byte absolute jump into the cave
+	if (allocateResult == CodeCaveAllocator::Result::OutOfReach)
+	{
+		std::cout << "No code cave within jmp rel32 range of the hackable region, falling back to an absolute jump" << std::endl;
+		allocateResult = CodeCaveAllocator::allocate(nullptr, caveSize, &cave);
+	}
+
+	if (allocateResult != CodeCaveAllocator::Result::Ok)
+	{
+		std::cout << (allocateResult == CodeCaveAllocator::Result::TooLarge ? "Hack is too large for a code cave" : "Unable to allocate a code cave for the hack") << std::endl;
+		return false;
+	}
+
+	HackUtils::CompileResult compileResult = compileAt(cave);
+	std::vector<unsigned char> caveBytes = compileResult.compiledBytes;
+	std::vector<unsigned char> entryBytes = std::vector<unsigned char>();
+
+	if (!compileResult.hasError)
+	{
+		HackableCode::appendJump(caveBytes, (unsigned char*)cave + caveBytes.size(), this->codeEndPointer);
+		HackableCode::appendJump(entryBytes, this->codePointer, cave);
+	}
+
+	if (compileResult.hasError || caveBytes.size() > caveSize || (int)entryBytes.size() > this->originalCodeLength)
+	{
+		std::cout << (compileResult.hasError ? compileResult.errorData.message : "Code cave is out of jmp rel32 range of the hackable region") << std::endl;
+
+		CodeCaveAllocator::release(cave);
+		return false;
+	}
+
+	memcpy(cave, caveBytes.data(), caveBytes.size());
+
+	// The region only holds the jump out, the rest of it is never executed
+	this->writeCustomBytes(entryBytes);
+	this->releaseOverflowCave();
+	this->overflowCave = cave;
+
+	return true;
+}
+
+void HackableCode::releaseOverflowCave()
+{
+	// Only called once the region no longer jumps into the cave
+	if (this->overflowCave != nullptr)
+	{
+		CodeCaveAllocator::release(this->overflowCave);
+		this->overflowCave = nullptr;
+	}
+}
+
+void HackableCode::appendJump(std::vector<unsigned char>& bytes, void* jumpAddress, void* targetAddress)
+{
+	long long displacement = (long long)((unsigned char*)targetAddress - ((unsigned char*)jumpAddress + 5));
+
+	// jmp rel32 when the target is within 2GB, otherwise jmp [rip+0] followed by the absolute address
+	if (sizeof(void*) == 4 || (displacement >= INT32_MIN && displacement <= INT32_MAX))
+	{
+		int displacement32 = (int)displacement;
+
+		bytes.push_back(0xE9);
+		bytes.insert(bytes.end(), (unsigned char*)&displacement32, (unsigned char*)&displacement32 + sizeof(displacement32));
+	}
+	else
+	{
+		unsigned long long target = (unsigned long long)targetAddress;
+		const unsigned char absoluteJump[] = { 0xFF, 0x25, 0x00, 0x00, 0x00, 0x00 };
+
+		bytes.insert(bytes.end(), absoluteJump, absoluteJump + sizeof(absoluteJump));
+		bytes.insert(bytes.end(), (unsigned char*)&target, (unsigned char*)&target + sizeof(target));
+	}
+}
+
+void HackableCode::appendPadding(std::vector<unsigned char>& bytes, int length)
+{
+	// Recommended long NOP forms (0F 1F /0), longer ones add 66 prefixes. Capped at 11 bytes since some cores decode instructions
+	// with more than a few prefixes slowly.
+	static const unsigned char LongNops[][11] =
+	{
+		{ 0x90 },
+		{ 0x66, 0x90 },
+		{ 0x0F, 0x1F, 0x00 },
+		{ 0x0F, 0x1F, 0x40, 0x00 },
+		{ 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+		{ 0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+		{ 0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00 },
+		{ 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+		{ 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+		{ 0x66, 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+		{ 0x66, 0x66, 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	};
+	const int maxNopLength = 11;
+	const int jumpOverThreshold = 3 * maxNopLength;
+
+	// Past a few NOPs, one taken jump is cheaper than decoding the rest. The skipped bytes still get NOPs so the region disassembles cleanly.
+	if (length > jumpOverThreshold)
+	{
+		int skippedLength = length - 2;
+
+		if (skippedLength <= INT8_MAX)
+		{
+			bytes.push_back(0xEB);
+			bytes.push_back((unsigned char)skippedLength);
+		}
+		else
+		{
+			skippedLength = length - 5;
+
+			bytes.push_back(0xE9);
+			bytes.insert(bytes.end(), (unsigned char*)&skippedLength, (unsigned char*)&skippedLength + sizeof(skippedLength));
+		}
+
+		length = skippedLength;
+	}
+
+	while (length > 0)
+	{
+		int nopLength = length < maxNopLength ? length : maxNopLength;
+
+		bytes.insert(bytes.end(), LongNops[nopLength - 1], LongNops[nopLength - 1] + nopLength);
+		length -= nopLength;
+	}
+}
+
+void HackableCode::setAssemblyString(std::string newAssemblyString)
+{
+	this->assemblyString = std::make_shared<const std::string>(newAssemblyString);
+
+	// Whatever the last assembly's peephole pass reported no longer describes the region
+	this->peepholeRewrites.clear();
 }
 
 std::vector<HackableCode*> HackableCode::parseHackables(void* functionStart)
@@ -174,8 +554,17 @@ std::vector<HackableCode::HackableCodeMarkers>& HackableCode::parseHackableMarke
 					if (nextHackableCodeStart != nullptr)
 					{
 						void* nextHackableCodeEnd = (void*)currentBase;
-
-						extractedMarkers.push_back(HackableCodeMarkers(nextHackableCodeStart, nextHackableCodeEnd));
+						int regionLength = (int)((unsigned char*)nextHackableCodeEnd - (unsigned char*)nextHackableCodeStart);
+
+						// Tags are matched byte by byte, so a region that doesn't end on an instruction boundary came from tag bytes inside other instructions
+						if (regionLength == 0 || InstructionLength::getCoveringLength(nextHackableCodeStart, regionLength) == regionLength)
+						{
+							extractedMarkers.push_back(HackableCodeMarkers(nextHackableCodeStart, nextHackableCodeEnd));
+						}
+						else
+						{
+							std::cout << "Skipping a hackable region that doesn't end on an instruction boundary" << std::endl;
+						}
 
 						nextHackableCodeStart = nullptr;
 					}
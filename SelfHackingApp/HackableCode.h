@@ -1,8 +1,14 @@
 #pragma once
+#include <array>
+#include <functional>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "HackUtils.h"
+#include "RegisterLiveness.h"
+
 #ifndef _WIN32
 #include <sys/mman.h>
 #endif
@@ -145,20 +151,53 @@
 class HackableCode
 {
 public:
+	enum class HookPosition
+	{
+		Before,
+		After,
+	};
+
 	static std::vector<HackableCode*> create(void* functionStart);
 
-	std::string getAssemblyString();
-	std::string getOriginalAssemblyString();
+	const std::string& getAssemblyString();
+	const std::string& getOriginalAssemblyString();
 	void* getPointer();
 	int getOriginalLength();
 	bool applyCustomCode(std::string newAssembly);
+	bool applyCustomCode(std::vector<unsigned char> newBytes);
+
+	// Compiles statements such as 'health = health - damage * 2', see HackableExpression
+	bool applyExpression(std::string expression);
+
+	// Runs the hook before or after the region's original instructions, which are relocated into a code cave together with it
+	bool applyHook(std::string hookAssembly, HookPosition position);
+
+	template<std::size_t Size>
+	bool applyCustomCode(const std::array<unsigned char, Size>& newBytes)
+	{
+		return this->applyCustomCode(std::vector<unsigned char>(newBytes.begin(), newBytes.end()));
+	}
+
 	void restoreState();
 
+	// What the peephole pass changed in the last applied assembly, with the bytes and cycles each change saved
+	const std::vector<HackUtils::PeepholeRewrite>& getPeepholeRewrites();
+
+	// Live registers and flags the last applied patch overwrites that the original code left alone. Often that is the point of the
+	// patch, so nothing is printed, callers decide whether to warn about them.
+	RegisterLiveness::RegisterSet getLiveClobbers();
+
+	// Registers and flags that are dead where the hackable region starts and ends, so patches can use them without saving them
+	RegisterLiveness::RegisterSet getFreeRegistersAtStart();
+	RegisterLiveness::RegisterSet getFreeRegistersAtEnd();
+
 protected:
 	HackableCode(void* codeStart, void* codeEnd);
 	virtual ~HackableCode();
 
 private:
+	friend class HackableCodeTemplate;
+
 	struct HackableCodeMarkers
 	{
 		void* start;
@@ -173,14 +212,38 @@ private:
 	static std::vector<HackableCode*> parseHackables(void* functionStart);
 	static std::vector<HackableCode::HackableCodeMarkers>& parseHackableMarkers(void* functionStart);
 
-	std::string assemblyString;
-	std::string originalAssemblyString;
+	bool writeCustomBytes(std::vector<unsigned char> newBytes);
+	bool applyOverflowCode(const std::function<HackUtils::CompileResult(void* caveAddress)>& compileAt, size_t estimatedSize);
+	void releaseOverflowCave();
+	void setAssemblyString(std::string newAssemblyString);
+	void computeLiveness();
+	RegisterLiveness::RegisterSet findLiveClobbers(std::vector<unsigned char>& newBytes);
+
+	// Both are null until needed. The original text is disassembled on first access and interned per region, and the current text
+	// only gets its own string once the code is patched.
+	std::shared_ptr<const std::string> assemblyString;
+	std::shared_ptr<const std::string> originalAssemblyString;
 	void* codePointer;
 	void* codeEndPointer;
 	std::vector<unsigned char> originalCodeCopy;
 	int originalCodeLength;
 
+	// Computed on first use, everything is treated as live until then
+	bool isLivenessComputed;
+	RegisterLiveness::RegisterSet liveAtStart;
+	RegisterLiveness::RegisterSet liveAtEnd;
+
+	// Code cave holding a patch too large for the region, if one is applied
+	void* overflowCave;
+
+	std::vector<HackUtils::PeepholeRewrite> peepholeRewrites;
+	RegisterLiveness::RegisterSet liveClobbers;
+
+	static void appendJump(std::vector<unsigned char>& bytes, void* jumpAddress, void* targetAddress);
+	static void appendPadding(std::vector<unsigned char>& bytes, int length);
+
 	static MarkerMap MarkerCache;
+	static std::map<void*, std::shared_ptr<const std::string>> OriginalAssemblyCache;
 	static const unsigned char StartTagSignature[];
 	static const unsigned char EndTagSignature[];
 	static const unsigned char StopSearchTagSignature[];
@@ -0,0 +1,334 @@
+#include "HackableCodeTemplate.h"
+
+#include <cctype>
+#include <iostream>
+
+#include "HackableCode.h"
+#include "HackUtils.h"
+
+// Placeholders are assembled with values that need a full 32-bit field and differ in every byte, so diffing two assemblies pins down each field
+const long long HackableCodeTemplate::PlaceholderValue = 0x41424344;
+const long long HackableCodeTemplate::PlaceholderProbeValue = 0x51525354;
+
+HackableCodeTemplate* HackableCodeTemplate::create(HackableCode* hackableCode, std::string templateAssembly)
+{
+	if (hackableCode == nullptr)
+	{
+		return nullptr;
+	}
+
+	HackableCodeTemplate* hackableCodeTemplate = new HackableCodeTemplate(hackableCode);
+
+	if (!hackableCodeTemplate->parseTemplate(templateAssembly) || !hackableCodeTemplate->compileTemplate())
+	{
+		delete hackableCodeTemplate;
+
+		return nullptr;
+	}
+
+	return hackableCodeTemplate;
+}
+
+HackableCodeTemplate::HackableCodeTemplate(HackableCode* hackableCode)
+{
+	this->hackableCode = hackableCode;
+	this->segments = std::vector<TemplateSegment>();
+	this->slots = std::vector<ParameterSlot>();
+	this->templateBytes = std::vector<unsigned char>();
+	this->parameters = std::map<std::string, long long>();
+	this->isBound = false;
+}
+
+HackableCodeTemplate::~HackableCodeTemplate()
+{
+}
+
+bool HackableCodeTemplate::apply()
+{
+	bool allSlotsFit = true;
+
+	for (auto slot : this->slots)
+	{
+		allSlotsFit &= this->slotFitsValue(slot, this->parameters[slot.parameterName]);
+	}
+
+	if (allSlotsFit)
+	{
+		std::vector<unsigned char> instantiatedBytes = this->templateBytes;
+
+		for (auto slot : this->slots)
+		{
+			this->encodeSlot(instantiatedBytes.data() + slot.byteOffset, slot, this->parameters[slot.parameterName]);
+		}
+
+		if (this->hackableCode->writeCustomBytes(instantiatedBytes))
+		{
+			// Same release step as applyCustomCode, a cave left by an earlier oversized patch is no longer jumped to
+			this->hackableCode->setAssemblyString(this->getAssemblyString());
+			this->hackableCode->releaseOverflowCave();
+			this->isBound = true;
+
+			return true;
+		}
+	}
+
+	// Either a value no longer fits its field or the full-width encoding is too large for the region. Assemble the literal values instead.
+	this->isBound = false;
+
+	return this->hackableCode->applyCustomCode(this->getAssemblyString());
+}
+
+bool HackableCodeTemplate::setParameter(std::string name, long long value)
+{
+	if (this->parameters.find(name) == this->parameters.end())
+	{
+		std::cout << "Unknown template parameter: " << name << std::endl;
+		return false;
+	}
+
+	this->parameters[name] = value;
+
+	// The region may have been restored or patched with something else since the template was applied
+	if (!this->isBound || !this->isTemplateInPlace())
+	{
+		return this->apply();
+	}
+
+	for (auto slot : this->slots)
+	{
+		if (slot.parameterName == name && !this->slotFitsValue(slot, value))
+		{
+			return this->apply();
+		}
+	}
+
+	// Fast path: the template encoding is already in place, so only the immediate/displacement bytes change
+	for (auto slot : this->slots)
+	{
+		if (slot.parameterName == name)
+		{
+			unsigned char slotBytes[sizeof(int)];
+
+			this->encodeSlot(slotBytes, slot, value);
+			HackUtils::writeMemory((unsigned char*)this->hackableCode->getPointer() + slot.byteOffset, slotBytes, slot.byteWidth);
+		}
+	}
+
+	this->hackableCode->setAssemblyString(this->getAssemblyString());
+
+	return true;
+}
+
+bool HackableCodeTemplate::isTemplateInPlace()
+{
+	const unsigned char* region = (const unsigned char*)this->hackableCode->getPointer();
+	std::vector<bool> isSlotByte = std::vector<bool>(this->templateBytes.size(), false);
+
+	for (auto slot : this->slots)
+	{
+		for (int index = 0; index < slot.byteWidth; index++)
+		{
+			isSlotByte[slot.byteOffset + index] = true;
+		}
+	}
+
+	// Slot bytes hold whatever values were last written, everything else has to still be the template encoding
+	for (size_t index = 0; index < this->templateBytes.size(); index++)
+	{
+		if (!isSlotByte[index] && region[index] != this->templateBytes[index])
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+long long HackableCodeTemplate::getParameter(std::string name)
+{
+	return this->parameters.find(name) == this->parameters.end() ? 0 : this->parameters[name];
+}
+
+std::string HackableCodeTemplate::getAssemblyString()
+{
+	std::vector<long long> segmentValues = std::vector<long long>();
+
+	for (auto segment : this->segments)
+	{
+		segmentValues.push_back(this->parameters[segment.parameterName]);
+	}
+
+	return this->render(segmentValues);
+}
+
+bool HackableCodeTemplate::parseTemplate(std::string templateAssembly)
+{
+	std::string text = "";
+
+	for (size_t index = 0; index < templateAssembly.size(); index++)
+	{
+		if (templateAssembly[index] != '{')
+		{
+			text += templateAssembly[index];
+			continue;
+		}
+
+		size_t closeIndex = templateAssembly.find('}', index);
+
+		if (closeIndex == std::string::npos)
+		{
+			std::cout << "Unterminated template parameter" << std::endl;
+			return false;
+		}
+
+		std::string name = templateAssembly.substr(index + 1, closeIndex - index - 1);
+		bool isValidName = !name.empty() && !std::isdigit((unsigned char)name[0]);
+
+		for (auto next : name)
+		{
+			isValidName &= (std::isalnum((unsigned char)next) || next == '_');
+		}
+
+		if (!isValidName)
+		{
+			std::cout << "Invalid template parameter name: " << name << std::endl;
+			return false;
+		}
+
+		this->segments.push_back(TemplateSegment(text, name));
+		this->parameters[name] = 0;
+
+		text = "";
+		index = closeIndex;
+	}
+
+	this->segments.push_back(TemplateSegment(text, ""));
+
+	return true;
+}
+
+bool HackableCodeTemplate::compileTemplate()
+{
+	std::vector<long long> placeholderValues = std::vector<long long>(this->segments.size(), HackableCodeTemplate::PlaceholderValue);
+	HackUtils::CompileResult compileResult = HackUtils::assemble(this->render(placeholderValues), this->hackableCode->getPointer());
+
+	if (compileResult.hasError)
+	{
+		std::cout << compileResult.errorData.message << std::endl;
+		return false;
+	}
+
+	auto readInt32 = [](const std::vector<unsigned char>& bytes, int offset)
+	{
+		unsigned int value = 0;
+
+		for (int index = sizeof(int) - 1; index >= 0; index--)
+		{
+			value = (value << 8) | bytes[offset + index];
+		}
+
+		return (int)value;
+	};
+
+	// Re-assemble once per placeholder with a different value; the bytes that change are that placeholder's field
+	for (int segmentIndex = 0; segmentIndex < (int)this->segments.size(); segmentIndex++)
+	{
+		if (this->segments[segmentIndex].parameterName.empty())
+		{
+			continue;
+		}
+
+		std::vector<long long> probeValues = placeholderValues;
+		probeValues[segmentIndex] = HackableCodeTemplate::PlaceholderProbeValue;
+
+		HackUtils::CompileResult probeResult = HackUtils::assemble(this->render(probeValues), this->hackableCode->getPointer());
+
+		if (probeResult.hasError || probeResult.byteCount != compileResult.byteCount)
+		{
+			std::cout << "Template parameter must be a 32-bit immediate or displacement: " << this->segments[segmentIndex].parameterName << std::endl;
+			return false;
+		}
+
+		int firstDifference = -1;
+		int lastDifference = -1;
+
+		for (int index = 0; index < compileResult.byteCount; index++)
+		{
+			if (compileResult.compiledBytes[index] != probeResult.compiledBytes[index])
+			{
+				firstDifference = firstDifference < 0 ? index : firstDifference;
+				lastDifference = index;
+			}
+		}
+
+		const int byteWidth = sizeof(int);
+
+		if (firstDifference < 0 || lastDifference - firstDifference >= byteWidth || firstDifference + byteWidth > compileResult.byteCount)
+		{
+			std::cout << "Unable to locate template parameter: " << this->segments[segmentIndex].parameterName << std::endl;
+			return false;
+		}
+
+		int encodedValue = readInt32(compileResult.compiledBytes, firstDifference);
+		int sign = encodedValue == (int)HackableCodeTemplate::PlaceholderValue ? 1 : (encodedValue == -(int)HackableCodeTemplate::PlaceholderValue ? -1 : 0);
+
+		if (sign == 0)
+		{
+			std::cout << "Template parameter is not encoded verbatim: " << this->segments[segmentIndex].parameterName << std::endl;
+			return false;
+		}
+
+		// Some encodings zero-extend (ie 'mov r64, imm32' may become 'mov r32, imm32'), so only allow negative values if they survive unchanged
+		probeValues[segmentIndex] = -HackableCodeTemplate::PlaceholderValue;
+		probeResult = HackUtils::assemble(this->render(probeValues), this->hackableCode->getPointer());
+
+		bool isSigned = !probeResult.hasError
+			&& probeResult.byteCount == compileResult.byteCount
+			&& readInt32(probeResult.compiledBytes, firstDifference) == -encodedValue;
+
+		this->slots.push_back(ParameterSlot(this->segments[segmentIndex].parameterName, firstDifference, byteWidth, sign, isSigned));
+	}
+
+	this->templateBytes = compileResult.compiledBytes;
+
+	return true;
+}
+
+std::string HackableCodeTemplate::render(std::vector<long long> segmentValues)
+{
+	std::string assembly = "";
+
+	for (int index = 0; index < (int)this->segments.size(); index++)
+	{
+		assembly += this->segments[index].text;
+
+		if (!this->segments[index].parameterName.empty())
+		{
+			assembly += std::to_string(segmentValues[index]);
+		}
+	}
+
+	return assembly;
+}
+
+bool HackableCodeTemplate::slotFitsValue(const ParameterSlot& slot, long long value)
+{
+	long long encodedValue = slot.sign * value;
+
+	if (slot.isSigned)
+	{
+		return encodedValue >= -2147483648LL && encodedValue <= 2147483647LL;
+	}
+
+	return encodedValue >= 0 && encodedValue <= 4294967295LL;
+}
+
+void HackableCodeTemplate::encodeSlot(unsigned char* destination, const ParameterSlot& slot, long long value)
+{
+	unsigned long long encodedValue = (unsigned long long)(slot.sign * value);
+
+	for (int index = 0; index < slot.byteWidth; index++)
+	{
+		destination[index] = (unsigned char)(encodedValue >> (index * 8));
+	}
+}
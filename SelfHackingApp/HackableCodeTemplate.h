@@ -0,0 +1,63 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+
+class HackableCode;
+
+// A patch such as "add eax, {amount}" that is assembled once with full-width placeholders. Changing a parameter afterwards
+// only rewrites the immediate/displacement bytes in the hackable region, falling back to reassembly if the value no longer fits.
+class HackableCodeTemplate
+{
+public:
+	static HackableCodeTemplate* create(HackableCode* hackableCode, std::string templateAssembly);
+
+	bool apply();
+	bool setParameter(std::string name, long long value);
+	long long getParameter(std::string name);
+	std::string getAssemblyString();
+
+protected:
+	HackableCodeTemplate(HackableCode* hackableCode);
+	virtual ~HackableCodeTemplate();
+
+private:
+	struct TemplateSegment
+	{
+		std::string text;
+		std::string parameterName;
+
+		TemplateSegment() : text(""), parameterName("") { }
+		TemplateSegment(std::string text, std::string parameterName) : text(text), parameterName(parameterName) { }
+	};
+
+	struct ParameterSlot
+	{
+		std::string parameterName;
+		int byteOffset;
+		int byteWidth;
+		int sign;
+		bool isSigned;
+
+		ParameterSlot() : parameterName(""), byteOffset(0), byteWidth(0), sign(1), isSigned(true) { }
+		ParameterSlot(std::string parameterName, int byteOffset, int byteWidth, int sign, bool isSigned)
+			: parameterName(parameterName), byteOffset(byteOffset), byteWidth(byteWidth), sign(sign), isSigned(isSigned) { }
+	};
+
+	bool parseTemplate(std::string templateAssembly);
+	bool compileTemplate();
+	std::string render(std::vector<long long> segmentValues);
+	bool isTemplateInPlace();
+	bool slotFitsValue(const ParameterSlot& slot, long long value);
+	void encodeSlot(unsigned char* destination, const ParameterSlot& slot, long long value);
+
+	HackableCode* hackableCode;
+	std::vector<TemplateSegment> segments;
+	std::vector<ParameterSlot> slots;
+	std::vector<unsigned char> templateBytes;
+	std::map<std::string, long long> parameters;
+	bool isBound;
+
+	static const long long PlaceholderValue;
+	static const long long PlaceholderProbeValue;
+};
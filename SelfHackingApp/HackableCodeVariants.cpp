@@ -0,0 +1,104 @@
+#include "HackableCodeVariants.h"
+
+#include <iostream>
+
+#include "HackableCode.h"
+#include "External/asmjit/asmjit.h"
+
+HackableCodeVariants* HackableCodeVariants::create(HackableCode* hackableCode)
+{
+	if (hackableCode == nullptr)
+	{
+		return nullptr;
+	}
+
+	return new HackableCodeVariants(hackableCode);
+}
+
+HackableCodeVariants::HackableCodeVariants(HackableCode* hackableCode)
+{
+	this->hackableCode = hackableCode;
+	this->variants = std::vector<CodeVariant>();
+	this->selectedVariant = -1;
+	this->isSelected = false;
+}
+
+HackableCodeVariants::~HackableCodeVariants()
+{
+}
+
+void HackableCodeVariants::addVariant(std::string assembly, std::vector<CpuFeature> requirements)
+{
+	this->variants.push_back(CodeVariant(assembly, requirements));
+
+	// A new variant may be preferred over the one picked so far
+	this->isSelected = false;
+}
+
+bool HackableCodeVariants::apply()
+{
+	int variantIndex = this->getSelectedVariant();
+
+	if (variantIndex == -1)
+	{
+		std::cout << "No variant of the patch is supported by this CPU" << std::endl;
+		return false;
+	}
+
+	return this->hackableCode->applyCustomCode(this->variants[variantIndex].assembly);
+}
+
+int HackableCodeVariants::getSelectedVariant()
+{
+	if (this->isSelected)
+	{
+		return this->selectedVariant;
+	}
+
+	this->selectedVariant = -1;
+	this->isSelected = true;
+
+	for (int variantIndex = 0; variantIndex < (int)this->variants.size(); variantIndex++)
+	{
+		bool isRunnable = true;
+
+		for (CpuFeature feature : this->variants[variantIndex].requirements)
+		{
+			isRunnable &= HackableCodeVariants::isSupported(feature);
+		}
+
+		if (isRunnable)
+		{
+			this->selectedVariant = variantIndex;
+			break;
+		}
+	}
+
+	return this->selectedVariant;
+}
+
+bool HackableCodeVariants::isSupported(CpuFeature feature)
+{
+	return (HackableCodeVariants::getSupportedFeatures() & (1u << (unsigned int)feature)) != 0;
+}
+
+unsigned int HackableCodeVariants::getSupportedFeatures()
+{
+	// cpuid and xgetbv only need to run once per process, the answer never changes
+	static const unsigned int supportedFeatures = []()
+	{
+		const asmjit::x86::Features& features = asmjit::CpuInfo::host().features<asmjit::x86::Features>();
+		unsigned int result = 0;
+
+		// asmjit already clears the AVX features when the OS doesn't save the extended register state
+		result |= features.has(asmjit::x86::Features::kSSE4_2) ? 1u << (unsigned int)CpuFeature::SSE4_2 : 0;
+		result |= features.has(asmjit::x86::Features::kAVX2) ? 1u << (unsigned int)CpuFeature::AVX2 : 0;
+		result |= features.has(asmjit::x86::Features::kAVX512_F) && features.has(asmjit::x86::Features::kAVX512_BW)
+			&& features.has(asmjit::x86::Features::kAVX512_VL) ? 1u << (unsigned int)CpuFeature::AVX512 : 0;
+		result |= features.has(asmjit::x86::Features::kBMI2) ? 1u << (unsigned int)CpuFeature::BMI2 : 0;
+
+		return result;
+	}();
+
+	return supportedFeatures;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <string>
+#include <vector>
+
+class HackableCode;
+
+// Several versions of the same patch tagged with the instruction set extensions they use, such as a vectorised one needing AVX2
+// next to a plain fallback. The variant is picked from the host CPU the first time the patch is applied and reused after that.
+class HackableCodeVariants
+{
+public:
+	enum class CpuFeature
+	{
+		SSE4_2,
+		AVX2,
+		AVX512,
+		BMI2,
+	};
+
+	static HackableCodeVariants* create(HackableCode* hackableCode);
+
+	// Variants are preferred in the order they are added, so add the most demanding first and end with one that needs nothing
+	void addVariant(std::string assembly, std::vector<CpuFeature> requirements);
+	bool apply();
+
+	// -1 if none of the variants can run on this CPU
+	int getSelectedVariant();
+
+	static bool isSupported(CpuFeature feature);
+
+protected:
+	HackableCodeVariants(HackableCode* hackableCode);
+	virtual ~HackableCodeVariants();
+
+private:
+	struct CodeVariant
+	{
+		std::string assembly;
+		std::vector<CpuFeature> requirements;
+
+		CodeVariant() : assembly(""), requirements() { }
+		CodeVariant(std::string assembly, std::vector<CpuFeature> requirements) : assembly(assembly), requirements(requirements) { }
+	};
+
+	static unsigned int getSupportedFeatures();
+
+	HackableCode* hackableCode;
+	std::vector<CodeVariant> variants;
+	int selectedVariant;
+	bool isSelected;
+};
@@ -0,0 +1,1039 @@
+#include "HackableExpression.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "DebugLocals.h"
+
+using namespace asmjit;
+
+#if !defined(_WIN32) && (__x86_64__ || _WIN64)
+// SysV leaf functions may keep locals below rsp, so pushes made by the expression have to skip over them
+const int HackableExpression::RedZoneSize = 128;
+#else
+const int HackableExpression::RedZoneSize = 0;
+#endif
+const int HackableExpression::MaxAssignedRegisters = 2;
+const int HackableExpression::MaxPasses = 4;
+
+HackUtils::CompileResult HackableExpression::compile(const std::string& expression, void* codeAddress, const RegisterLiveness::RegisterSet& liveAtEnd)
+{
+	HackableExpression hackableExpression = HackableExpression(expression, codeAddress);
+	HackUtils::CompileResult compileResult;
+
+	compileResult.hasError = true;
+	compileResult.byteCount = 0;
+	compileResult.compiledBytes = std::vector<unsigned char>();
+
+	if (!hackableExpression.tokenize() || !hackableExpression.parse() || !hackableExpression.bindNames())
+	{
+		compileResult.errorData = hackableExpression.errorData;
+
+		return compileResult;
+	}
+
+	int flagsSize = liveAtEnd.flags ? (int)sizeof(void*) : 0;
+	int stackReserve = flagsSize > 0 ? HackableExpression::RedZoneSize + flagsSize : 0;
+	int stackShift = 0;
+	unsigned int savedRegisters = 0;
+
+	// The prologue the allocator ends up needing decides whether the red zone has to be skipped, which in turn moves rsp relative
+	// locals, and which live registers need saving is only known once the allocator has picked them. Compile until the layout
+	// settles (normally the first or second pass).
+	for (int pass = 0; pass < HackableExpression::MaxPasses; pass++)
+	{
+		CodeHolder code;
+		code.init(CodeInfo(sizeof(void*) == 4 ? ArchInfo::kIdX86 : ArchInfo::kIdX64));
+
+		int prologueShift = 0;
+		unsigned int unsavedRegisters = 0;
+
+		if (!hackableExpression.emit(code, liveAtEnd, stackReserve, stackShift, savedRegisters, &prologueShift, &unsavedRegisters))
+		{
+			compileResult.errorData = hackableExpression.errorData;
+
+			return compileResult;
+		}
+
+		int neededReserve = (prologueShift > 0 || flagsSize > 0 ? HackableExpression::RedZoneSize : 0) + flagsSize;
+
+		if (neededReserve == stackReserve && prologueShift == stackShift && unsavedRegisters == 0)
+		{
+			CodeBuffer& buffer = code.sectionById(0)->buffer();
+
+			compileResult.hasError = false;
+			compileResult.errorData.lineNumber = 0;
+			compileResult.errorData.message = "";
+			compileResult.compiledBytes = std::vector<unsigned char>(buffer.data(), buffer.data() + buffer.size());
+			compileResult.byteCount = (int)buffer.size();
+
+			return compileResult;
+		}
+
+		stackReserve = neededReserve;
+		stackShift = prologueShift;
+		savedRegisters |= unsavedRegisters;
+	}
+
+	compileResult.errorData.lineNumber = 0;
+	compileResult.errorData.message = "Unable to settle the stack layout of the expression";
+
+	return compileResult;
+}
+
+HackableExpression::HackableExpression(const std::string& expression, void* codeAddress)
+{
+	this->expression = expression;
+	this->codeAddress = codeAddress;
+	this->tokens = std::vector<Token>();
+	this->tokenIndex = 0;
+	this->nodes = std::vector<ExpressionNode>();
+	this->statements = std::vector<Statement>();
+	this->bindings = std::map<std::string, Binding>();
+	this->registerValues = std::map<int, x86::Gp>();
+	this->stackShift = 0;
+	this->errorData.lineNumber = 0;
+	this->errorData.message = "";
+}
+
+bool HackableExpression::tokenize()
+{
+	static const char* Operators[] = { "<<=", ">>=", "<<", ">>", "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", "=", "+", "-", "*", "/", "%", "&", "|", "^", "~", "(", ")" };
+	size_t position = 0;
+	int lineNumber = 1;
+
+	while (position < this->expression.size())
+	{
+		char next = this->expression[position];
+
+		if (next == '\n' || next == ';')
+		{
+			this->tokens.push_back(Token(TokenKind::Separator, std::string(1, next), 0, lineNumber));
+			lineNumber += next == '\n' ? 1 : 0;
+			position++;
+		}
+		else if (std::isspace((unsigned char)next))
+		{
+			position++;
+		}
+		else if (std::isdigit((unsigned char)next))
+		{
+			const char* start = this->expression.c_str() + position;
+			char* end = nullptr;
+			long long value = (long long)std::strtoull(start, &end, 0);
+
+			if (std::isalnum((unsigned char)*end) || *end == '_')
+			{
+				return this->fail(lineNumber, "Invalid number '" + std::string(start, end - start + 1) + "'");
+			}
+
+			this->tokens.push_back(Token(TokenKind::Number, std::string(start, end - start), value, lineNumber));
+			position += end - start;
+		}
+		else if (std::isalpha((unsigned char)next) || next == '_')
+		{
+			size_t nameEnd = position;
+
+			while (nameEnd < this->expression.size() && (std::isalnum((unsigned char)this->expression[nameEnd]) || this->expression[nameEnd] == '_'))
+			{
+				nameEnd++;
+			}
+
+			this->tokens.push_back(Token(TokenKind::Name, this->expression.substr(position, nameEnd - position), 0, lineNumber));
+			position = nameEnd;
+		}
+		else
+		{
+			bool isOperator = false;
+
+			for (const char* nextOperator : Operators)
+			{
+				if (this->expression.compare(position, strlen(nextOperator), nextOperator) == 0)
+				{
+					this->tokens.push_back(Token(TokenKind::Operator, nextOperator, 0, lineNumber));
+					position += strlen(nextOperator);
+					isOperator = true;
+					break;
+				}
+			}
+
+			if (!isOperator)
+			{
+				return this->fail(lineNumber, "Unexpected character '" + std::string(1, next) + "'");
+			}
+		}
+	}
+
+	this->tokens.push_back(Token(TokenKind::End, "", 0, lineNumber));
+
+	return true;
+}
+
+bool HackableExpression::parse()
+{
+	this->tokenIndex = 0;
+
+	while (this->tokens[this->tokenIndex].kind != TokenKind::End)
+	{
+		if (this->tokens[this->tokenIndex].kind == TokenKind::Separator)
+		{
+			this->tokenIndex++;
+			continue;
+		}
+
+		const Token& target = this->tokens[this->tokenIndex];
+		const Token& assignment = this->tokens[this->tokenIndex + 1];
+
+		if (target.kind != TokenKind::Name)
+		{
+			return this->fail(target.lineNumber, "Expected a name to assign to");
+		}
+
+		if (assignment.kind != TokenKind::Operator || assignment.text.back() != '=')
+		{
+			return this->fail(assignment.lineNumber, "Expected an assignment after '" + target.text + "'");
+		}
+
+		this->tokenIndex += 2;
+
+		int root = this->parseBinary(0);
+
+		if (root < 0)
+		{
+			return false;
+		}
+
+		const Token& next = this->tokens[this->tokenIndex];
+
+		if (next.kind != TokenKind::Separator && next.kind != TokenKind::End)
+		{
+			return this->fail(next.lineNumber, "Unexpected '" + next.text + "'");
+		}
+
+		this->statements.push_back(Statement(target.text, assignment.text, root, target.lineNumber));
+	}
+
+	if (this->statements.empty())
+	{
+		return this->fail(0, "Expression has no statements");
+	}
+
+	return true;
+}
+
+int HackableExpression::parseBinary(int precedence)
+{
+	// Lowest to highest, as in C
+	static const std::vector<std::vector<std::string>> Precedences =
+	{
+		{ "|" },
+		{ "^" },
+		{ "&" },
+		{ "<<", ">>" },
+		{ "+", "-" },
+		{ "*", "/", "%" },
+	};
+
+	if (precedence == (int)Precedences.size())
+	{
+		return this->parseUnary();
+	}
+
+	int left = this->parseBinary(precedence + 1);
+
+	while (left >= 0 && this->tokens[this->tokenIndex].kind == TokenKind::Operator)
+	{
+		const Token& operation = this->tokens[this->tokenIndex];
+		const std::vector<std::string>& operations = Precedences[precedence];
+
+		if (std::find(operations.begin(), operations.end(), operation.text) == operations.end())
+		{
+			break;
+		}
+
+		this->tokenIndex++;
+
+		int right = this->parseBinary(precedence + 1);
+
+		if (right < 0)
+		{
+			return -1;
+		}
+
+		this->nodes.push_back(ExpressionNode(NodeKind::Binary, operation.text, 0, left, right, operation.lineNumber));
+		left = (int)this->nodes.size() - 1;
+	}
+
+	return left;
+}
+
+int HackableExpression::parseUnary()
+{
+	const Token& token = this->tokens[this->tokenIndex];
+
+	if (token.kind == TokenKind::Operator && (token.text == "-" || token.text == "~" || token.text == "+"))
+	{
+		this->tokenIndex++;
+
+		int operand = this->parseUnary();
+
+		if (operand < 0 || token.text == "+")
+		{
+			return operand;
+		}
+
+		this->nodes.push_back(ExpressionNode(NodeKind::Unary, token.text, 0, operand, -1, token.lineNumber));
+	}
+	else if (token.kind == TokenKind::Number)
+	{
+		this->tokenIndex++;
+		this->nodes.push_back(ExpressionNode(NodeKind::Constant, token.text, token.value, -1, -1, token.lineNumber));
+	}
+	else if (token.kind == TokenKind::Name)
+	{
+		this->tokenIndex++;
+		this->nodes.push_back(ExpressionNode(NodeKind::Name, token.text, 0, -1, -1, token.lineNumber));
+	}
+	else if (token.kind == TokenKind::Operator && token.text == "(")
+	{
+		this->tokenIndex++;
+
+		int inner = this->parseBinary(0);
+
+		if (inner < 0)
+		{
+			return -1;
+		}
+
+		if (this->tokens[this->tokenIndex].text != ")")
+		{
+			this->fail(this->tokens[this->tokenIndex].lineNumber, "Expected ')'");
+			return -1;
+		}
+
+		this->tokenIndex++;
+
+		return inner;
+	}
+	else
+	{
+		this->fail(token.lineNumber, token.kind == TokenKind::End || token.kind == TokenKind::Separator ? "Expected a value" : "Expected a value but found '" + token.text + "'");
+		return -1;
+	}
+
+	return (int)this->nodes.size() - 1;
+}
+
+bool HackableExpression::bindNames()
+{
+	for (const Statement& statement : this->statements)
+	{
+		if (!this->bindName(statement.target))
+		{
+			this->errorData.lineNumber = statement.lineNumber;
+			return false;
+		}
+	}
+
+	for (const ExpressionNode& node : this->nodes)
+	{
+		if (node.kind == NodeKind::Name && !this->bindName(node.text))
+		{
+			this->errorData.lineNumber = node.lineNumber;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool HackableExpression::bindName(const std::string& name)
+{
+	if (this->bindings.find(name) != this->bindings.end())
+	{
+		return true;
+	}
+
+	Binding binding = Binding();
+	int registerId = -1;
+	int byteSize = 0;
+
+	if (HackableExpression::findRegister(name, &registerId, &byteSize))
+	{
+		if (byteSize != (int)sizeof(void*) || registerId == x86::Gp::kIdSp)
+		{
+			return this->fail(0, "Only full width general purpose registers other than the stack pointer can be used, not '" + name + "'");
+		}
+
+		binding.isRegister = true;
+		binding.registerId = registerId;
+		binding.byteSize = byteSize;
+	}
+	else
+	{
+		DebugLocals::LocalLocation location = DebugLocals::findLocal(name, this->codeAddress);
+
+		switch (location.kind)
+		{
+			case DebugLocals::LocalLocation::Kind::Register:
+			{
+				if (!HackableExpression::findRegister(location.operand, &registerId, &byteSize))
+				{
+					return this->fail(0, "Unsupported register '" + location.operand + "' for '" + name + "'");
+				}
+
+				binding.isRegister = true;
+				binding.registerId = registerId;
+				binding.byteSize = (int)sizeof(void*);
+				break;
+			}
+			case DebugLocals::LocalLocation::Kind::Memory:
+			{
+				size_t offsetStart = location.operand.find_first_of("+-");
+
+				if (!HackableExpression::findRegister(location.operand.substr(0, offsetStart), &registerId, &byteSize))
+				{
+					return this->fail(0, "Unsupported location '" + location.operand + "' for '" + name + "'");
+				}
+
+				if (location.byteSize != 1 && location.byteSize != 2 && location.byteSize != 4 && location.byteSize != (int)sizeof(void*))
+				{
+					return this->fail(0, "'" + name + "' is not an integer");
+				}
+
+				binding.baseRegisterId = registerId;
+				binding.offset = offsetStart == std::string::npos ? 0 : std::strtoll(location.operand.c_str() + offsetStart, nullptr, 10);
+				binding.byteSize = location.byteSize;
+				break;
+			}
+			case DebugLocals::LocalLocation::Kind::None:
+			default:
+			{
+				return this->fail(0, "Unknown name '" + name + "'");
+			}
+		}
+	}
+
+	this->bindings[name] = binding;
+
+	return true;
+}
+
+bool HackableExpression::emit(CodeHolder& code, const RegisterLiveness::RegisterSet& liveAtEnd, int stackReserve, int stackShift, unsigned int savedRegisters, int* outStackShift, unsigned int* outUnsavedRegisters)
+{
+	x86::Compiler cc(&code);
+	int flagsSize = liveAtEnd.flags ? (int)sizeof(void*) : 0;
+	unsigned int gpMask = sizeof(void*) == 8 ? 0xFFFF : 0xFF;
+	unsigned int inputMask = 0;
+	unsigned int outputMask = 0;
+	std::vector<int> inputs = std::vector<int>();
+	std::vector<int> outputs = std::vector<int>();
+
+	this->stackShift = stackReserve + stackShift;
+	this->registerValues.clear();
+
+	// Every bound register, and the base register of every bound local other than the stack pointer, comes in as an argument
+	for (auto& next : this->bindings)
+	{
+		int registerId = next.second.isRegister ? next.second.registerId : next.second.baseRegisterId;
+
+		if (registerId != x86::Gp::kIdSp && !(inputMask & (1u << registerId)))
+		{
+			inputMask |= 1u << registerId;
+			inputs.push_back(registerId);
+		}
+	}
+
+	for (const Statement& statement : this->statements)
+	{
+		const Binding& binding = this->bindings[statement.target];
+
+		if (binding.isRegister && !(outputMask & (1u << binding.registerId)))
+		{
+			outputMask |= 1u << binding.registerId;
+			outputs.push_back(binding.registerId);
+		}
+	}
+
+	if ((int)outputs.size() > HackableExpression::MaxAssignedRegisters)
+	{
+		return this->fail(0, "At most " + std::to_string(HackableExpression::MaxAssignedRegisters) + " registers can be assigned per expression");
+	}
+
+	// Skips the red zone and saves the flags outside of the function, so the allocator's prologue and epilogue sit inside both
+	if (stackReserve > 0)
+	{
+		if (stackReserve > flagsSize)
+		{
+			cc.lea(cc.zsp(), x86::ptr(cc.zsp(), -HackableExpression::RedZoneSize));
+		}
+
+		if (liveAtEnd.flags)
+		{
+			sizeof(void*) == 8 ? cc.pushfq() : cc.pushfd();
+		}
+	}
+
+	FuncSignatureBuilder signature = FuncSignatureBuilder(CallConv::kIdHost);
+	uint32_t typeId = sizeof(void*) == 8 ? Type::kIdI64 : Type::kIdI32;
+	uint32_t registerType = sizeof(void*) == 8 ? BaseReg::kTypeGp64 : BaseReg::kTypeGp32;
+
+	signature.setRetT<void>();
+
+	for (size_t index = 0; index < inputs.size(); index++)
+	{
+		signature.addArgT<intptr_t>();
+	}
+
+	FuncNode* func = cc.newFunc(signature);
+	FuncDetail& detail = func->detail();
+
+	// Arguments and return values are pinned to the registers they are bound to rather than the host calling convention's
+	detail._usedRegs[BaseReg::kGroupGp] = 0;
+	detail._argStackSize = 0;
+
+	for (size_t index = 0; index < inputs.size(); index++)
+	{
+		detail.arg((uint32_t)index).initReg(registerType, inputs[index], typeId);
+		detail.addUsedRegs(BaseReg::kGroupGp, 1u << inputs[index]);
+	}
+
+	detail._retCount = (uint8_t)outputs.size();
+
+	for (size_t index = 0; index < outputs.size(); index++)
+	{
+		detail.ret((uint32_t)index).initReg(registerType, outputs[index], typeId);
+	}
+
+	// The frame was set up from the host signature, which marks its argument registers dirty. Start clean and let the allocator
+	// mark what it touches. It counts every register an instruction reads as dirty too, so only the live registers an earlier
+	// pass saw the code actually write are preserved, and inputs that are only read aren't saved.
+	func->frame().setDirtyRegs(BaseReg::kGroupGp, 0);
+	func->frame()._preservedRegs[BaseReg::kGroupGp] = savedRegisters;
+
+	cc.addFunc(func);
+
+	for (size_t index = 0; index < inputs.size(); index++)
+	{
+		x86::Gp argument = cc.newIntPtr();
+
+		cc.setArg((uint32_t)index, argument);
+		this->registerValues[inputs[index]] = argument;
+	}
+
+	for (const Statement& statement : this->statements)
+	{
+		if (!this->emitStatement(cc, statement))
+		{
+			return false;
+		}
+	}
+
+	Operand results[2];
+
+	for (size_t index = 0; index < outputs.size(); index++)
+	{
+		results[index] = this->registerValues[outputs[index]];
+	}
+
+	cc.addRet(results[0], results[1]);
+	cc.endFunc();
+
+	if (stackReserve > 0)
+	{
+		if (liveAtEnd.flags)
+		{
+			sizeof(void*) == 8 ? cc.popfq() : cc.popfd();
+		}
+
+		if (stackReserve > flagsSize)
+		{
+			cc.lea(cc.zsp(), x86::ptr(cc.zsp(), HackableExpression::RedZoneSize));
+		}
+	}
+
+	Error error = cc.runPasses();
+
+	if (error != kErrorOk)
+	{
+		return this->fail(0, DebugUtils::errorAsString(error));
+	}
+
+	*outStackShift = (int)(func->frame().gpSaveSize() + func->frame().stackAdjustment());
+
+	// The code falls through to the rest of the region instead of returning. Copies into temporaries that were given the
+	// register they copy from are dropped too (a 32-bit mov to itself still zero extends, so only full width ones).
+	for (BaseNode* node = cc.firstNode(); node != nullptr;)
+	{
+		BaseNode* next = node->next();
+
+		if (node->type() == BaseNode::kNodeInst)
+		{
+			InstNode* instruction = node->as<InstNode>();
+
+			if (instruction->id() == x86::Inst::kIdRet)
+			{
+				cc.removeNode(node);
+			}
+			else if (instruction->id() == x86::Inst::kIdMov && instruction->opCount() == 2
+				&& instruction->operands()[0].isReg() && instruction->operands()[0] == instruction->operands()[1]
+				&& instruction->operands()[0].as<BaseReg>().size() == sizeof(void*))
+			{
+				cc.removeNode(node);
+			}
+		}
+
+		node = next;
+	}
+
+	x86::Assembler assembler(&code);
+	error = cc.serialize(&assembler);
+
+	if (error != kErrorOk)
+	{
+		return this->fail(0, DebugUtils::errorAsString(error));
+	}
+
+	// Everything live after the region has to survive, apart from the registers the expression assigns
+	CodeBuffer& buffer = code.sectionById(0)->buffer();
+	RegisterLiveness::RegisterSet written = RegisterLiveness::getWrittenRegisters(buffer.data(), (int)buffer.size());
+
+	*outUnsavedRegisters = written.registers & liveAtEnd.registers & ~outputMask & ~(1u << x86::Gp::kIdSp) & gpMask;
+
+	return true;
+}
+
+bool HackableExpression::emitStatement(x86::Compiler& cc, const Statement& statement)
+{
+	const Binding& binding = this->bindings[statement.target];
+	std::string operation = statement.operation.substr(0, statement.operation.size() - 1);
+	int root = statement.root;
+	const ExpressionNode& rootNode = this->nodes[root];
+
+	// 'x = x op y' and 'x = y op x' are compiled like 'x op= y', which works on the target in place
+	if (operation.empty() && rootNode.kind == NodeKind::Binary)
+	{
+		const ExpressionNode& left = this->nodes[rootNode.left];
+		const ExpressionNode& right = this->nodes[rootNode.right];
+
+		if (left.kind == NodeKind::Name && left.text == statement.target)
+		{
+			operation = rootNode.text;
+			root = rootNode.right;
+		}
+		else if (right.kind == NodeKind::Name && right.text == statement.target && HackableExpression::isCommutative(rootNode.text))
+		{
+			operation = rootNode.text;
+			root = rootNode.left;
+		}
+	}
+
+	Value value = Value();
+
+	if (!this->emitNode(cc, root, value))
+	{
+		return false;
+	}
+
+	if (binding.isRegister)
+	{
+		x86::Gp& current = this->registerValues[binding.registerId];
+
+		if (!operation.empty())
+		{
+			return this->emitOperation(cc, operation, current, (int)sizeof(void*), value);
+		}
+
+		switch (value.kind)
+		{
+			case Value::Kind::Temporary:
+			{
+				// Nothing else refers to a temporary, so the name can just take it over
+				current = value.reg;
+				break;
+			}
+			case Value::Kind::Register:
+			{
+				cc.mov(current, value.reg);
+				break;
+			}
+			case Value::Kind::Memory:
+			{
+				cc.mov(current, value.mem);
+				break;
+			}
+			case Value::Kind::Constant:
+			default:
+			{
+				cc.mov(current, imm(value.constant));
+				break;
+			}
+		}
+
+		return true;
+	}
+
+	x86::Mem memory = this->getMemory(binding);
+
+	if (!operation.empty())
+	{
+		return this->emitOperation(cc, operation, memory, binding.byteSize, value);
+	}
+
+	if (value.kind == Value::Kind::Constant && (binding.byteSize < 8 || Support::isInt32(value.constant)))
+	{
+		cc.mov(memory, imm(value.constant));
+	}
+	else
+	{
+		cc.mov(memory, HackableExpression::sizeRegister(this->toRegister(cc, value), binding.byteSize));
+	}
+
+	return true;
+}
+
+bool HackableExpression::emitNode(x86::Compiler& cc, int nodeIndex, Value& outValue)
+{
+	const ExpressionNode& node = this->nodes[nodeIndex];
+
+	switch (node.kind)
+	{
+		case NodeKind::Constant:
+		{
+			outValue.kind = Value::Kind::Constant;
+			outValue.constant = node.value;
+			return true;
+		}
+		case NodeKind::Name:
+		{
+			const Binding& binding = this->bindings[node.text];
+
+			if (binding.isRegister)
+			{
+				outValue.kind = Value::Kind::Register;
+				outValue.reg = this->registerValues[binding.registerId];
+			}
+			else if (binding.byteSize == (int)sizeof(void*))
+			{
+				// Full width locals can be used as memory operands directly
+				outValue.kind = Value::Kind::Memory;
+				outValue.mem = this->getMemory(binding);
+			}
+			else
+			{
+				outValue.kind = Value::Kind::Temporary;
+				outValue.reg = cc.newIntPtr();
+				this->emitLoad(cc, outValue.reg, this->getMemory(binding), binding.byteSize);
+			}
+
+			return true;
+		}
+		case NodeKind::Unary:
+		{
+			Value operand = Value();
+
+			if (!this->emitNode(cc, node.left, operand))
+			{
+				return false;
+			}
+
+			if (operand.kind == Value::Kind::Constant)
+			{
+				outValue.kind = Value::Kind::Constant;
+				outValue.constant = node.text == "-" ? (long long)(0ULL - (unsigned long long)operand.constant) : ~operand.constant;
+				return true;
+			}
+
+			outValue.kind = Value::Kind::Temporary;
+			outValue.reg = this->toTemporary(cc, operand);
+			node.text == "-" ? cc.neg(outValue.reg) : cc.not_(outValue.reg);
+
+			return true;
+		}
+		case NodeKind::Binary:
+		default:
+		{
+			Value left = Value();
+			Value right = Value();
+
+			if (!this->emitNode(cc, node.left, left) || !this->emitNode(cc, node.right, right))
+			{
+				return false;
+			}
+
+			if (left.kind == Value::Kind::Constant && right.kind == Value::Kind::Constant)
+			{
+				outValue.kind = Value::Kind::Constant;
+
+				return HackableExpression::foldConstant(node.text, left.constant, right.constant, &outValue.constant) || this->fail(node.lineNumber, "Division by zero");
+			}
+
+			// Work on whichever side is already a temporary, to save a copy
+			if (HackableExpression::isCommutative(node.text) && left.kind != Value::Kind::Temporary && (right.kind == Value::Kind::Temporary || left.kind == Value::Kind::Constant))
+			{
+				std::swap(left, right);
+			}
+
+			outValue.kind = Value::Kind::Temporary;
+			outValue.reg = this->toTemporary(cc, left);
+
+			return this->emitOperation(cc, node.text, outValue.reg, (int)sizeof(void*), right);
+		}
+	}
+}
+
+bool HackableExpression::emitOperation(x86::Compiler& cc, const std::string& operation, const Operand& destination, int byteSize, const Value& source)
+{
+	bool isMemory = destination.isMem();
+	bool isImmediate = source.kind == Value::Kind::Constant && Support::isInt32(source.constant);
+
+	if (operation == "+" || operation == "-" || operation == "&" || operation == "|" || operation == "^")
+	{
+		uint32_t instruction = operation == "+" ? x86::Inst::kIdAdd : (operation == "-" ? x86::Inst::kIdSub
+			: (operation == "&" ? x86::Inst::kIdAnd : (operation == "|" ? x86::Inst::kIdOr : x86::Inst::kIdXor)));
+
+		if (isImmediate)
+		{
+			cc.emit(instruction, destination, imm(source.constant));
+		}
+		else if (source.kind == Value::Kind::Memory && !isMemory)
+		{
+			cc.emit(instruction, destination, source.mem);
+		}
+		else
+		{
+			cc.emit(instruction, destination, HackableExpression::sizeRegister(this->toRegister(cc, source), byteSize));
+		}
+
+		return true;
+	}
+
+	if (operation == "<<" || operation == ">>")
+	{
+		uint32_t instruction = operation == "<<" ? x86::Inst::kIdShl : x86::Inst::kIdSar;
+
+		if (source.kind == Value::Kind::Constant)
+		{
+			cc.emit(instruction, destination, imm(source.constant & (byteSize * 8 - 1)));
+		}
+		else
+		{
+			// The allocator moves the count into cl
+			cc.emit(instruction, destination, this->toRegister(cc, source).r8());
+		}
+
+		return true;
+	}
+
+	if (isMemory)
+	{
+		// No memory destination forms for the rest, so go through a register
+		x86::Gp temporary = cc.newIntPtr();
+
+		this->emitLoad(cc, temporary, destination.as<x86::Mem>(), byteSize);
+
+		if (!this->emitOperation(cc, operation, temporary, (int)sizeof(void*), source))
+		{
+			return false;
+		}
+
+		cc.mov(destination.as<x86::Mem>(), HackableExpression::sizeRegister(temporary, byteSize));
+
+		return true;
+	}
+
+	const x86::Gp& reg = destination.as<x86::Gp>();
+
+	if (operation == "*")
+	{
+		if (source.kind == Value::Kind::Constant && source.constant > 0 && (source.constant & (source.constant - 1)) == 0)
+		{
+			cc.shl(reg, imm(Support::ctz((uint64_t)source.constant)));
+		}
+		else if (isImmediate)
+		{
+			cc.imul(reg, reg, imm(source.constant));
+		}
+		else if (source.kind == Value::Kind::Memory)
+		{
+			cc.imul(reg, source.mem);
+		}
+		else
+		{
+			cc.imul(reg, this->toRegister(cc, source));
+		}
+
+		return true;
+	}
+
+	if (source.kind == Value::Kind::Constant && source.constant == 0)
+	{
+		return this->fail(0, "Division by zero");
+	}
+
+	// idiv takes its dividend in rdx:rax, the allocator assigns both
+	x86::Gp high = cc.newIntPtr();
+	x86::Gp low = cc.newIntPtr();
+
+	cc.mov(low, reg);
+	sizeof(void*) == 8 ? cc.cqo(high, low) : cc.cdq(high, low);
+
+	if (source.kind == Value::Kind::Memory)
+	{
+		cc.idiv(high, low, source.mem);
+	}
+	else
+	{
+		cc.idiv(high, low, this->toRegister(cc, source));
+	}
+
+	cc.mov(reg, operation == "/" ? low : high);
+
+	return true;
+}
+
+x86::Gp HackableExpression::toTemporary(x86::Compiler& cc, const Value& value)
+{
+	if (value.kind == Value::Kind::Temporary)
+	{
+		return value.reg;
+	}
+
+	x86::Gp temporary = cc.newIntPtr();
+
+	switch (value.kind)
+	{
+		case Value::Kind::Register:
+		{
+			cc.mov(temporary, value.reg);
+			break;
+		}
+		case Value::Kind::Memory:
+		{
+			cc.mov(temporary, value.mem);
+			break;
+		}
+		case Value::Kind::Constant:
+		default:
+		{
+			cc.mov(temporary, imm(value.constant));
+			break;
+		}
+	}
+
+	return temporary;
+}
+
+x86::Gp HackableExpression::toRegister(x86::Compiler& cc, const Value& value)
+{
+	return value.kind == Value::Kind::Register || value.kind == Value::Kind::Temporary ? value.reg : this->toTemporary(cc, value);
+}
+
+x86::Mem HackableExpression::getMemory(const Binding& binding)
+{
+	// The stack pointer is never allocated, but the prologue and red zone skip move it away from where the local was found
+	if (binding.baseRegisterId == x86::Gp::kIdSp)
+	{
+		return x86::ptr(sizeof(void*) == 8 ? x86::rsp : x86::esp, (int32_t)(binding.offset + this->stackShift), binding.byteSize);
+	}
+
+	return x86::ptr(this->registerValues[binding.baseRegisterId], (int32_t)binding.offset, binding.byteSize);
+}
+
+void HackableExpression::emitLoad(x86::Compiler& cc, const x86::Gp& destination, const x86::Mem& source, int byteSize)
+{
+	if (byteSize == (int)sizeof(void*))
+	{
+		cc.mov(destination, source);
+	}
+	else if (byteSize == 4)
+	{
+		cc.movsxd(destination, source);
+	}
+	else
+	{
+		cc.movsx(destination, source);
+	}
+}
+
+bool HackableExpression::fail(int lineNumber, const std::string& message)
+{
+	this->errorData.lineNumber = lineNumber;
+	this->errorData.message = message;
+
+	return false;
+}
+
+bool HackableExpression::findRegister(const std::string& name, int* outRegisterId, int* outByteSize)
+{
+	static const char* Registers[4][16] =
+	{
+		{ "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil", "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b" },
+		{ "ax", "cx", "dx", "bx", "sp", "bp", "si", "di", "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w" },
+		{ "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" },
+		{ "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" },
+	};
+	int registerCount = sizeof(void*) == 8 ? 16 : 8;
+	int sizeCount = sizeof(void*) == 8 ? 4 : 3;
+
+	for (int sizeIndex = 0; sizeIndex < sizeCount; sizeIndex++)
+	{
+		for (int registerId = 0; registerId < registerCount; registerId++)
+		{
+			if (name == Registers[sizeIndex][registerId])
+			{
+				*outRegisterId = registerId;
+				*outByteSize = 1 << sizeIndex;
+
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+bool HackableExpression::foldConstant(const std::string& operation, long long left, long long right, long long* outValue)
+{
+	// Wraps like the generated code would rather than relying on signed overflow
+	unsigned long long unsignedLeft = (unsigned long long)left;
+	unsigned long long unsignedRight = (unsigned long long)right;
+	int shiftMask = (int)sizeof(void*) * 8 - 1;
+
+	if ((operation == "/" || operation == "%") && right == 0)
+	{
+		return false;
+	}
+
+	if (operation == "+") *outValue = (long long)(unsignedLeft + unsignedRight);
+	else if (operation == "-") *outValue = (long long)(unsignedLeft - unsignedRight);
+	else if (operation == "*") *outValue = (long long)(unsignedLeft * unsignedRight);
+	else if (operation == "/") *outValue = right == -1 ? (long long)(0ULL - unsignedLeft) : left / right;
+	else if (operation == "%") *outValue = right == -1 ? 0 : left % right;
+	else if (operation == "&") *outValue = left & right;
+	else if (operation == "|") *outValue = left | right;
+	else if (operation == "^") *outValue = left ^ right;
+	else if (operation == "<<") *outValue = (long long)(unsignedLeft << (right & shiftMask));
+	else *outValue = left >> (right & shiftMask);
+
+	return true;
+}
+
+bool HackableExpression::isCommutative(const std::string& operation)
+{
+	return operation == "+" || operation == "*" || operation == "&" || operation == "|" || operation == "^";
+}
+
+x86::Gp HackableExpression::sizeRegister(const x86::Gp& reg, int byteSize)
+{
+	switch (byteSize)
+	{
+		case 1: return reg.r8();
+		case 2: return reg.r16();
+		case 4: return reg.r32();
+		default: return reg;
+	}
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+
+#include "HackUtils.h"
+#include "RegisterLiveness.h"
+#include "External/asmjit/asmjit.h"
+
+// Compiles simple balance tweaks such as 'health = health - damage * 2' with asmjit's x86::Compiler, so temporaries live in
+// virtual registers and its register allocator picks where they go. Names bind to registers by name (ie 'rbx') or to the
+// function's locals through DebugLocals. Statements are separated by newlines or ';' and work on signed pointer sized integers.
+// Bound registers enter the function pinned as arguments and assigned ones leave pinned as return values, so at most two
+// registers can be assigned per expression. Registers live after the region are saved and restored if the allocator needs them.
+class HackableExpression
+{
+public:
+	// The code has no branches and can run from any address, the address is only used to look up locals
+	static HackUtils::CompileResult compile(const std::string& expression, void* codeAddress, const RegisterLiveness::RegisterSet& liveAtEnd);
+
+private:
+	enum class TokenKind
+	{
+		Number,
+		Name,
+		Operator,
+		Separator,
+		End,
+	};
+
+	struct Token
+	{
+		TokenKind kind;
+		std::string text;
+		long long value;
+		int lineNumber;
+
+		Token() : kind(TokenKind::End), text(""), value(0), lineNumber(0) { }
+		Token(TokenKind kind, std::string text, long long value, int lineNumber) : kind(kind), text(text), value(value), lineNumber(lineNumber) { }
+	};
+
+	enum class NodeKind
+	{
+		Constant,
+		Name,
+		Unary,
+		Binary,
+	};
+
+	struct ExpressionNode
+	{
+		NodeKind kind;
+		std::string text;
+		long long value;
+		int left;
+		int right;
+		int lineNumber;
+
+		ExpressionNode() : kind(NodeKind::Constant), text(""), value(0), left(-1), right(-1), lineNumber(0) { }
+		ExpressionNode(NodeKind kind, std::string text, long long value, int left, int right, int lineNumber)
+			: kind(kind), text(text), value(value), left(left), right(right), lineNumber(lineNumber) { }
+	};
+
+	struct Statement
+	{
+		std::string target;
+		std::string operation;
+		int root;
+		int lineNumber;
+
+		Statement() : target(""), operation(""), root(-1), lineNumber(0) { }
+		Statement(std::string target, std::string operation, int root, int lineNumber) : target(target), operation(operation), root(root), lineNumber(lineNumber) { }
+	};
+
+	struct Binding
+	{
+		bool isRegister;
+		int registerId;
+		int baseRegisterId;
+		long long offset;
+		int byteSize;
+
+		Binding() : isRegister(false), registerId(-1), baseRegisterId(-1), offset(0), byteSize(0) { }
+	};
+
+	struct Value
+	{
+		enum class Kind
+		{
+			Constant,
+			Register,
+			Temporary,
+			Memory,
+		};
+
+		Kind kind;
+		long long constant;
+		asmjit::x86::Gp reg;
+		asmjit::x86::Mem mem;
+
+		Value() : kind(Kind::Constant), constant(0), reg(), mem() { }
+	};
+
+	HackableExpression(const std::string& expression, void* codeAddress);
+
+	bool tokenize();
+	bool parse();
+	int parseBinary(int precedence);
+	int parseUnary();
+	bool bindNames();
+	bool bindName(const std::string& name);
+	bool emit(asmjit::CodeHolder& code, const RegisterLiveness::RegisterSet& liveAtEnd, int stackReserve, int stackShift, unsigned int savedRegisters, int* outStackShift, unsigned int* outUnsavedRegisters);
+	bool emitStatement(asmjit::x86::Compiler& cc, const Statement& statement);
+	bool emitNode(asmjit::x86::Compiler& cc, int nodeIndex, Value& outValue);
+	bool emitOperation(asmjit::x86::Compiler& cc, const std::string& operation, const asmjit::Operand& destination, int byteSize, const Value& source);
+	asmjit::x86::Gp toTemporary(asmjit::x86::Compiler& cc, const Value& value);
+	asmjit::x86::Gp toRegister(asmjit::x86::Compiler& cc, const Value& value);
+	asmjit::x86::Mem getMemory(const Binding& binding);
+	void emitLoad(asmjit::x86::Compiler& cc, const asmjit::x86::Gp& destination, const asmjit::x86::Mem& source, int byteSize);
+	bool fail(int lineNumber, const std::string& message);
+
+	static bool findRegister(const std::string& name, int* outRegisterId, int* outByteSize);
+	static bool foldConstant(const std::string& operation, long long left, long long right, long long* outValue);
+	static bool isCommutative(const std::string& operation);
+	static asmjit::x86::Gp sizeRegister(const asmjit::x86::Gp& reg, int byteSize);
+
+	std::string expression;
+	void* codeAddress;
+	std::vector<Token> tokens;
+	size_t tokenIndex;
+	std::vector<ExpressionNode> nodes;
+	std::vector<Statement> statements;
+	std::map<std::string, Binding> bindings;
+	std::map<int, asmjit::x86::Gp> registerValues;
+	int stackShift;
+	HackUtils::CompileResult::ErrorData errorData;
+
+	static const int RedZoneSize;
+	static const int MaxAssignedRegisters;
+	static const int MaxPasses;
+};
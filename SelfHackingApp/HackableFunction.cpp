@@ -0,0 +1,263 @@
+#include "HackableFunction.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#include "CodeCaveAllocator.h"
+#include "HackUtils.h"
+#include "SymbolTable.h"
+
+std::map<void*, HackableFunction*> HackableFunction::FunctionCache = std::map<void*, HackableFunction*>();
+const int HackableFunction::EntryJumpSize = 5;
+const size_t HackableFunction::StubSize = 16;
+
+HackableFunction* HackableFunction::create(void* functionStart)
+{
+	// Looked up before following any jmp, since a redirected function starts with the jmp to its own stub
+	auto cachedFunction = HackableFunction::FunctionCache.find(functionStart);
+
+	if (cachedFunction != HackableFunction::FunctionCache.end())
+	{
+		return cachedFunction->second;
+	}
+
+	void* resolvedFunctionStart = HackUtils::resolveVTableAddress(functionStart);
+
+	cachedFunction = HackableFunction::FunctionCache.find(resolvedFunctionStart);
+
+	// One object per function, otherwise two of them would fight over the entry bytes
+	if (cachedFunction != HackableFunction::FunctionCache.end())
+	{
+		HackableFunction::FunctionCache[functionStart] = cachedFunction->second;
+
+		return cachedFunction->second;
+	}
+
+	void* functionEnd = nullptr;
+	void* symbolStart = nullptr;
+
+	if (SymbolTable::findFunctionRange(resolvedFunctionStart, &symbolStart, &functionEnd)
+		&& (unsigned char*)functionEnd - (unsigned char*)resolvedFunctionStart < HackableFunction::EntryJumpSize)
+	{
+		std::cout << "Function is too small to redirect with a jump" << std::endl;
+		return nullptr;
+	}
+
+	// The entry jump has to be written with one atomic store, which can't span two 8 byte words
+	if (((uintptr_t)resolvedFunctionStart & 7) + HackableFunction::EntryJumpSize > 8)
+	{
+		std::cout << "Function entry straddles an 8 byte boundary, so it can't be redirected atomically" << std::endl;
+		return nullptr;
+	}
+
+	HackableFunction* hackableFunction = new HackableFunction(resolvedFunctionStart);
+
+	HackableFunction::FunctionCache[functionStart] = hackableFunction;
+	HackableFunction::FunctionCache[resolvedFunctionStart] = hackableFunction;
+
+	return hackableFunction;
+}
+
+HackableFunction::HackableFunction(void* functionStart)
+{
+	this->functionPointer = functionStart;
+	this->originalEntryBytes = std::vector<unsigned char>((unsigned char*)functionStart, (unsigned char*)functionStart + HackableFunction::EntryJumpSize);
+	this->versions = std::vector<void*>();
+	this->activeVersion = -1;
+	this->stub = nullptr;
+	this->stubSlot = nullptr;
+}
+
+HackableFunction::~HackableFunction()
+{
+	// Versions and the stub are never released, a thread may still be running through them
+}
+
+int HackableFunction::addVersion(const std::string& assembly)
+{
+	asmjit::JitAllocator* allocator = HackableFunction::getRuntime().allocator();
+	HackUtils::CompileResult compileResult = HackUtils::assemble(assembly, nullptr);
+	void* version = nullptr;
+	void* versionWritable = nullptr;
+	size_t allocatedSize = 0;
+
+	// Branches to absolute addresses encode differently once the final address is known, so reallocate until the code fits
+	while (!compileResult.hasError && (size_t)compileResult.byteCount > allocatedSize)
+	{
+		if (version != nullptr)
+		{
+			allocator->release(version);
+		}
+
+		allocatedSize = compileResult.byteCount + 16;
+
+		if (allocator->alloc(&version, &versionWritable, allocatedSize) != asmjit::kErrorOk)
+		{
+			std::cout << "Unable to allocate memory for the function version" << std::endl;
+			return -1;
+		}
+
+		compileResult = HackUtils::assemble(assembly, version);
+	}
+
+	if (compileResult.hasError)
+	{
+		std::cout << compileResult.errorData.message << std::endl;
+
+		if (version != nullptr)
+		{
+			allocator->release(version);
+		}
+
+		return -1;
+	}
+
+	memcpy(versionWritable, compileResult.compiledBytes.data(), compileResult.compiledBytes.size());
+	this->versions.push_back(version);
+
+	return (int)this->versions.size() - 1;
+}
+
+int HackableFunction::addVersion(const EmitFunction& emitFunction)
+{
+	asmjit::CodeHolder code;
+	code.init(HackableFunction::getRuntime().codeInfo());
+
+	asmjit::x86::Assembler assembler(&code);
+	void* version = nullptr;
+
+	if (!emitFunction(assembler))
+	{
+		std::cout << "Unable to emit the function version" << std::endl;
+		return -1;
+	}
+
+	if (HackableFunction::getRuntime().add(&version, &code) != asmjit::kErrorOk)
+	{
+		std::cout << "Unable to add the function version to the runtime" << std::endl;
+		return -1;
+	}
+
+	this->versions.push_back(version);
+
+	return (int)this->versions.size() - 1;
+}
+
+bool HackableFunction::applyVersion(int versionIndex)
+{
+	if (versionIndex < 0 || versionIndex >= (int)this->versions.size())
+	{
+		return false;
+	}
+
+	if (this->stub == nullptr && !this->createStub())
+	{
+		return false;
+	}
+
+	// The slot is set before the entry jump exists, so the stub never jumps to a stale version. Caves are already writable, so
+	// this is the only write a swap between versions needs.
+	this->stubSlot->store(this->versions[versionIndex]);
+
+	if (this->activeVersion == -1)
+	{
+		int displacement = (int)(this->stub - ((unsigned char*)this->functionPointer + HackableFunction::EntryJumpSize));
+		unsigned char entryJump[] = { 0xE9, 0x00, 0x00, 0x00, 0x00 };
+
+		memcpy(entryJump + 1, &displacement, sizeof(displacement));
+
+		if (!this->writeEntry(entryJump))
+		{
+			return false;
+		}
+	}
+
+	this->activeVersion = versionIndex;
+
+	return true;
+}
+
+void HackableFunction::restoreState()
+{
+	if (this->activeVersion == -1)
+	{
+		return;
+	}
+
+	if (this->writeEntry(this->originalEntryBytes.data()))
+	{
+		this->activeVersion = -1;
+	}
+}
+
+void* HackableFunction::getPointer()
+{
+	return this->functionPointer;
+}
+
+void* HackableFunction::getVersionPointer(int versionIndex)
+{
+	return versionIndex >= 0 && versionIndex < (int)this->versions.size() ? this->versions[versionIndex] : nullptr;
+}
+
+int HackableFunction::getVersionCount()
+{
+	return (int)this->versions.size();
+}
+
+int HackableFunction::getActiveVersion()
+{
+	return this->activeVersion;
+}
+
+bool HackableFunction::createStub()
+{
+	void* cave = nullptr;
+
+	// JitRuntime places versions anywhere, the stub is what keeps the entry jump within rel32 range
+	if (CodeCaveAllocator::allocate(this->functionPointer, HackableFunction::StubSize, &cave) != CodeCaveAllocator::Result::Ok)
+	{
+		std::cout << "No code cave within jmp rel32 range of the function" << std::endl;
+		return false;
+	}
+
+	// jmp [slot], padded with int3 so the slot is 8 byte aligned (caves are at least 32 byte aligned)
+	unsigned char stubBytes[] = { 0xFF, 0x25, 0x02, 0x00, 0x00, 0x00, 0xCC, 0xCC, 0, 0, 0, 0, 0, 0, 0, 0 };
+	unsigned char* slot = (unsigned char*)cave + 8;
+
+	if (sizeof(void*) == 4)
+	{
+		// 32-bit has no rip-relative addressing, the slot address is absolute
+		unsigned int slotAddress = (unsigned int)(uintptr_t)slot;
+
+		memcpy(stubBytes + 2, &slotAddress, sizeof(slotAddress));
+	}
+
+	memcpy(cave, stubBytes, sizeof(stubBytes));
+
+	this->stub = (unsigned char*)cave;
+	this->stubSlot = new (slot) std::atomic<void*>(nullptr);
+
+	return true;
+}
+
+bool HackableFunction::writeEntry(const unsigned char* bytes)
+{
+	// create() only accepts entries within one 8 byte word, so a caller never sees half of the jump
+	if (!HackUtils::writeMemoryAtomic(this->functionPointer, bytes, HackableFunction::EntryJumpSize))
+	{
+		std::cout << "Unable to write the function entry atomically" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+asmjit::JitRuntime& HackableFunction::getRuntime()
+{
+	static asmjit::JitRuntime runtime;
+
+	return runtime;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "External/asmjit/asmjit.h"
+
+// Replaces a whole function rather than a marked region. Each version is compiled once into JitRuntime memory, and the function
+// entry is redirected with a jmp rel32 to a small stub near it that jumps through a pointer slot. Swapping between versions only
+// rewrites that slot with one aligned atomic store, so it is safe while other threads are calling the function.
+class HackableFunction
+{
+public:
+	typedef std::function<bool(asmjit::x86::Assembler& assembler)> EmitFunction;
+
+	// Returns the same object for a function however often it is called, and nullptr if the entry is too small for the jump or
+	// straddles an 8 byte boundary, where the jump couldn't be written with one atomic store
+	static HackableFunction* create(void* functionStart);
+
+	// Both return the new version index, or -1 if it failed to compile
+	int addVersion(const std::string& assembly);
+	int addVersion(const EmitFunction& emitFunction);
+
+	bool applyVersion(int versionIndex);
+	void restoreState();
+	void* getPointer();
+	void* getVersionPointer(int versionIndex);
+	int getVersionCount();
+
+	// -1 while the original code is running
+	int getActiveVersion();
+
+protected:
+	HackableFunction(void* functionStart);
+	virtual ~HackableFunction();
+
+private:
+	bool createStub();
+	bool writeEntry(const unsigned char* bytes);
+
+	void* functionPointer;
+	std::vector<unsigned char> originalEntryBytes;
+	std::vector<void*> versions;
+	int activeVersion;
+
+	// jmp [slot] near the function, allocated on the first swap and kept for the life of the process
+	unsigned char* stub;
+	std::atomic<void*>* stubSlot;
+
+	static asmjit::JitRuntime& getRuntime();
+
+	static std::map<void*, HackableFunction*> FunctionCache;
+	static const int EntryJumpSize;
+	static const size_t StubSize;
+};
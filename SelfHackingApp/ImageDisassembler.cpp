@@ -0,0 +1,226 @@
+#include "ImageDisassembler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#ifdef __linux__
+#include <link.h>
+#endif
+
+#include "HackUtils.h"
+#include "SymbolTable.h"
+#include "External/libudis86/udis86.h"
+
+ImageDisassembler::ImageDisassembly ImageDisassembler::disassembleImage(void* addressInImage, int threadCount)
+{
+	struct SegmentSearch
+	{
+		unsigned long long address;
+		unsigned long long start;
+		unsigned long long end;
+	};
+
+	SegmentSearch search = SegmentSearch{ (unsigned long long)addressInImage, 0, 0 };
+
+#ifdef __linux__
+	// Covers every executable segment of the module, not just the one containing the address
+	dl_iterate_phdr([](struct dl_phdr_info* info, size_t, void* data) -> int
+	{
+		SegmentSearch* search = (SegmentSearch*)data;
+		unsigned long long start = ~0ULL;
+		unsigned long long end = 0;
+		bool containsAddress = false;
+
+		for (int index = 0; index < info->dlpi_phnum; index++)
+		{
+			const ElfW(Phdr)& header = info->dlpi_phdr[index];
+			unsigned long long segmentStart = info->dlpi_addr + header.p_vaddr;
+			unsigned long long segmentEnd = segmentStart + header.p_memsz;
+
+			containsAddress |= header.p_type == PT_LOAD && search->address >= segmentStart && search->address < segmentEnd;
+
+			if (header.p_type == PT_LOAD && (header.p_flags & PF_X))
+			{
+				start = std::min(start, segmentStart);
+				end = std::max(end, segmentEnd);
+			}
+		}
+
+		if (containsAddress && end > start)
+		{
+			search->start = start;
+			search->end = end;
+			return 1;
+		}
+
+		return 0;
+	}, &search);
+#endif
+
+	if (search.end == 0)
+	{
+		return ImageDisassembly();
+	}
+
+	return ImageDisassembler::disassembleRange((void*)(uintptr_t)search.start, (void*)(uintptr_t)search.end, threadCount);
+}
+
+ImageDisassembler::ImageDisassembly ImageDisassembler::disassembleRange(void* rangeStart, void* rangeEnd, int threadCount)
+{
+	ImageDisassembly imageDisassembly = ImageDisassembly();
+	std::vector<std::pair<void*, void*>> functionRanges;
+
+	SymbolTable::getFunctionRanges(rangeStart, rangeEnd, functionRanges);
+
+	if (functionRanges.empty())
+	{
+		return imageDisassembly;
+	}
+
+	// Results are written straight into their own slot, so merging into address order needs no sort or lock
+	imageDisassembly.functions = std::vector<FunctionDisassembly>(functionRanges.size());
+
+	size_t workerCount = std::min((size_t)(threadCount > 0 ? threadCount : std::max(std::thread::hardware_concurrency(), 1u)), functionRanges.size());
+	std::vector<TaskRange> taskRanges = std::vector<TaskRange>(workerCount);
+
+	imageDisassembly.threadStats = std::vector<ThreadStats>(workerCount);
+
+	for (size_t index = 0; index < workerCount; index++)
+	{
+		taskRanges[index].begin = functionRanges.size() * index / workerCount;
+		taskRanges[index].end = functionRanges.size() * (index + 1) / workerCount;
+	}
+
+	auto worker = [&](size_t workerIndex)
+	{
+		ThreadStats& threadStats = imageDisassembly.threadStats[workerIndex];
+		auto startTime = std::chrono::steady_clock::now();
+		ud_t ud_obj;
+
+		ud_init(&ud_obj);
+		ud_set_mode(&ud_obj, sizeof(void*) * 8);
+		ud_set_syntax(&ud_obj, UD_SYN_INTEL);
+
+		while (true)
+		{
+			size_t task = 0;
+
+			if (!ImageDisassembler::takeTask(taskRanges[workerIndex], &task))
+			{
+				if (!ImageDisassembler::stealTasks(taskRanges, workerIndex))
+				{
+					break;
+				}
+
+				threadStats.stealCount++;
+				continue;
+			}
+
+			FunctionDisassembly& function = imageDisassembly.functions[task];
+
+			function.address = functionRanges[task].first;
+			function.length = (size_t)((unsigned char*)functionRanges[task].second - (unsigned char*)functionRanges[task].first);
+
+			ud_set_pc(&ud_obj, (uint64_t)function.address);
+			ud_set_input_buffer(&ud_obj, (unsigned char*)function.address, function.length);
+
+			// Same text as HackUtils::disassemble, immediates in decimal
+			while (ud_disassemble(&ud_obj))
+			{
+				HackUtils::appendDecimalLiterals(ud_insn_asm(&ud_obj), function.text);
+				function.text += "\n";
+				threadStats.instructionCount++;
+			}
+
+			threadStats.functionCount++;
+		}
+
+		threadStats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+		threadStats.instructionsPerSecond = threadStats.seconds > 0.0 ? threadStats.instructionCount / threadStats.seconds : 0.0;
+	};
+
+	std::vector<std::thread> workers = std::vector<std::thread>();
+
+	// The calling thread takes the first range itself
+	for (size_t index = 1; index < workerCount; index++)
+	{
+		workers.push_back(std::thread(worker, index));
+	}
+
+	worker(0);
+
+	for (auto& next : workers)
+	{
+		next.join();
+	}
+
+	return imageDisassembly;
+}
+
+bool ImageDisassembler::takeTask(TaskRange& taskRange, size_t* outTask)
+{
+	std::lock_guard<std::mutex> lock(taskRange.mutex);
+
+	// Owners work from the front of their range, thieves take from the back
+	if (taskRange.begin >= taskRange.end)
+	{
+		return false;
+	}
+
+	*outTask = taskRange.begin++;
+
+	return true;
+}
+
+bool ImageDisassembler::stealTasks(std::vector<TaskRange>& taskRanges, size_t thiefIndex)
+{
+	// Stealing from whoever has the most left keeps the number of steals logarithmic in the range sizes
+	while (true)
+	{
+		size_t victimIndex = taskRanges.size();
+		size_t mostRemaining = 0;
+
+		for (size_t index = 0; index < taskRanges.size(); index++)
+		{
+			std::lock_guard<std::mutex> lock(taskRanges[index].mutex);
+			size_t remaining = taskRanges[index].end - taskRanges[index].begin;
+
+			if (index != thiefIndex && remaining > mostRemaining)
+			{
+				victimIndex = index;
+				mostRemaining = remaining;
+			}
+		}
+
+		if (victimIndex == taskRanges.size())
+		{
+			return false;
+		}
+
+		size_t stolenBegin = 0;
+		size_t stolenEnd = 0;
+
+		{
+			std::lock_guard<std::mutex> lock(taskRanges[victimIndex].mutex);
+			TaskRange& victim = taskRanges[victimIndex];
+
+			// The victim may have drained its range since it was picked
+			if (victim.begin >= victim.end)
+			{
+				continue;
+			}
+
+			stolenEnd = victim.end;
+			stolenBegin = victim.end - (victim.end - victim.begin + 1) / 2;
+			victim.end = stolenBegin;
+		}
+
+		std::lock_guard<std::mutex> lock(taskRanges[thiefIndex].mutex);
+
+		taskRanges[thiefIndex].begin = stolenBegin;
+		taskRanges[thiefIndex].end = stolenEnd;
+
+		return true;
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Disassembles every sized function symbol in a module in parallel, for audits and coverage tooling that need the whole image.
+// Functions are split into one contiguous range per thread, threads that run out steal half of the largest remaining range, and
+// each thread decodes with its own udis86 context. Results come back in address order.
+class ImageDisassembler
+{
+public:
+	struct FunctionDisassembly
+	{
+		void* address;
+		size_t length;
+		std::string text;
+
+		FunctionDisassembly() : address(nullptr), length(0), text("") { }
+	};
+
+	struct ThreadStats
+	{
+		size_t functionCount;
+		size_t instructionCount;
+		size_t stealCount;
+		double seconds;
+		double instructionsPerSecond;
+
+		ThreadStats() : functionCount(0), instructionCount(0), stealCount(0), seconds(0.0), instructionsPerSecond(0.0) { }
+	};
+
+	struct ImageDisassembly
+	{
+		std::vector<FunctionDisassembly> functions;
+		std::vector<ThreadStats> threadStats;
+	};
+
+	// Disassembles the executable segments of the module containing addressInImage. A thread count of 0 uses every core.
+	static ImageDisassembly disassembleImage(void* addressInImage, int threadCount = 0);
+	static ImageDisassembly disassembleRange(void* rangeStart, void* rangeEnd, int threadCount = 0);
+
+private:
+	struct TaskRange
+	{
+		std::mutex mutex;
+		size_t begin;
+		size_t end;
+
+		TaskRange() : mutex(), begin(0), end(0) { }
+	};
+
+	static bool takeTask(TaskRange& taskRange, size_t* outTask);
+	static bool stealTasks(std::vector<TaskRange>& taskRanges, size_t thiefIndex);
+};
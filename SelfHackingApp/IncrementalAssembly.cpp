@@ -0,0 +1,350 @@
+#include "IncrementalAssembly.h"
+
+#include <algorithm>
+#include <cctype>
+
+#include "StrUtils.h"
+
+// Branches to labels are encoded at a fixed size, so layout normally settles in two passes. This only guards against pathological input.
+const int IncrementalAssembly::MaxRelayoutPasses = 8;
+
+IncrementalAssembly::IncrementalAssembly(void* addressStart)
+{
+	this->addressStart = addressStart;
+	this->lines = std::vector<AssembledLine>();
+	this->labelOffsets = std::map<std::string, int>();
+	this->lastEncodeCount = 0;
+}
+
+IncrementalAssembly::~IncrementalAssembly()
+{
+}
+
+HackUtils::CompileResult IncrementalAssembly::assemble(std::string assembly)
+{
+	std::vector<std::string> sourceLines = std::vector<std::string>();
+	size_t lineStart = 0;
+
+	for (size_t lineEnd = assembly.find('\n'); lineEnd != std::string::npos; lineEnd = assembly.find('\n', lineStart))
+	{
+		sourceLines.push_back(assembly.substr(lineStart, lineEnd - lineStart));
+		lineStart = lineEnd + 1;
+	}
+
+	sourceLines.push_back(assembly.substr(lineStart));
+
+	this->lines.clear();
+	this->labelOffsets.clear();
+	this->lastEncodeCount = 0;
+
+	for (auto sourceLine : sourceLines)
+	{
+		this->lines.push_back(IncrementalAssembly::parseLine(sourceLine));
+	}
+
+	return this->encodeStaleLines();
+}
+
+HackUtils::CompileResult IncrementalAssembly::updateLine(int lineIndex, std::string newLine)
+{
+	if (lineIndex < 0 || lineIndex > (int)this->lines.size() || newLine.find('\n') != std::string::npos)
+	{
+		// Anything other than a single line edit (or append) changes the line structure, so start over
+		std::string assembly = this->getAssemblyString();
+
+		return lineIndex < 0 || lineIndex > (int)this->lines.size() ? this->assemble(assembly) : this->assemble(assembly.empty() ? newLine : assembly + "\n" + newLine);
+	}
+
+	this->lastEncodeCount = 0;
+
+	if (lineIndex == (int)this->lines.size())
+	{
+		this->lines.push_back(IncrementalAssembly::parseLine(newLine));
+	}
+	else
+	{
+		// Keep the old bytes as a stand-in until the line is re-encoded so the layout of the other lines is undisturbed
+		AssembledLine line = IncrementalAssembly::parseLine(newLine);
+
+		line.byteOffset = this->lines[lineIndex].byteOffset;
+		line.bytes = this->lines[lineIndex].bytes;
+		this->lines[lineIndex] = line;
+	}
+
+	return this->encodeStaleLines();
+}
+
+int IncrementalAssembly::getLineCount()
+{
+	return (int)this->lines.size();
+}
+
+int IncrementalAssembly::getLineOffset(int lineIndex)
+{
+	return (lineIndex < 0 || lineIndex >= (int)this->lines.size()) ? 0 : this->lines[lineIndex].byteOffset;
+}
+
+int IncrementalAssembly::getLineSize(int lineIndex)
+{
+	return (lineIndex < 0 || lineIndex >= (int)this->lines.size()) ? 0 : (int)this->lines[lineIndex].bytes.size();
+}
+
+int IncrementalAssembly::getLastEncodeCount()
+{
+	return this->lastEncodeCount;
+}
+
+std::string IncrementalAssembly::getAssemblyString()
+{
+	std::string assembly = "";
+
+	for (int index = 0; index < (int)this->lines.size(); index++)
+	{
+		assembly += (index == 0 ? "" : "\n") + this->lines[index].text;
+	}
+
+	return assembly;
+}
+
+IncrementalAssembly::AssembledLine IncrementalAssembly::parseLine(std::string text)
+{
+	AssembledLine line = AssembledLine();
+
+	text = StrUtils::rtrim(text, "\r");
+	line.text = text;
+
+	// Comments never affect the encoding
+	size_t commentStart = std::min(text.find(';'), text.find("//"));
+	std::string code = text.substr(0, commentStart);
+
+	// A leading 'name:' defines a label, the rest of the line (if any) is an instruction
+	size_t labelStart = code.find_first_not_of(" \t");
+
+	if (labelStart != std::string::npos && IncrementalAssembly::isIdentifierStart(code[labelStart]))
+	{
+		size_t labelEnd = IncrementalAssembly::findTokenEnd(code, labelStart);
+		size_t colon = code.find_first_not_of(" \t", labelEnd);
+
+		if (colon != std::string::npos && code[colon] == ':')
+		{
+			line.labelDefinition = code.substr(labelStart, labelEnd - labelStart);
+			code = code.substr(colon + 1);
+		}
+	}
+
+	line.code = code;
+
+	for (size_t index = 0; index < code.size();)
+	{
+		size_t tokenEnd = IncrementalAssembly::findTokenEnd(code, index);
+		std::string token = code.substr(index, tokenEnd - index);
+
+		if (IncrementalAssembly::isIdentifierStart(token[0]) && std::find(line.identifiers.begin(), line.identifiers.end(), token) == line.identifiers.end())
+		{
+			line.identifiers.push_back(token);
+		}
+
+		index = tokenEnd;
+	}
+
+	// Relative branches and rip-relative operands encode differently depending on where the line lands
+	std::string mnemonic = line.identifiers.empty() ? "" : line.identifiers[0];
+	std::transform(mnemonic.begin(), mnemonic.end(), mnemonic.begin(), ::tolower);
+
+	line.isPositionDependent = StrUtils::startsWith(mnemonic, "j", true)
+		|| StrUtils::startsWith(mnemonic, "loop", true)
+		|| mnemonic == "call"
+		|| mnemonic == "xbegin";
+
+	// Branches with both a rel8 and a rel32 form, unless the line already asks for the short one
+	line.hasLongForm = (mnemonic == "call" || StrUtils::startsWith(mnemonic, "j", true))
+		&& mnemonic != "jecxz" && mnemonic != "jcxz" && mnemonic != "jrcxz";
+
+	for (auto identifier : line.identifiers)
+	{
+		line.isPositionDependent |= StrUtils::startsWith(identifier, "rip", true) && identifier.size() == 3;
+		line.hasLongForm &= !(StrUtils::startsWith(identifier, "short", true) && identifier.size() == 5);
+	}
+
+	return line;
+}
+
+bool IncrementalAssembly::isIdentifierStart(char next)
+{
+	return std::isalpha((unsigned char)next) || next == '_' || next == '.' || next == '@' || next == '$';
+}
+
+size_t IncrementalAssembly::findTokenEnd(const std::string& code, size_t tokenStart)
+{
+	size_t tokenEnd = tokenStart + 1;
+
+	// Identifiers and numbers are read whole (so '0x1F' is never mistaken for the identifier 'x1F'), anything else is a single character
+	if (IncrementalAssembly::isIdentifierStart(code[tokenStart]) || std::isdigit((unsigned char)code[tokenStart]))
+	{
+		while (tokenEnd < code.size() && (IncrementalAssembly::isIdentifierStart(code[tokenEnd]) || std::isdigit((unsigned char)code[tokenEnd])))
+		{
+			tokenEnd++;
+		}
+	}
+
+	return tokenEnd;
+}
+
+int IncrementalAssembly::getLabelOffset(const std::string& identifier)
+{
+	auto labelOffset = this->labelOffsets.find(identifier);
+
+	return labelOffset == this->labelOffsets.end() ? -1 : labelOffset->second;
+}
+
+bool IncrementalAssembly::isStale(const AssembledLine& line, bool labelsMoved)
+{
+	if (!line.isEncoded || (line.isPositionDependent && line.encodedOffset != line.byteOffset))
+	{
+		return true;
+	}
+
+	if (labelsMoved)
+	{
+		for (int index = 0; index < (int)line.identifiers.size(); index++)
+		{
+			if (this->getLabelOffset(line.identifiers[index]) != line.encodedLabelOffsets[index])
+			{
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+void IncrementalAssembly::encodeLine(AssembledLine& line)
+{
+	line.isEncoded = true;
+	line.encodedOffset = line.byteOffset;
+	line.encodedLabelOffsets.clear();
+	line.bytes.clear();
+	line.hasError = false;
+
+	for (auto identifier : line.identifiers)
+	{
+		line.encodedLabelOffsets.push_back(this->getLabelOffset(identifier));
+	}
+
+	if (line.code.find_first_not_of(" \t") == std::string::npos)
+	{
+		return;
+	}
+
+	// Swap label references for their absolute address. asmjit would pick rel8 for a near target, so branches to a label are
+	// encoded in their long form to keep them at a fixed size regardless of distance.
+	std::string resolvedCode = "";
+	bool referencesLabel = false;
+
+	for (size_t index = 0; index < line.code.size();)
+	{
+		size_t tokenEnd = IncrementalAssembly::findTokenEnd(line.code, index);
+		std::string token = line.code.substr(index, tokenEnd - index);
+		int labelOffset = IncrementalAssembly::isIdentifierStart(token[0]) ? this->getLabelOffset(token) : -1;
+
+		resolvedCode += labelOffset < 0 ? token : std::to_string((unsigned long long)this->addressStart + labelOffset);
+		referencesLabel |= labelOffset >= 0;
+		index = tokenEnd;
+	}
+
+	if (referencesLabel && line.hasLongForm)
+	{
+		resolvedCode = "long " + resolvedCode;
+	}
+
+	HackUtils::CompileResult compileResult = HackUtils::assemble(resolvedCode, (unsigned char*)this->addressStart + line.byteOffset);
+
+	this->lastEncodeCount++;
+
+	if (compileResult.hasError)
+	{
+		line.hasError = true;
+		line.errorData = compileResult.errorData;
+		return;
+	}
+
+	line.bytes = compileResult.compiledBytes;
+}
+
+bool IncrementalAssembly::updateOffsets()
+{
+	std::map<std::string, int> newLabelOffsets = std::map<std::string, int>();
+	int byteOffset = 0;
+
+	for (auto& line : this->lines)
+	{
+		line.byteOffset = byteOffset;
+		line.isDuplicateLabel = !line.labelDefinition.empty() && newLabelOffsets.find(line.labelDefinition) != newLabelOffsets.end();
+
+		if (!line.labelDefinition.empty() && !line.isDuplicateLabel)
+		{
+			newLabelOffsets[line.labelDefinition] = byteOffset;
+		}
+
+		byteOffset += (int)line.bytes.size();
+	}
+
+	bool labelsMoved = newLabelOffsets != this->labelOffsets;
+
+	this->labelOffsets = newLabelOffsets;
+
+	return labelsMoved;
+}
+
+HackUtils::CompileResult IncrementalAssembly::encodeStaleLines()
+{
+	for (int pass = 0; pass < IncrementalAssembly::MaxRelayoutPasses; pass++)
+	{
+		bool labelsMoved = this->updateOffsets();
+		bool anyResized = false;
+
+		for (auto& line : this->lines)
+		{
+			if (this->isStale(line, labelsMoved))
+			{
+				size_t previousSize = line.bytes.size();
+
+				this->encodeLine(line);
+
+				anyResized |= line.bytes.size() != previousSize;
+			}
+		}
+
+		if (!anyResized)
+		{
+			break;
+		}
+	}
+
+	HackUtils::CompileResult compileResult;
+
+	compileResult.hasError = false;
+	compileResult.errorData.lineNumber = 0;
+	compileResult.errorData.message = "";
+	compileResult.compiledBytes = std::vector<unsigned char>();
+
+	for (int index = 0; index < (int)this->lines.size(); index++)
+	{
+		const AssembledLine& line = this->lines[index];
+
+		if (line.hasError || line.isDuplicateLabel)
+		{
+			compileResult.hasError = true;
+			compileResult.errorData.lineNumber = index + 1;
+			compileResult.errorData.message = line.hasError ? line.errorData.message : "Label already defined";
+			compileResult.compiledBytes.clear();
+			break;
+		}
+
+		compileResult.compiledBytes.insert(compileResult.compiledBytes.end(), line.bytes.begin(), line.bytes.end());
+	}
+
+	compileResult.byteCount = (int)compileResult.compiledBytes.size();
+
+	return compileResult;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+
+#include "HackUtils.h"
+
+// Keeps the per-line encoding of a snippet so that editing one line only re-encodes that line, plus any lines whose
+// relative branches are affected by it. Label references are resolved to absolute addresses before encoding, and jmp, jcc
+// and call are forced into their rel32 form so that a moved label never changes the size of the lines that use it. Branches
+// with only a rel8 form (loop, jecxz) keep that size anyway.
+class IncrementalAssembly
+{
+public:
+	IncrementalAssembly(void* addressStart);
+	virtual ~IncrementalAssembly();
+
+	HackUtils::CompileResult assemble(std::string assembly);
+	HackUtils::CompileResult updateLine(int lineIndex, std::string newLine);
+	int getLineCount();
+	int getLineOffset(int lineIndex);
+	int getLineSize(int lineIndex);
+	int getLastEncodeCount();
+	std::string getAssemblyString();
+
+private:
+	struct AssembledLine
+	{
+		std::string text;
+		std::string code;
+		std::string labelDefinition;
+		std::vector<std::string> identifiers;
+		std::vector<unsigned char> bytes;
+		int byteOffset;
+		bool isPositionDependent;
+		bool hasLongForm;
+		bool isDuplicateLabel;
+
+		// What the current bytes were encoded against
+		bool isEncoded;
+		int encodedOffset;
+		std::vector<int> encodedLabelOffsets;
+		HackUtils::CompileResult::ErrorData errorData;
+		bool hasError;
+
+		AssembledLine() : text(""), code(""), labelDefinition(""), identifiers(), bytes(), byteOffset(0), isPositionDependent(false), hasLongForm(false), isDuplicateLabel(false),
+			isEncoded(false), encodedOffset(0), encodedLabelOffsets(), errorData(), hasError(false) { }
+	};
+
+	static AssembledLine parseLine(std::string text);
+	static bool isIdentifierStart(char next);
+	static size_t findTokenEnd(const std::string& code, size_t tokenStart);
+	int getLabelOffset(const std::string& identifier);
+	bool isStale(const AssembledLine& line, bool labelsMoved);
+	void encodeLine(AssembledLine& line);
+	bool updateOffsets();
+	HackUtils::CompileResult encodeStaleLines();
+
+	void* addressStart;
+	std::vector<AssembledLine> lines;
+	std::map<std::string, int> labelOffsets;
+	int lastEncodeCount;
+
+	static const int MaxRelayoutPasses;
+};
@@ -0,0 +1,296 @@
+#include "InstructionLength.h"
+
+#include <algorithm>
+
+const int InstructionLength::MaxLength = 15;
+
+// Flags per opcode: 0x01 ModRm, 0x02 Imm8, 0x04 Imm16, 0x08 ImmZ (16 or 32 bit), 0x10 Special, 0x20 Invalid64, 0x40 Prefix.
+// Special opcodes have operand sizes the flags cannot express and are handled in getLength.
+const unsigned char InstructionLength::OneByteOpcodes[256] =
+{
+	0x01, 0x01, 0x01, 0x01, 0x02, 0x08, 0x20, 0x20, 0x01, 0x01, 0x01, 0x01, 0x02, 0x08, 0x20, 0x10, // 00
+	0x01, 0x01, 0x01, 0x01, 0x02, 0x08, 0x20, 0x20, 0x01, 0x01, 0x01, 0x01, 0x02, 0x08, 0x20, 0x20, // 10
+	0x01, 0x01, 0x01, 0x01, 0x02, 0x08, 0x40, 0x20, 0x01, 0x01, 0x01, 0x01, 0x02, 0x08, 0x40, 0x20, // 20
+	0x01, 0x01, 0x01, 0x01, 0x02, 0x08, 0x40, 0x20, 0x01, 0x01, 0x01, 0x01, 0x02, 0x08, 0x40, 0x20, // 30
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 40
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 50
+	0x20, 0x20, 0x11, 0x01, 0x40, 0x40, 0x40, 0x40, 0x08, 0x09, 0x02, 0x03, 0x00, 0x00, 0x00, 0x00, // 60
+	0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, // 70
+	0x03, 0x09, 0x23, 0x03, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, // 80
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00, 0x00, 0x00, // 90
+	0x10, 0x10, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00, 0x02, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // A0
+	0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, // B0
+	0x03, 0x03, 0x04, 0x00, 0x11, 0x11, 0x03, 0x09, 0x06, 0x00, 0x04, 0x00, 0x00, 0x02, 0x20, 0x00, // C0
+	0x01, 0x01, 0x01, 0x01, 0x22, 0x22, 0x20, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, // D0
+	0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x08, 0x08, 0x30, 0x02, 0x00, 0x00, 0x00, 0x00, // E0
+	0x40, 0x00, 0x40, 0x40, 0x00, 0x00, 0x11, 0x11, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01, // F0
+};
+
+const unsigned char InstructionLength::TwoByteOpcodes[256] =
+{
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x01, 0x01, 0x00, 0x03, // 00
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, // 10
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, // 20
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x10, 0x01, 0x10, 0x01, 0x01, 0x01, 0x01, 0x01, // 30
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, // 40
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, // 50
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, // 60
+	0x03, 0x03, 0x03, 0x03, 0x01, 0x01, 0x01, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, // 70
+	0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, // 80
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, // 90
+	0x00, 0x00, 0x00, 0x01, 0x03, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x01, 0x03, 0x01, 0x01, 0x01, // A0
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x03, 0x01, 0x01, 0x01, 0x01, 0x01, // B0
+	0x01, 0x01, 0x03, 0x01, 0x03, 0x03, 0x03, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // C0
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, // D0
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, // E0
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, // F0
+};
+
+int InstructionLength::getLength(const void* address, int available, int mode)
+{
+	Layout layout;
+
+	return InstructionLength::getLayout(address, available, layout, mode) ? layout.length : 0;
+}
+
+bool InstructionLength::getLayout(const void* address, int available, Layout& outLayout, int mode)
+{
+	const unsigned char* start = (const unsigned char*)address;
+	const unsigned char* end = start + std::min(available, InstructionLength::MaxLength);
+	const unsigned char* code = start;
+	bool is64 = mode == 64;
+	bool hasOperandSizePrefix = false;
+	bool hasAddressSizePrefix = false;
+	bool hasRepPrefix = false;
+	bool rexW = false;
+	bool rexB = false;
+	bool isVex = false;
+	int opcodeMap = 0;
+	unsigned char opcode = 0;
+	unsigned char flags = 0;
+
+	// A REX prefix only takes effect when it is the last prefix before the opcode
+	while (true)
+	{
+		if (code >= end)
+		{
+			return false;
+		}
+
+		opcode = *code++;
+		flags = InstructionLength::OneByteOpcodes[opcode];
+
+		if (flags & Prefix)
+		{
+			hasOperandSizePrefix |= opcode == 0x66;
+			hasAddressSizePrefix |= opcode == 0x67;
+			hasRepPrefix |= opcode == 0xF3;
+			rexW = false;
+			rexB = false;
+		}
+		else if (is64 && (opcode & 0xF0) == 0x40)
+		{
+			rexW = (opcode & 0x08) != 0;
+			rexB = (opcode & 0x01) != 0;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	if (is64 && (flags & Invalid64))
+	{
+		return false;
+	}
+
+	bool isOperandSize16 = hasOperandSizePrefix && !rexW;
+	int immediateSize = 0;
+
+	if (flags & Special)
+	{
+		switch (opcode)
+		{
+			case 0x0F:
+			{
+				if (code >= end)
+				{
+					return false;
+				}
+
+				opcode = *code++;
+				opcodeMap = 1;
+
+				if (opcode == 0x38 || opcode == 0x3A)
+				{
+					if (code >= end)
+					{
+						return false;
+					}
+
+					opcodeMap = opcode == 0x3A ? 3 : 2;
+					opcode = *code++;
+					flags = opcodeMap == 3 ? (ModRm | Imm8) : ModRm;
+				}
+				else
+				{
+					flags = InstructionLength::TwoByteOpcodes[opcode];
+				}
+
+				break;
+			}
+			case 0x62:
+			case 0xC4:
+			case 0xC5:
+			{
+				// Outside 64-bit mode these are BOUND/LES/LDS unless the next byte would be a register-form ModRM
+				if (!is64 && (code >= end || (*code & 0xC0) != 0xC0))
+				{
+					break;
+				}
+
+				int payloadSize = opcode == 0x62 ? 3 : (opcode == 0xC4 ? 2 : 1);
+
+				if (end - code < payloadSize + 1)
+				{
+					return false;
+				}
+
+				// VEX and EVEX select the 0F, 0F38 or 0F3A opcode map instead of spelling it out
+				int map = opcode == 0x62 ? (code[0] & 0x07) : (opcode == 0xC4 ? (code[0] & 0x1F) : 1);
+
+				if (map < 1 || map > 3)
+				{
+					return false;
+				}
+
+				code += payloadSize;
+				opcode = *code++;
+				opcodeMap = map;
+				isVex = true;
+				// vzeroupper/vzeroall are the only ones without a ModRM byte, and in the 0F map only the legacy imm8 opcodes keep an immediate
+				flags = map == 1 ? ((InstructionLength::TwoByteOpcodes[opcode] & Imm8) | (opcode == 0x77 ? 0 : ModRm)) : (map == 2 ? ModRm : (ModRm | Imm8));
+				break;
+			}
+			case 0x9A:
+			case 0xEA:
+			{
+				// Far pointer, offset then selector
+				immediateSize = isOperandSize16 ? 4 : 6;
+				break;
+			}
+			case 0xA0:
+			case 0xA1:
+			case 0xA2:
+			case 0xA3:
+			{
+				// Absolute offset sized by the address size
+				immediateSize = is64 ? (hasAddressSizePrefix ? 4 : 8) : (hasAddressSizePrefix ? 2 : 4);
+				break;
+			}
+			case 0xF6:
+			case 0xF7:
+			{
+				// Only TEST (/0 and /1) in group 3 takes an immediate
+				if (code < end && ((*code >> 3) & 0x07) < 2)
+				{
+					immediateSize = opcode == 0xF6 ? 1 : (isOperandSize16 ? 2 : 4);
+				}
+
+				break;
+			}
+			default:
+			{
+				// B8-BF mov r, imm is the only instruction with a full 64-bit immediate
+				immediateSize = rexW ? 8 : (isOperandSize16 ? 2 : 4);
+				break;
+			}
+		}
+	}
+
+	immediateSize += ((flags & Imm8) ? 1 : 0) + ((flags & Imm16) ? 2 : 0) + ((flags & ImmZ) ? (isOperandSize16 ? 2 : 4) : 0);
+
+	int displacementSize = 0;
+	bool isRipRelative = false;
+	unsigned char modRm = 0;
+
+	if (flags & ModRm)
+	{
+		if (code >= end)
+		{
+			return false;
+		}
+
+		modRm = *code++;
+		int mod = modRm >> 6;
+		int rm = modRm & 0x07;
+
+		if (mod != 3 && !is64 && hasAddressSizePrefix)
+		{
+			// 16-bit addressing has no SIB byte, and [disp16] takes the place of [bp]
+			displacementSize = mod == 1 ? 1 : ((mod == 2 || (mod == 0 && rm == 6)) ? 2 : 0);
+		}
+		else if (mod != 3)
+		{
+			// Without a SIB byte, [disp32] is rip-relative in 64-bit mode
+			isRipRelative = is64 && mod == 0 && rm == 5;
+
+			if (rm == 4)
+			{
+				if (code >= end)
+				{
+					return false;
+				}
+
+				// A SIB base of 5 with mod 0 means [index*scale + disp32]
+				rm = (*code++ & 0x07) == 5 ? 5 : 4;
+			}
+
+			displacementSize = mod == 1 ? 1 : ((mod == 2 || (mod == 0 && rm == 5)) ? 4 : 0);
+		}
+	}
+
+	int length = (int)(code - start) + displacementSize + immediateSize;
+
+	if (length > (int)(end - start))
+	{
+		return false;
+	}
+
+	outLayout.length = length;
+	outLayout.opcodeMap = opcodeMap;
+	outLayout.opcode = opcode;
+	outLayout.displacementOffset = (int)(code - start);
+	outLayout.displacementSize = displacementSize;
+	outLayout.immediateOffset = outLayout.displacementOffset + displacementSize;
+	outLayout.immediateSize = immediateSize;
+	outLayout.isRipRelative = isRipRelative;
+
+	// jcc, loop/jcxz, call and jmp rel, the 0F jcc rel forms and xbegin (C7 F8)
+	outLayout.isRelativeBranch = !isVex && ((opcodeMap == 0 && ((opcode & 0xF0) == 0x70 || (opcode >= 0xE0 && opcode <= 0xE3)
+		|| opcode == 0xE8 || opcode == 0xE9 || opcode == 0xEB || (opcode == 0xC7 && modRm == 0xF8))) || (opcodeMap == 1 && (opcode & 0xF0) == 0x80));
+
+	// 90 is xchg r8, rax with REX.B, 0F 1F is the multi-byte NOP. F3 turns 90 into pause, so F3 forms aren't counted either way.
+	outLayout.isNop = !isVex && !hasRepPrefix && ((opcodeMap == 0 && opcode == 0x90 && !rexB) || (opcodeMap == 1 && opcode == 0x1F));
+
+	return true;
+}
+
+int InstructionLength::getCoveringLength(const void* address, int minimumLength, int mode)
+{
+	int length = 0;
+
+	while (length < minimumLength)
+	{
+		int nextLength = InstructionLength::getLength((const unsigned char*)address + length, InstructionLength::MaxLength, mode);
+
+		if (nextLength == 0)
+		{
+			return 0;
+		}
+
+		length += nextLength;
+	}
+
+	return length;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+// Length-only x86/x64 instruction decoder, for callers that only need instruction boundaries (scanning, relocating and validating code).
+// Prefixes, opcode, ModRM/SIB, displacement and immediate sizes come from two 256 entry tables, so there is no operand resolution and
+// no walk through udis86's itab. Instructions udis86 decodes as valid get the same length as ud_insn_len.
+class InstructionLength
+{
+public:
+	// Where the parts of an instruction are, for callers that copy or patch instructions rather than read their operands. Offsets
+	// are from the first prefix byte, and the map is 0 for one byte opcodes, then 1-3 for 0F, 0F38 and 0F3A (VEX and EVEX included).
+	struct Layout
+	{
+		int length;
+		int opcodeMap;
+		unsigned char opcode;
+		int displacementOffset;
+		int displacementSize;
+		int immediateOffset;
+		int immediateSize;
+		// The displacement is relative to the end of the instruction, ie [rip+disp32]
+		bool isRipRelative;
+		// The immediate is a branch displacement from the end of the instruction (jmp, call, jcc, loop, jcxz, xbegin)
+		bool isRelativeBranch;
+		bool isNop;
+
+		Layout() : length(0), opcodeMap(0), opcode(0), displacementOffset(0), displacementSize(0), immediateOffset(0), immediateSize(0),
+			isRipRelative(false), isRelativeBranch(false), isNop(false) { }
+	};
+
+	// Returns the length of the instruction at address, or 0 if it is invalid or runs past the available bytes
+	static int getLength(const void* address, int available, int mode = sizeof(void*) * 8);
+
+	// Same decode as getLength, returning false where getLength returns 0
+	static bool getLayout(const void* address, int available, Layout& outLayout, int mode = sizeof(void*) * 8);
+
+	// Returns the length of the whole instructions starting at address that cover at least minimumLength bytes, or 0 on an invalid instruction
+	static int getCoveringLength(const void* address, int minimumLength, int mode = sizeof(void*) * 8);
+
+	static const int MaxLength;
+
+private:
+	enum OpcodeFlags
+	{
+		ModRm = 0x01,
+		Imm8 = 0x02,
+		Imm16 = 0x04,
+		ImmZ = 0x08,
+		Special = 0x10,
+		Invalid64 = 0x20,
+		Prefix = 0x40,
+	};
+
+	static const unsigned char OneByteOpcodes[256];
+	static const unsigned char TwoByteOpcodes[256];
+};
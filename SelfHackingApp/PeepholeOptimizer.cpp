@@ -0,0 +1,373 @@
+#include "PeepholeOptimizer.h"
+
+using namespace asmjit;
+
+// Rough cycles saved per rewrite, taken from the latency tables for recent Intel and AMD cores
+static const int MoveCycles = 1;
+static const int ArithmeticCycles = 1;
+static const int MultiplyCycles = 2;
+static const int StackRoundTripCycles = 4;
+
+// Status flags a patch can observe, DF and the FPU flags are never written by the instructions rewritten here
+static const uint32_t StatusFlags = x86::Status::kCF | x86::Status::kOF | x86::Status::kSF | x86::Status::kZF | x86::Status::kAF | x86::Status::kPF;
+
+void PeepholeOptimizer::optimize(x86::Builder& builder, bool flagsLiveAtEnd, std::vector<HackUtils::PeepholeRewrite>& outRewrites)
+{
+	PeepholeOptimizer optimizer = PeepholeOptimizer(builder, flagsLiveAtEnd, outRewrites);
+	bool isChanged = true;
+
+	outRewrites.clear();
+
+	// Patches are a handful of lines, so each rewrite simply starts over. That also lets pairs nested inside each other
+	// (push rax; push rbx; pop rbx; pop rax) fold one after the other.
+	while (isChanged)
+	{
+		isChanged = false;
+
+		for (BaseNode* node = builder.firstNode(); node != nullptr && !isChanged; node = node->next())
+		{
+			if (node->type() != BaseNode::kNodeInst)
+			{
+				continue;
+			}
+
+			InstNode* instruction = node->as<InstNode>();
+
+			isChanged = optimizer.removeSelfMove(instruction)
+				|| optimizer.removeDeadMove(instruction)
+				|| optimizer.removeIdentityOperation(instruction)
+				|| optimizer.reduceMultiply(instruction)
+				|| optimizer.foldPushPop(instruction);
+		}
+	}
+}
+
+PeepholeOptimizer::PeepholeOptimizer(x86::Builder& builder, bool flagsLiveAtEnd, std::vector<HackUtils::PeepholeRewrite>& outRewrites)
+	: builder(builder), rewrites(outRewrites)
+{
+	this->flagsLiveAtEnd = flagsLiveAtEnd;
+	this->archId = builder.archId();
+	this->pointerSize = builder.gpSize();
+}
+
+bool PeepholeOptimizer::removeSelfMove(InstNode* node)
+{
+	// mov eax, eax on x64 clears the upper half, so only full width copies do nothing
+	if (node->id() != x86::Inst::kIdMov || node->opCount() != 2 || !PeepholeOptimizer::isGpRegister(node->opType(0))
+		|| node->opType(0) != node->opType(1) || node->opType(0).as<BaseReg>().size() != this->pointerSize)
+	{
+		return false;
+	}
+
+	this->report({ node }, { }, MoveCycles);
+	this->builder.removeNode(node);
+
+	return true;
+}
+
+bool PeepholeOptimizer::removeDeadMove(InstNode* node)
+{
+	InstNode* next = PeepholeOptimizer::getNextInstruction(node);
+
+	// Register to register, immediate and lea moves only, dropping a load could hide a fault the patch depends on
+	if (next == nullptr || node->opCount() != 2 || !PeepholeOptimizer::isGpRegister(node->opType(0))
+		|| !(node->id() == x86::Inst::kIdLea || (node->id() == x86::Inst::kIdMov && !node->opType(1).isMem())))
+	{
+		return false;
+	}
+
+	if (!(next->id() == x86::Inst::kIdMov || next->id() == x86::Inst::kIdLea || next->id() == x86::Inst::kIdMovzx
+		|| next->id() == x86::Inst::kIdMovsx || next->id() == x86::Inst::kIdMovsxd)
+		|| next->opCount() != 2 || !PeepholeOptimizer::isGpRegister(next->opType(0)))
+	{
+		return false;
+	}
+
+	const BaseReg& destination = node->opType(0).as<BaseReg>();
+	const BaseReg& nextDestination = next->opType(0).as<BaseReg>();
+
+	// The next move has to overwrite everything this one wrote. Byte and word registers are skipped, ah and al share an id.
+	bool isOverwritten = nextDestination.id() == destination.id() && destination.size() >= 4 && nextDestination.size() >= 4
+		&& (nextDestination.size() >= destination.size() || (this->pointerSize == 8 && nextDestination.size() == 4));
+
+	if (!isOverwritten || PeepholeOptimizer::referencesRegister(next, destination.id(), 1))
+	{
+		return false;
+	}
+
+	this->report({ node }, { }, MoveCycles);
+	this->builder.removeNode(node);
+
+	return true;
+}
+
+bool PeepholeOptimizer::removeIdentityOperation(InstNode* node)
+{
+	if (node->opCount() < 2 || !PeepholeOptimizer::isGpRegister(node->opType(0)) || node->opType(0).as<BaseReg>().size() != this->pointerSize)
+	{
+		return false;
+	}
+
+	const Operand& source = node->opType(node->opCount() - 1);
+
+	if (!source.isImm() || (node->opCount() == 3 && !(node->id() == x86::Inst::kIdImul && node->opType(1) == node->opType(0))))
+	{
+		return false;
+	}
+
+	int64_t value = source.as<Imm>().i64();
+	bool isShift = false;
+	bool isIdentity = false;
+
+	switch (node->id())
+	{
+		case x86::Inst::kIdAdd:
+		case x86::Inst::kIdSub:
+		case x86::Inst::kIdOr:
+		case x86::Inst::kIdXor:
+		{
+			isIdentity = value == 0;
+			break;
+		}
+		case x86::Inst::kIdAnd:
+		{
+			isIdentity = value == -1;
+			break;
+		}
+		case x86::Inst::kIdImul:
+		{
+			isIdentity = value == 1;
+			break;
+		}
+		case x86::Inst::kIdShl:
+		case x86::Inst::kIdShr:
+		case x86::Inst::kIdSar:
+		case x86::Inst::kIdRol:
+		case x86::Inst::kIdRor:
+		{
+			isIdentity = (value & (this->pointerSize * 8 - 1)) == 0;
+			isShift = true;
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+
+	// Shifts and rotates by zero leave the flags alone, the rest still set them
+	if (!isIdentity || (!isShift && !this->areFlagsDeadAfter(node)))
+	{
+		return false;
+	}
+
+	this->report({ node }, { }, ArithmeticCycles);
+	this->builder.removeNode(node);
+
+	return true;
+}
+
+bool PeepholeOptimizer::reduceMultiply(InstNode* node)
+{
+	if (node->id() != x86::Inst::kIdImul || node->opCount() < 2 || !PeepholeOptimizer::isGpRegister(node->opType(0)))
+	{
+		return false;
+	}
+
+	const Operand& source = node->opType(node->opCount() - 1);
+
+	// imul reg, imm and imm reg, reg, imm with the same register, shl can't multiply into another register
+	if (!source.isImm() || (node->opCount() == 3 && node->opType(1) != node->opType(0)) || node->opCount() > 3)
+	{
+		return false;
+	}
+
+	int64_t value = source.as<Imm>().i64();
+
+	// imul leaves SF, ZF, AF and PF undefined and sets CF/OF differently from shl, so nothing may read them afterwards
+	if (value <= 1 || (value & (value - 1)) != 0 || !this->areFlagsDeadAfter(node))
+	{
+		return false;
+	}
+
+	InstNode* shift = this->builder.newInstNode(x86::Inst::kIdShl, 0, node->opType(0), imm(Support::ctz((uint64_t)value)));
+
+	if (shift == nullptr)
+	{
+		return false;
+	}
+
+	this->report({ node }, { shift }, MultiplyCycles);
+	this->builder.addAfter(shift, node);
+	this->builder.removeNode(node);
+
+	return true;
+}
+
+bool PeepholeOptimizer::foldPushPop(InstNode* node)
+{
+	InstNode* next = PeepholeOptimizer::getNextInstruction(node);
+
+	if (next == nullptr || node->id() != x86::Inst::kIdPush || next->id() != x86::Inst::kIdPop
+		|| node->opCount() != 1 || next->opCount() != 1
+		|| !PeepholeOptimizer::isGpRegister(node->opType(0)) || !PeepholeOptimizer::isGpRegister(next->opType(0)))
+	{
+		return false;
+	}
+
+	const BaseReg& source = node->opType(0).as<BaseReg>();
+	const BaseReg& destination = next->opType(0).as<BaseReg>();
+
+	// push/pop of the stack pointer itself see a moving value, leave those alone
+	if (source.size() != this->pointerSize || destination.size() != this->pointerSize
+		|| source.id() == x86::Gp::kIdSp || destination.id() == x86::Gp::kIdSp)
+	{
+		return false;
+	}
+
+	if (source.id() == destination.id())
+	{
+		this->report({ node, next }, { }, StackRoundTripCycles);
+		this->builder.removeNode(node);
+		this->builder.removeNode(next);
+
+		return true;
+	}
+
+	// A register move is a byte longer than push/pop but skips the store forwarding round trip
+	InstNode* move = this->builder.newInstNode(x86::Inst::kIdMov, 0, destination, source);
+
+	if (move == nullptr)
+	{
+		return false;
+	}
+
+	this->report({ node, next }, { move }, StackRoundTripCycles);
+	this->builder.addAfter(move, next);
+	this->builder.removeNode(node);
+	this->builder.removeNode(next);
+
+	return true;
+}
+
+bool PeepholeOptimizer::areFlagsDeadAfter(BaseNode* node)
+{
+	uint32_t pendingFlags = StatusFlags;
+
+	for (BaseNode* next = node->next(); next != nullptr; next = next->next())
+	{
+		// A label can be reached from anywhere, and a branch leaves the patch, so the flags are assumed live past either
+		if (next->type() != BaseNode::kNodeInst)
+		{
+			return false;
+		}
+
+		InstNode* instruction = next->as<InstNode>();
+		InstRWInfo rwInfo;
+
+		if (x86::InstDB::infoById(instruction->id()).controlType() != BaseInst::kControlNone
+			|| InstAPI::queryRWInfo(this->archId, instruction->baseInst(), instruction->operands(), instruction->opCount(), rwInfo) != kErrorOk)
+		{
+			return false;
+		}
+
+		if ((rwInfo.readFlags() & pendingFlags) != 0)
+		{
+			return false;
+		}
+
+		pendingFlags &= ~rwInfo.writeFlags();
+
+		if (pendingFlags == 0)
+		{
+			return true;
+		}
+	}
+
+	return !this->flagsLiveAtEnd;
+}
+
+void PeepholeOptimizer::report(const std::vector<InstNode*>& before, const std::vector<InstNode*>& after, int cyclesSaved)
+{
+	HackUtils::PeepholeRewrite rewrite = HackUtils::PeepholeRewrite();
+
+	for (InstNode* node : before)
+	{
+		rewrite.before += (rewrite.before.empty() ? "" : "; ") + this->getText(node);
+		rewrite.bytesSaved += this->getEncodedSize(node);
+	}
+
+	for (InstNode* node : after)
+	{
+		rewrite.after += (rewrite.after.empty() ? "" : "; ") + this->getText(node);
+		rewrite.bytesSaved -= this->getEncodedSize(node);
+	}
+
+	rewrite.cyclesSaved = cyclesSaved;
+
+	this->rewrites.push_back(rewrite);
+}
+
+int PeepholeOptimizer::getEncodedSize(InstNode* node)
+{
+	// Only position independent instructions are rewritten, so a scratch encoding at address zero gives the right size
+	CodeHolder code;
+	code.init(CodeInfo(this->archId));
+
+	x86::Assembler assembler(&code);
+
+	if (assembler.emitInst(node->baseInst(), node->operands(), node->opCount()) != kErrorOk)
+	{
+		return 0;
+	}
+
+	return (int)code.sectionById(0)->buffer().size();
+}
+
+std::string PeepholeOptimizer::getText(InstNode* node)
+{
+	String text;
+
+	Logging::formatInstruction(text, 0, &this->builder, this->archId, node->baseInst(), node->operands(), node->opCount());
+
+	return std::string(text.data(), text.size());
+}
+
+InstNode* PeepholeOptimizer::getNextInstruction(BaseNode* node)
+{
+	BaseNode* next = node->next();
+
+	return next != nullptr && next->type() == BaseNode::kNodeInst ? next->as<InstNode>() : nullptr;
+}
+
+bool PeepholeOptimizer::isGpRegister(const Operand& operand)
+{
+	return operand.isReg() && operand.as<BaseReg>().group() == BaseReg::kGroupGp;
+}
+
+bool PeepholeOptimizer::referencesRegister(InstNode* node, unsigned int registerId, int firstOperand)
+{
+	for (int index = firstOperand; index < (int)node->opCount(); index++)
+	{
+		const Operand& operand = node->opType(index);
+
+		if (PeepholeOptimizer::isGpRegister(operand) && operand.as<BaseReg>().id() == registerId)
+		{
+			return true;
+		}
+
+		if (operand.isMem())
+		{
+			const BaseMem& memory = operand.as<BaseMem>();
+			bool isGpBase = memory.baseType() >= BaseReg::kTypeGp8Lo && memory.baseType() <= BaseReg::kTypeGp64;
+			bool isGpIndex = memory.indexType() >= BaseReg::kTypeGp8Lo && memory.indexType() <= BaseReg::kTypeGp64;
+
+			if ((isGpBase && memory.baseId() == registerId) || (isGpIndex && memory.indexId() == registerId))
+			{
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "HackUtils.h"
+#include "External/asmjit/asmjit.h"
+
+// Cleans up user patches after they are parsed into an x86::Builder node list and before they are serialized. Only adjacent
+// instructions are rewritten, so nothing moves across a label. Rewrites that change the flags are only made where the flags
+// are overwritten before anything reads them, or aren't live after the patch.
+class PeepholeOptimizer
+{
+public:
+	static void optimize(asmjit::x86::Builder& builder, bool flagsLiveAtEnd, std::vector<HackUtils::PeepholeRewrite>& outRewrites);
+
+private:
+	PeepholeOptimizer(asmjit::x86::Builder& builder, bool flagsLiveAtEnd, std::vector<HackUtils::PeepholeRewrite>& outRewrites);
+
+	bool removeSelfMove(asmjit::InstNode* node);
+	bool removeDeadMove(asmjit::InstNode* node);
+	bool removeIdentityOperation(asmjit::InstNode* node);
+	bool reduceMultiply(asmjit::InstNode* node);
+	bool foldPushPop(asmjit::InstNode* node);
+
+	bool areFlagsDeadAfter(asmjit::BaseNode* node);
+	void report(const std::vector<asmjit::InstNode*>& before, const std::vector<asmjit::InstNode*>& after, int cyclesSaved);
+	int getEncodedSize(asmjit::InstNode* node);
+	std::string getText(asmjit::InstNode* node);
+
+	static asmjit::InstNode* getNextInstruction(asmjit::BaseNode* node);
+	static bool isGpRegister(const asmjit::Operand& operand);
+	static bool referencesRegister(asmjit::InstNode* node, unsigned int registerId, int firstOperand);
+
+	asmjit::x86::Builder& builder;
+	bool flagsLiveAtEnd;
+	std::vector<HackUtils::PeepholeRewrite>& rewrites;
+	unsigned int archId;
+	unsigned int pointerSize;
+};
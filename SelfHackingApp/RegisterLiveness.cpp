@@ -0,0 +1,712 @@
+#include "RegisterLiveness.h"
+
+#include <algorithm>
+
+#include "SymbolTable.h"
+#include "External/libudis86/udis86.h"
+
+const unsigned int RegisterLiveness::FlagsBit = 1u << 16;
+const unsigned int RegisterLiveness::AllRegisters = sizeof(void*) == 8 ? 0xFFFF : 0x00FF;
+
+// Register bits in encoding order
+static const unsigned int Rax = 1u << 0;
+static const unsigned int Rcx = 1u << 1;
+static const unsigned int Rdx = 1u << 2;
+static const unsigned int Rbx = 1u << 3;
+static const unsigned int Rsp = 1u << 4;
+static const unsigned int Rbp = 1u << 5;
+static const unsigned int Rsi = 1u << 6;
+static const unsigned int Rdi = 1u << 7;
+static const unsigned int R8 = 1u << 8;
+static const unsigned int R9 = 1u << 9;
+static const unsigned int R10 = 1u << 10;
+static const unsigned int R11 = 1u << 11;
+static const unsigned int R12To15 = 0xF000;
+
+// What a call may read and clobber, and what must survive a return, under the platform calling convention
+#if _WIN64
+static const unsigned int ArgumentRegisters = Rcx | Rdx | R8 | R9;
+static const unsigned int CallerSavedRegisters = Rax | Rcx | Rdx | R8 | R9 | R10 | R11;
+static const unsigned int ReturnRegisters = Rax | Rsp | Rbx | Rbp | Rsi | Rdi | R12To15;
+#elif __x86_64__
+// rax carries the vector register count into variadic functions
+static const unsigned int ArgumentRegisters = Rax | Rdi | Rsi | Rdx | Rcx | R8 | R9;
+static const unsigned int CallerSavedRegisters = Rax | Rcx | Rdx | Rsi | Rdi | R8 | R9 | R10 | R11;
+static const unsigned int ReturnRegisters = Rax | Rdx | Rsp | Rbx | Rbp | R12To15;
+#else
+// Arguments are on the stack, except for fastcall/thiscall/regparm
+static const unsigned int ArgumentRegisters = Rax | Rcx | Rdx;
+static const unsigned int CallerSavedRegisters = Rax | Rcx | Rdx;
+static const unsigned int ReturnRegisters = Rax | Rdx | Rsp | Rbx | Rbp | Rsi | Rdi;
+#endif
+
+bool RegisterLiveness::findLiveRegisters(const std::vector<void*>& addresses, std::vector<RegisterSet>& outLiveSets)
+{
+	outLiveSets = std::vector<RegisterSet>(addresses.size(), RegisterLiveness::getAllRegisters());
+
+	void* functionStart = nullptr;
+	void* functionEnd = nullptr;
+
+	if (addresses.empty() || !SymbolTable::findFunctionRange(addresses[0], &functionStart, &functionEnd))
+	{
+		return false;
+	}
+
+	std::vector<HackUtils::DecodedInstruction> instructions;
+
+	HackUtils::decode(functionStart, (int)((unsigned char*)functionEnd - (unsigned char*)functionStart), instructions);
+
+	if (instructions.empty())
+	{
+		return false;
+	}
+
+	auto findInstruction = [&](unsigned long long address) -> size_t
+	{
+		auto next = std::lower_bound(instructions.begin(), instructions.end(), address, [](const HackUtils::DecodedInstruction& instruction, unsigned long long address)
+		{
+			return (unsigned long long)instruction.address < address;
+		});
+
+		// Targets that land mid-instruction or outside the function have no index
+		return next == instructions.end() || (unsigned long long)next->address != address ? instructions.size() : (size_t)(next - instructions.begin());
+	};
+
+	std::vector<unsigned int> uses = std::vector<unsigned int>(instructions.size());
+	std::vector<unsigned int> defs = std::vector<unsigned int>(instructions.size());
+	std::vector<bool> isLeader = std::vector<bool>(instructions.size() + 1, false);
+	std::vector<bool> isBlockEnd = std::vector<bool>(instructions.size(), false);
+
+	isLeader[0] = true;
+
+	for (size_t index = 0; index < instructions.size(); index++)
+	{
+		if (RegisterLiveness::isMarker(instructions, index))
+		{
+			// HACKABLE_CODE markers restore everything they touch, so they are skipped rather than making their register look live
+			index += 4;
+			continue;
+		}
+
+		RegisterLiveness::getEffects(instructions, index, &uses[index], &defs[index]);
+
+		const HackUtils::DecodedInstruction& instruction = instructions[index];
+		bool isBranch = instruction.mnemonic >= UD_Ija && instruction.mnemonic <= UD_Ijz && instruction.mnemonic != UD_Ijmp;
+		bool isLoop = instruction.mnemonic == UD_Iloop || instruction.mnemonic == UD_Iloope || instruction.mnemonic == UD_Iloopne;
+
+		if (isBranch || isLoop || instruction.mnemonic == UD_Ijmp)
+		{
+			isBlockEnd[index] = true;
+			isLeader[index + 1] = true;
+
+			if (instruction.operandCount > 0 && instruction.operands[0].type == UD_OP_JIMM)
+			{
+				size_t target = findInstruction((unsigned long long)instruction.operands[0].value);
+
+				isLeader[target] = true;
+			}
+		}
+		else if (instruction.mnemonic == UD_Iret || instruction.mnemonic == UD_Iretf || instruction.mnemonic == UD_Iiretw
+			|| instruction.mnemonic == UD_Iiretd || instruction.mnemonic == UD_Iiretq || instruction.mnemonic == UD_Ihlt
+			|| instruction.mnemonic == UD_Iud2 || instruction.mnemonic == UD_Iinvalid)
+		{
+			isBlockEnd[index] = true;
+			isLeader[index + 1] = true;
+		}
+	}
+
+	// Split the function into blocks and link each block to the blocks it can continue into
+	std::vector<BasicBlock> blocks;
+	std::vector<size_t> blockOfInstruction = std::vector<size_t>(instructions.size());
+
+	for (size_t index = 0; index < instructions.size(); index++)
+	{
+		if (isLeader[index])
+		{
+			blocks.push_back(BasicBlock());
+			blocks.back().firstInstruction = index;
+		}
+
+		blocks.back().lastInstruction = index;
+		blockOfInstruction[index] = blocks.size() - 1;
+	}
+
+	for (auto& block : blocks)
+	{
+		const HackUtils::DecodedInstruction& last = instructions[block.lastInstruction];
+		bool fallsThrough = !isBlockEnd[block.lastInstruction] || (last.mnemonic != UD_Ijmp && last.mnemonic != UD_Iret
+			&& last.mnemonic != UD_Iretf && last.mnemonic != UD_Iiretw && last.mnemonic != UD_Iiretd && last.mnemonic != UD_Iiretq
+			&& last.mnemonic != UD_Ihlt && last.mnemonic != UD_Iud2 && last.mnemonic != UD_Iinvalid);
+
+		if (fallsThrough)
+		{
+			// Running off the end of the function is not something the analysis can follow
+			if (block.lastInstruction + 1 < instructions.size())
+			{
+				block.successors.push_back(blockOfInstruction[block.lastInstruction + 1]);
+			}
+			else
+			{
+				block.exitUses |= RegisterLiveness::AllRegisters | RegisterLiveness::FlagsBit;
+			}
+		}
+
+		if (last.mnemonic == UD_Iret || last.mnemonic == UD_Iretf)
+		{
+			block.exitUses |= ReturnRegisters;
+		}
+		else if (last.mnemonic == UD_Iiretw || last.mnemonic == UD_Iiretd || last.mnemonic == UD_Iiretq || last.mnemonic == UD_Iinvalid)
+		{
+			block.exitUses |= RegisterLiveness::AllRegisters | RegisterLiveness::FlagsBit;
+		}
+		else if (isBlockEnd[block.lastInstruction] && last.mnemonic != UD_Ihlt && last.mnemonic != UD_Iud2)
+		{
+			size_t target = last.operandCount > 0 && last.operands[0].type == UD_OP_JIMM ? findInstruction((unsigned long long)last.operands[0].value) : instructions.size();
+
+			// Indirect jumps and jumps out of the function (tail calls) may go anywhere
+			if (target < instructions.size())
+			{
+				block.successors.push_back(blockOfInstruction[target]);
+			}
+			else
+			{
+				block.exitUses |= RegisterLiveness::AllRegisters | RegisterLiveness::FlagsBit;
+			}
+		}
+	}
+
+	auto transfer = [&](size_t firstInstruction, size_t lastInstruction, unsigned int live)
+	{
+		for (size_t index = lastInstruction + 1; index-- > firstInstruction;)
+		{
+			live = (live & ~defs[index]) | uses[index];
+		}
+
+		return live;
+	};
+
+	// Backward dataflow to a fixed point. Visiting blocks last to first converges in a few passes for typical code.
+	for (bool changed = true; changed;)
+	{
+		changed = false;
+
+		for (size_t blockIndex = blocks.size(); blockIndex-- > 0;)
+		{
+			BasicBlock& block = blocks[blockIndex];
+			unsigned int liveOut = block.exitUses;
+
+			for (auto successor : block.successors)
+			{
+				liveOut |= blocks[successor].liveIn;
+			}
+
+			unsigned int liveIn = transfer(block.firstInstruction, block.lastInstruction, liveOut);
+
+			changed |= liveIn != block.liveIn || liveOut != block.liveOut;
+			block.liveIn = liveIn;
+			block.liveOut = liveOut;
+		}
+	}
+
+	bool foundAll = true;
+
+	for (size_t addressIndex = 0; addressIndex < addresses.size(); addressIndex++)
+	{
+		size_t index = findInstruction((unsigned long long)addresses[addressIndex]);
+
+		if (index >= instructions.size())
+		{
+			foundAll = false;
+			continue;
+		}
+
+		const BasicBlock& block = blocks[blockOfInstruction[index]];
+		unsigned int live = transfer(index, block.lastInstruction, block.liveOut);
+
+		outLiveSets[addressIndex] = RegisterSet(live & RegisterLiveness::AllRegisters, (live & RegisterLiveness::FlagsBit) != 0);
+	}
+
+	return foundAll;
+}
+
+RegisterLiveness::RegisterSet RegisterLiveness::getWrittenRegisters(void* address, int length)
+{
+	std::vector<HackUtils::DecodedInstruction> instructions;
+
+	// Each saved register remembers whether it had already been written when it was pushed
+	std::vector<std::pair<unsigned int, bool>> savedRegisters;
+	unsigned int written = 0;
+
+	HackUtils::decode(address, length, instructions);
+
+	for (size_t index = 0; index < instructions.size(); index++)
+	{
+		const HackUtils::DecodedInstruction& instruction = instructions[index];
+		bool isPartial = false;
+		int registerId = instruction.operandCount > 0 && instruction.operands[0].type == UD_OP_REG ? RegisterLiveness::getRegisterId(instruction.operands[0].base, &isPartial) : -1;
+		unsigned int registerBit = registerId >= 0 && !isPartial ? (1u << registerId) : 0;
+		unsigned int uses = 0;
+		unsigned int defs = 0;
+
+		RegisterLiveness::getEffects(instructions, index, &uses, &defs);
+
+		if (instruction.mnemonic == UD_Ipush || instruction.mnemonic == UD_Ipushfw || instruction.mnemonic == UD_Ipushfd || instruction.mnemonic == UD_Ipushfq)
+		{
+			unsigned int savedBit = instruction.mnemonic == UD_Ipush ? registerBit : RegisterLiveness::FlagsBit;
+
+			savedRegisters.push_back(std::make_pair(savedBit, (written & savedBit) != 0));
+			continue;
+		}
+
+		if (instruction.mnemonic == UD_Ipop || instruction.mnemonic == UD_Ipopfw || instruction.mnemonic == UD_Ipopfd || instruction.mnemonic == UD_Ipopfq)
+		{
+			unsigned int restoredBit = instruction.mnemonic == UD_Ipop ? registerBit : RegisterLiveness::FlagsBit;
+
+			if (!savedRegisters.empty() && restoredBit != 0 && savedRegisters.back().first == restoredBit)
+			{
+				written = savedRegisters.back().second ? (written | restoredBit) : (written & ~restoredBit);
+				savedRegisters.pop_back();
+				continue;
+			}
+
+			if (!savedRegisters.empty())
+			{
+				savedRegisters.pop_back();
+			}
+		}
+
+		written |= defs;
+	}
+
+	// The stack pointer is expected to come back balanced, so it is never reported
+	return RegisterSet(written & RegisterLiveness::AllRegisters & ~Rsp, (written & RegisterLiveness::FlagsBit) != 0);
+}
+
+RegisterLiveness::RegisterSet RegisterLiveness::getAllRegisters()
+{
+	return RegisterSet(RegisterLiveness::AllRegisters, true);
+}
+
+RegisterLiveness::RegisterSet RegisterLiveness::getFreeRegisters(const RegisterSet& liveRegisters)
+{
+	// The stack pointer is never free, whatever the analysis says
+	return RegisterSet(~liveRegisters.registers & RegisterLiveness::AllRegisters & ~Rsp, !liveRegisters.flags);
+}
+
+std::string RegisterLiveness::getRegisterNames(const RegisterSet& registers)
+{
+	static const char* registerNames64[] = { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" };
+	static const char* registerNames32[] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi" };
+	std::string names = "";
+
+	for (int registerId = 0; registerId < 16; registerId++)
+	{
+		if ((registers.registers & RegisterLiveness::AllRegisters) & (1u << registerId))
+		{
+			names += names.empty() ? "" : ", ";
+			names += sizeof(void*) == 8 ? registerNames64[registerId] : registerNames32[registerId];
+		}
+	}
+
+	if (registers.flags)
+	{
+		names += names.empty() ? "flags" : ", flags";
+	}
+
+	return names;
+}
+
+void RegisterLiveness::getEffects(const std::vector<HackUtils::DecodedInstruction>& instructions, size_t index, unsigned int* uses, unsigned int* defs)
+{
+	enum class AccessMode
+	{
+		ReadWrite,
+		WriteOnly,
+		ReadOnly,
+	};
+
+	enum class FlagsMode
+	{
+		None,
+		Read,
+		Write,
+		ReadWrite,
+	};
+
+	const HackUtils::DecodedInstruction& instruction = instructions[index];
+	unsigned int operandUses = 0;
+	unsigned int destination = 0;
+	unsigned int source = 0;
+	bool isDestinationPartial = false;
+	bool isSourcePartial = false;
+	bool hasCountRegister = false;
+
+	for (int operandIndex = 0; operandIndex < instruction.operandCount; operandIndex++)
+	{
+		const HackUtils::DecodedOperand& operand = instruction.operands[operandIndex];
+		bool isPartial = false;
+
+		if (operand.type == UD_OP_MEM)
+		{
+			int baseId = RegisterLiveness::getRegisterId(operand.base, &isPartial);
+			int indexId = RegisterLiveness::getRegisterId(operand.index, &isPartial);
+
+			operandUses |= (baseId >= 0 ? (1u << baseId) : 0) | (indexId >= 0 ? (1u << indexId) : 0);
+		}
+		else if (operand.type == UD_OP_REG)
+		{
+			int registerId = RegisterLiveness::getRegisterId(operand.base, &isPartial);
+			unsigned int registerBit = registerId >= 0 ? (1u << registerId) : 0;
+
+			if (operandIndex == 0)
+			{
+				destination = registerBit;
+				isDestinationPartial = isPartial;
+			}
+			else
+			{
+				operandUses |= registerBit;
+				source = operandIndex == 1 ? registerBit : source;
+				isSourcePartial = operandIndex == 1 ? isPartial : isSourcePartial;
+				hasCountRegister |= operand.base == UD_R_CL;
+			}
+		}
+	}
+
+	AccessMode accessMode = AccessMode::ReadWrite;
+	FlagsMode flagsMode = FlagsMode::None;
+	unsigned int implicitUses = 0;
+	unsigned int implicitDefs = 0;
+
+	switch (instruction.mnemonic)
+	{
+		case UD_Imov: case UD_Imovzx: case UD_Imovsx: case UD_Imovsxd: case UD_Ilea: case UD_Imovd: case UD_Imovq:
+		case UD_Icvttss2si: case UD_Icvtss2si: case UD_Icvttsd2si: case UD_Icvtsd2si: case UD_Imovmskps: case UD_Imovmskpd:
+		case UD_Ipmovmskb: case UD_Ipextrw: case UD_Ipextrb: case UD_Ipextrd: case UD_Ipextrq:
+		case UD_Iseta: case UD_Isetae: case UD_Isetb: case UD_Isetbe: case UD_Isetg: case UD_Isetge: case UD_Isetl: case UD_Isetle:
+		case UD_Isetno: case UD_Isetnp: case UD_Isetns: case UD_Isetnz: case UD_Iseto: case UD_Isetp: case UD_Isets: case UD_Isetz:
+		{
+			accessMode = AccessMode::WriteOnly;
+			flagsMode = instruction.mnemonic >= UD_Iseta && instruction.mnemonic <= UD_Isetz ? FlagsMode::Read : FlagsMode::None;
+			break;
+		}
+		case UD_Ipop:
+		{
+			accessMode = AccessMode::WriteOnly;
+			implicitUses = Rsp;
+			implicitDefs = Rsp;
+			break;
+		}
+		case UD_Ipush:
+		{
+			accessMode = AccessMode::ReadOnly;
+			implicitUses = Rsp;
+			implicitDefs = Rsp;
+			break;
+		}
+		case UD_Icmp: case UD_Itest: case UD_Ibt: case UD_Icomiss: case UD_Icomisd: case UD_Iucomiss: case UD_Iucomisd:
+		{
+			accessMode = AccessMode::ReadOnly;
+			flagsMode = FlagsMode::Write;
+			break;
+		}
+		case UD_Ixor: case UD_Isub:
+		{
+			// xor/sub of a register with itself is a zeroing idiom that does not depend on the old value
+			bool isZeroing = destination != 0 && destination == source && !isDestinationPartial && !isSourcePartial;
+
+			accessMode = isZeroing ? AccessMode::WriteOnly : AccessMode::ReadWrite;
+			operandUses = isZeroing ? (operandUses & ~source) : operandUses;
+			flagsMode = FlagsMode::Write;
+			break;
+		}
+		case UD_Iadd: case UD_Iand: case UD_Ior: case UD_Ineg: case UD_Ibts: case UD_Ibtr: case UD_Ibtc: case UD_Ibsf: case UD_Ibsr: case UD_Ipopcnt:
+		case UD_Ifcomi: case UD_Ifcomip: case UD_Ifucomi: case UD_Ifucomip: case UD_Idaa: case UD_Idas: case UD_Iaaa: case UD_Iaas: case UD_Iaam: case UD_Iaad:
+		{
+			flagsMode = FlagsMode::Write;
+			break;
+		}
+		case UD_Ishl: case UD_Ishr: case UD_Isar: case UD_Ishld: case UD_Ishrd:
+		{
+			// A shift by cl may shift by zero, which leaves the flags alone
+			flagsMode = hasCountRegister ? FlagsMode::ReadWrite : FlagsMode::Write;
+			break;
+		}
+		case UD_Iinc: case UD_Idec: case UD_Irol: case UD_Iror: case UD_Iclc: case UD_Istc: case UD_Icmc: case UD_Isahf: case UD_Icld: case UD_Istd:
+		{
+			// These only update some of the flags
+			flagsMode = FlagsMode::ReadWrite;
+			implicitUses = instruction.mnemonic == UD_Isahf ? Rax : 0;
+			break;
+		}
+		case UD_Iadc: case UD_Isbb: case UD_Ircl: case UD_Ircr:
+		{
+			flagsMode = FlagsMode::ReadWrite;
+			break;
+		}
+		case UD_Icmova: case UD_Icmovae: case UD_Icmovb: case UD_Icmovbe: case UD_Icmovg: case UD_Icmovge: case UD_Icmovl: case UD_Icmovle:
+		case UD_Icmovno: case UD_Icmovnp: case UD_Icmovns: case UD_Icmovnz: case UD_Icmovo: case UD_Icmovp: case UD_Icmovs: case UD_Icmovz:
+		case UD_Ifcmovb: case UD_Ifcmove: case UD_Ifcmovbe: case UD_Ifcmovu: case UD_Ifcmovnb: case UD_Ifcmovne: case UD_Ifcmovnbe: case UD_Ifcmovnu:
+		case UD_Iinto: case UD_Isalc:
+		{
+			flagsMode = FlagsMode::Read;
+			break;
+		}
+		case UD_Ija: case UD_Ijae: case UD_Ijb: case UD_Ijbe: case UD_Ijg: case UD_Ijge: case UD_Ijl: case UD_Ijle:
+		case UD_Ijno: case UD_Ijnp: case UD_Ijns: case UD_Ijnz: case UD_Ijo: case UD_Ijp: case UD_Ijs: case UD_Ijz:
+		{
+			accessMode = AccessMode::ReadOnly;
+			flagsMode = FlagsMode::Read;
+			break;
+		}
+		case UD_Ijmp:
+		{
+			accessMode = AccessMode::ReadOnly;
+			break;
+		}
+		case UD_Ijcxz: case UD_Ijecxz: case UD_Ijrcxz:
+		{
+			accessMode = AccessMode::ReadOnly;
+			implicitUses = Rcx;
+			break;
+		}
+		case UD_Iloop: case UD_Iloope: case UD_Iloopne:
+		{
+			accessMode = AccessMode::ReadOnly;
+			flagsMode = instruction.mnemonic == UD_Iloop ? FlagsMode::None : FlagsMode::Read;
+			implicitUses = Rcx;
+			implicitDefs = Rcx;
+			break;
+		}
+		case UD_Icall:
+		{
+			accessMode = AccessMode::ReadOnly;
+			flagsMode = FlagsMode::Write;
+			implicitUses = ArgumentRegisters | Rsp;
+			implicitDefs = CallerSavedRegisters | Rsp;
+			break;
+		}
+		case UD_Iret: case UD_Iretf:
+		{
+			accessMode = AccessMode::ReadOnly;
+			implicitUses = Rsp;
+			implicitDefs = Rsp;
+			break;
+		}
+		case UD_Ileave:
+		{
+			implicitUses = Rbp;
+			implicitDefs = Rsp | Rbp;
+			break;
+		}
+		case UD_Ienter:
+		{
+			accessMode = AccessMode::ReadOnly;
+			implicitUses = Rsp | Rbp;
+			implicitDefs = Rsp | Rbp;
+			break;
+		}
+		case UD_Ipushfw: case UD_Ipushfd: case UD_Ipushfq:
+		{
+			flagsMode = FlagsMode::Read;
+			implicitUses = Rsp;
+			implicitDefs = Rsp;
+			break;
+		}
+		case UD_Ipopfw: case UD_Ipopfd: case UD_Ipopfq:
+		{
+			flagsMode = FlagsMode::Write;
+			implicitUses = Rsp;
+			implicitDefs = Rsp;
+			break;
+		}
+		case UD_Ipusha: case UD_Ipushad:
+		{
+			implicitUses = RegisterLiveness::AllRegisters;
+			implicitDefs = Rsp;
+			break;
+		}
+		case UD_Ipopa: case UD_Ipopad:
+		{
+			implicitUses = Rsp;
+			implicitDefs = RegisterLiveness::AllRegisters;
+			break;
+		}
+		case UD_Ilahf:
+		{
+			flagsMode = FlagsMode::Read;
+			implicitUses = Rax;
+			implicitDefs = Rax;
+			break;
+		}
+		case UD_Imul: case UD_Idiv: case UD_Iidiv:
+		{
+			accessMode = AccessMode::ReadOnly;
+			flagsMode = FlagsMode::Write;
+			implicitUses = instruction.mnemonic == UD_Imul ? Rax : (Rax | Rdx);
+			implicitDefs = Rax | Rdx;
+			break;
+		}
+		case UD_Iimul:
+		{
+			// The one operand form is rdx:rax = rax * src, the three operand form writes dst without reading it
+			accessMode = instruction.operandCount == 1 ? AccessMode::ReadOnly : (instruction.operandCount == 3 ? AccessMode::WriteOnly : AccessMode::ReadWrite);
+			flagsMode = FlagsMode::Write;
+			implicitUses = instruction.operandCount == 1 ? Rax : 0;
+			implicitDefs = instruction.operandCount == 1 ? (Rax | Rdx) : 0;
+			break;
+		}
+		case UD_Icbw: case UD_Icwde: case UD_Icdqe:
+		{
+			implicitUses = Rax;
+			implicitDefs = Rax;
+			break;
+		}
+		case UD_Icwd: case UD_Icdq: case UD_Icqo:
+		{
+			implicitUses = Rax;
+			implicitDefs = Rdx;
+			break;
+		}
+		case UD_Ixchg: case UD_Ixadd:
+		{
+			implicitDefs = isSourcePartial ? 0 : source;
+			flagsMode = instruction.mnemonic == UD_Ixadd ? FlagsMode::Write : FlagsMode::None;
+			break;
+		}
+		case UD_Icmpxchg: case UD_Icmpxchg8b: case UD_Icmpxchg16b:
+		{
+			flagsMode = FlagsMode::Write;
+			implicitUses = instruction.mnemonic == UD_Icmpxchg ? Rax : (Rax | Rbx | Rcx | Rdx);
+			implicitDefs = instruction.mnemonic == UD_Icmpxchg ? Rax : (Rax | Rdx);
+			break;
+		}
+		case UD_Imovsb: case UD_Imovsw: case UD_Imovsd: case UD_Imovsq: case UD_Istosb: case UD_Istosw: case UD_Istosd: case UD_Istosq:
+		case UD_Ilodsb: case UD_Ilodsw: case UD_Ilodsd: case UD_Ilodsq: case UD_Iscasb: case UD_Iscasw: case UD_Iscasd: case UD_Iscasq:
+		case UD_Icmpsb: case UD_Icmpsw: case UD_Icmpsd: case UD_Icmpsq: case UD_Iinsb: case UD_Iinsw: case UD_Iinsd: case UD_Ioutsb: case UD_Ioutsw: case UD_Ioutsd:
+		{
+			// movsd/cmpsd with operands are the SSE instructions, not string operations
+			if (instruction.operandCount > 0)
+			{
+				break;
+			}
+
+			// Whether there is a rep prefix is not decoded, so the count and pointers are treated as read and updated
+			bool isComparison = (instruction.mnemonic >= UD_Iscasb && instruction.mnemonic <= UD_Iscasw) || (instruction.mnemonic >= UD_Icmpsb && instruction.mnemonic <= UD_Icmpsw);
+
+			flagsMode = isComparison ? FlagsMode::ReadWrite : FlagsMode::Read;
+			implicitUses = Rsi | Rdi | Rcx | Rax | Rdx;
+			implicitDefs = Rsi | Rdi | Rcx | Rax;
+			break;
+		}
+		case UD_Ixlatb:
+		{
+			implicitUses = Rax | Rbx;
+			implicitDefs = Rax;
+			break;
+		}
+		case UD_Icpuid:
+		{
+			implicitUses = Rax | Rcx;
+			implicitDefs = Rax | Rbx | Rcx | Rdx;
+			break;
+		}
+		case UD_Irdtsc: case UD_Irdtscp: case UD_Ixgetbv:
+		{
+			implicitUses = instruction.mnemonic == UD_Ixgetbv ? Rcx : 0;
+			implicitDefs = instruction.mnemonic == UD_Irdtscp ? (Rax | Rdx | Rcx) : (Rax | Rdx);
+			break;
+		}
+		case UD_Isyscall:
+		{
+			implicitUses = Rax | Rdi | Rsi | Rdx | R10 | R8 | R9;
+			implicitDefs = Rax | Rcx | R11;
+			break;
+		}
+		case UD_Iint: case UD_Isysenter:
+		{
+			// System calls through interrupts take their arguments from any register
+			accessMode = AccessMode::ReadOnly;
+			implicitUses = RegisterLiveness::AllRegisters;
+			implicitDefs = Rax;
+			break;
+		}
+		case UD_Inop: case UD_Ipause: case UD_Iint3: case UD_Ihlt: case UD_Iud2:
+		{
+			accessMode = AccessMode::ReadOnly;
+			break;
+		}
+		case UD_Iinvalid:
+		{
+			implicitUses = RegisterLiveness::AllRegisters;
+			flagsMode = FlagsMode::Read;
+			break;
+		}
+		default:
+		{
+			// Anything else is assumed to read and write its first operand, which can only make registers look more live
+			break;
+		}
+	}
+
+	bool readsDestination = accessMode != AccessMode::WriteOnly || isDestinationPartial;
+
+	*uses = operandUses | implicitUses | (readsDestination ? destination : 0) | (flagsMode == FlagsMode::Read || flagsMode == FlagsMode::ReadWrite ? RegisterLiveness::FlagsBit : 0);
+	*defs = (accessMode != AccessMode::ReadOnly ? destination : 0) | implicitDefs | (flagsMode == FlagsMode::Write || flagsMode == FlagsMode::ReadWrite ? RegisterLiveness::FlagsBit : 0);
+}
+
+bool RegisterLiveness::isMarker(const std::vector<HackUtils::DecodedInstruction>& instructions, size_t index)
+{
+	// push reg; push imm; mov reg32, imm; pop reg; pop reg, the shape of every HACKABLE_CODE marker
+	if (index + 5 > instructions.size())
+	{
+		return false;
+	}
+
+	const HackUtils::DecodedInstruction* marker = &instructions[index];
+	bool isPartial = false;
+	int registerId = marker[0].operands[0].type == UD_OP_REG ? RegisterLiveness::getRegisterId(marker[0].operands[0].base, &isPartial) : -1;
+
+	auto isRegister = [&](const HackUtils::DecodedInstruction& instruction)
+	{
+		return instruction.operands[0].type == UD_OP_REG && RegisterLiveness::getRegisterId(instruction.operands[0].base, &isPartial) == registerId;
+	};
+
+	return registerId >= 0 && marker[0].mnemonic == UD_Ipush && marker[1].mnemonic == UD_Ipush && marker[1].operands[0].type == UD_OP_IMM
+		&& marker[2].mnemonic == UD_Imov && isRegister(marker[2]) && marker[2].operands[1].type == UD_OP_IMM
+		&& marker[3].mnemonic == UD_Ipop && isRegister(marker[3]) && marker[4].mnemonic == UD_Ipop && isRegister(marker[4]);
+}
+
+int RegisterLiveness::getRegisterId(unsigned short udRegister, bool* isPartial)
+{
+	if (udRegister >= UD_R_AL && udRegister <= UD_R_R15B)
+	{
+		*isPartial = true;
+
+		// al, cl, dl, bl, then ah..bh and spl..dil both map back onto rax..rdi
+		int index = udRegister - UD_R_AL;
+
+		return index < 4 ? index : index - 4;
+	}
+
+	if (udRegister >= UD_R_AX && udRegister <= UD_R_R15W)
+	{
+		*isPartial = true;
+		return udRegister - UD_R_AX;
+	}
+
+	// 32-bit writes zero the upper half in 64-bit mode, so they replace the whole register
+	if (udRegister >= UD_R_EAX && udRegister <= UD_R_R15D)
+	{
+		*isPartial = false;
+		return udRegister - UD_R_EAX;
+	}
+
+	if (udRegister >= UD_R_RAX && udRegister <= UD_R_R15)
+	{
+		*isPartial = false;
+		return udRegister - UD_R_RAX;
+	}
+
+	return -1;
+}
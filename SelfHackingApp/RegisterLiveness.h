@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "HackUtils.h"
+
+// Backward register liveness over a basic block CFG of the function containing some code, built from udis86 decodes.
+// Anything the analysis can't see through (indirect jumps, jumps out of the function, unknown function bounds) is treated as
+// keeping every register live, so a register is only ever reported dead when it is safe to overwrite.
+class RegisterLiveness
+{
+public:
+	struct RegisterSet
+	{
+		// One bit per general purpose register in encoding order (rax = 0, rcx = 1, ... r15 = 15)
+		unsigned int registers;
+		bool flags;
+
+		RegisterSet() : registers(0), flags(false) { }
+		RegisterSet(unsigned int registers, bool flags) : registers(registers), flags(flags) { }
+	};
+
+	// Finds what is live immediately before each address. All addresses must be in the same function. Returns false, with every
+	// register live, if the function bounds are unknown or an address is not on an instruction boundary.
+	static bool findLiveRegisters(const std::vector<void*>& addresses, std::vector<RegisterSet>& outLiveSets);
+
+	// Registers and flags the code may leave changed, not counting registers it saves with push and restores with pop
+	static RegisterSet getWrittenRegisters(void* address, int length);
+
+	static RegisterSet getAllRegisters();
+	static RegisterSet getFreeRegisters(const RegisterSet& liveRegisters);
+	static std::string getRegisterNames(const RegisterSet& registers);
+
+private:
+	struct BasicBlock
+	{
+		size_t firstInstruction;
+		size_t lastInstruction;
+		std::vector<size_t> successors;
+		unsigned int exitUses;
+		unsigned int liveIn;
+		unsigned int liveOut;
+
+		BasicBlock() : firstInstruction(0), lastInstruction(0), successors(), exitUses(0), liveIn(0), liveOut(0) { }
+	};
+
+	static void getEffects(const std::vector<HackUtils::DecodedInstruction>& instructions, size_t index, unsigned int* uses, unsigned int* defs);
+	static bool isMarker(const std::vector<HackUtils::DecodedInstruction>& instructions, size_t index);
+	static int getRegisterId(unsigned short udRegister, bool* isPartial);
+
+	static const unsigned int FlagsBit;
+	static const unsigned int AllRegisters;
+};
@@ -0,0 +1,400 @@
+#include "SymbolTable.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#include <cxxabi.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+std::vector<SymbolTable::SymbolEntry> SymbolTable::Entries = std::vector<SymbolTable::SymbolEntry>();
+std::string SymbolTable::NameStorage = std::string();
+size_t SymbolTable::SymbolCount = 0;
+std::vector<SymbolTable::FunctionSymbol> SymbolTable::FunctionLayout = std::vector<SymbolTable::FunctionSymbol>();
+std::string SymbolTable::FunctionNames = std::string();
+std::once_flag SymbolTable::ModuleSymbolsLoaded;
+std::mutex SymbolTable::TableMutex;
+
+void SymbolTable::registerSymbol(std::string name, void* address)
+{
+	std::call_once(SymbolTable::ModuleSymbolsLoaded, SymbolTable::loadModuleSymbols);
+	std::lock_guard<std::mutex> lock(SymbolTable::TableMutex);
+
+	// User-registered symbols take priority over anything found in the modules
+	SymbolTable::insertSymbol(name.c_str(), name.size(), address, true);
+}
+
+void* SymbolTable::resolveSymbol(const char* name, size_t length)
+{
+	std::call_once(SymbolTable::ModuleSymbolsLoaded, SymbolTable::loadModuleSymbols);
+	std::lock_guard<std::mutex> lock(SymbolTable::TableMutex);
+
+	SymbolEntry* entry = SymbolTable::findEntry(name, length, SymbolTable::hashName(name, length));
+
+	return entry == nullptr ? nullptr : entry->address;
+}
+
+void* SymbolTable::resolveSymbol(std::string name)
+{
+	return SymbolTable::resolveSymbol(name.c_str(), name.size());
+}
+
+const char* SymbolTable::findFunction(void* address, long long* offset)
+{
+	const FunctionSymbol* function = SymbolTable::findFunctionSymbol(address);
+
+	if (function == nullptr)
+	{
+		return nullptr;
+	}
+
+	*offset = (long long)((unsigned long long)address - function->start);
+
+	return SymbolTable::FunctionNames.c_str() + function->nameOffset;
+}
+
+bool SymbolTable::findFunctionRange(void* address, void** outStart, void** outEnd)
+{
+	const FunctionSymbol* function = SymbolTable::findFunctionSymbol(address);
+
+	// Symbols without a size only name their first byte, so they give no usable range
+	if (function == nullptr || function->size == 0)
+	{
+		return false;
+	}
+
+	*outStart = (void*)(uintptr_t)function->start;
+	*outEnd = (void*)(uintptr_t)(function->start + function->size);
+
+	return true;
+}
+
+void SymbolTable::getFunctionRanges(void* rangeStart, void* rangeEnd, std::vector<std::pair<void*, void*>>& outRanges)
+{
+	std::call_once(SymbolTable::ModuleSymbolsLoaded, SymbolTable::loadModuleSymbols);
+
+	outRanges.clear();
+
+	for (size_t index = 1; index < SymbolTable::FunctionLayout.size(); index++)
+	{
+		const FunctionSymbol& function = SymbolTable::FunctionLayout[index];
+
+		if (function.size != 0 && function.start >= (unsigned long long)rangeStart && function.start + function.size <= (unsigned long long)rangeEnd)
+		{
+			outRanges.push_back(std::make_pair((void*)(uintptr_t)function.start, (void*)(uintptr_t)(function.start + function.size)));
+		}
+	}
+
+	// The layout is in search order rather than address order
+	std::sort(outRanges.begin(), outRanges.end());
+}
+
+const SymbolTable::FunctionSymbol* SymbolTable::findFunctionSymbol(void* address)
+{
+	std::call_once(SymbolTable::ModuleSymbolsLoaded, SymbolTable::loadModuleSymbols);
+
+	// The layout is only written while loading, so lookups need no lock
+	const FunctionSymbol* layout = SymbolTable::FunctionLayout.data();
+	size_t count = SymbolTable::FunctionLayout.size();
+	unsigned long long target = (unsigned long long)address;
+	size_t best = 0;
+
+	// Eytzinger order (1-based, children of k at 2k and 2k+1) keeps the top levels of the search in the same few cache lines.
+	// Every step right is to a larger start, so the last one taken is the closest function starting at or before the target.
+	for (size_t index = 1; index < count;)
+	{
+		bool isAtOrBefore = layout[index].start <= target;
+
+		best = isAtOrBefore ? index : best;
+		index = index * 2 + (isAtOrBefore ? 1 : 0);
+	}
+
+	if (best == 0 || (target - layout[best].start >= layout[best].size && target != layout[best].start))
+	{
+		return nullptr;
+	}
+
+	return &layout[best];
+}
+
+void SymbolTable::insertSymbol(const char* name, size_t length, void* address, bool replaceExisting)
+{
+	if (length == 0 || address == nullptr)
+	{
+		return;
+	}
+
+	// Keep the load factor at or below 1/2 so probe sequences stay short
+	if ((SymbolTable::SymbolCount + 1) * 2 > SymbolTable::Entries.size())
+	{
+		SymbolTable::growTable();
+	}
+
+	unsigned int hash = SymbolTable::hashName(name, length);
+	SymbolEntry* entry = SymbolTable::findEntry(name, length, hash);
+
+	if (entry != nullptr)
+	{
+		entry->address = replaceExisting ? address : entry->address;
+		return;
+	}
+
+	size_t mask = SymbolTable::Entries.size() - 1;
+
+	for (size_t index = hash & mask; ; index = (index + 1) & mask)
+	{
+		if (SymbolTable::Entries[index].nameLength == 0)
+		{
+			SymbolTable::Entries[index] = SymbolEntry(hash, (unsigned int)SymbolTable::NameStorage.size(), (unsigned int)length, address);
+			SymbolTable::NameStorage.append(name, length);
+			SymbolTable::SymbolCount++;
+			return;
+		}
+	}
+}
+
+void SymbolTable::growTable()
+{
+	std::vector<SymbolEntry> previousEntries = SymbolTable::Entries;
+	size_t capacity = previousEntries.empty() ? 1024 : previousEntries.size() * 2;
+	size_t mask = capacity - 1;
+
+	SymbolTable::Entries = std::vector<SymbolEntry>(capacity);
+
+	// Names are stored by offset, so re-hashing only moves the slots
+	for (auto entry : previousEntries)
+	{
+		if (entry.nameLength == 0)
+		{
+			continue;
+		}
+
+		size_t index = entry.hash & mask;
+
+		while (SymbolTable::Entries[index].nameLength != 0)
+		{
+			index = (index + 1) & mask;
+		}
+
+		SymbolTable::Entries[index] = entry;
+	}
+}
+
+SymbolTable::SymbolEntry* SymbolTable::findEntry(const char* name, size_t length, unsigned int hash)
+{
+	if (SymbolTable::Entries.empty())
+	{
+		return nullptr;
+	}
+
+	size_t mask = SymbolTable::Entries.size() - 1;
+
+	for (size_t index = hash & mask; SymbolTable::Entries[index].nameLength != 0; index = (index + 1) & mask)
+	{
+		SymbolEntry& entry = SymbolTable::Entries[index];
+
+		if (entry.hash == hash && entry.nameLength == length && memcmp(SymbolTable::NameStorage.data() + entry.nameOffset, name, length) == 0)
+		{
+			return &entry;
+		}
+	}
+
+	return nullptr;
+}
+
+void SymbolTable::addFunction(const char* name, size_t length, void* address, unsigned long long size, bool isPlainName)
+{
+	// Names are null terminated here, since udis86 takes them as plain C strings
+	SymbolTable::FunctionLayout.push_back(FunctionSymbol((unsigned long long)address, size, (unsigned int)SymbolTable::FunctionNames.size(), isPlainName));
+	SymbolTable::FunctionNames.append(name, length);
+	SymbolTable::FunctionNames.push_back('\0');
+}
+
+void SymbolTable::buildFunctionLayout()
+{
+	std::vector<FunctionSymbol> sortedFunctions = SymbolTable::FunctionLayout;
+
+	// Aliases share an address, so keep one per address, preferring the plain name that the assembler also accepts
+	std::sort(sortedFunctions.begin(), sortedFunctions.end(), [](const FunctionSymbol& left, const FunctionSymbol& right)
+	{
+		return left.start != right.start ? left.start < right.start : left.isPlainName > right.isPlainName;
+	});
+
+	sortedFunctions.erase(std::unique(sortedFunctions.begin(), sortedFunctions.end(), [](const FunctionSymbol& left, const FunctionSymbol& right)
+	{
+		return left.start == right.start;
+	}), sortedFunctions.end());
+
+	// Slot 0 is unused so that the children of slot k are always 2k and 2k+1
+	SymbolTable::FunctionLayout = std::vector<FunctionSymbol>(sortedFunctions.size() + 1);
+	SymbolTable::fillFunctionLayout(sortedFunctions, 0, 1);
+}
+
+size_t SymbolTable::fillFunctionLayout(const std::vector<FunctionSymbol>& sortedFunctions, size_t sortedIndex, size_t layoutIndex)
+{
+	// An in-order walk of the implicit tree visits the slots in sorted order
+	if (layoutIndex < SymbolTable::FunctionLayout.size())
+	{
+		sortedIndex = SymbolTable::fillFunctionLayout(sortedFunctions, sortedIndex, layoutIndex * 2);
+		SymbolTable::FunctionLayout[layoutIndex] = sortedFunctions[sortedIndex++];
+		sortedIndex = SymbolTable::fillFunctionLayout(sortedFunctions, sortedIndex, layoutIndex * 2 + 1);
+	}
+
+	return sortedIndex;
+}
+
+unsigned int SymbolTable::hashName(const char* name, size_t length)
+{
+	// FNV-1a
+	unsigned int hash = 2166136261u;
+
+	for (size_t index = 0; index < length; index++)
+	{
+		hash = (hash ^ (unsigned char)name[index]) * 16777619u;
+	}
+
+	return hash;
+}
+
+#ifdef __linux__
+template<typename ElfHeader, typename SectionHeader, typename Symbol, unsigned char (*SymbolType)(unsigned char)>
+static void loadElfSymbols(const unsigned char* image, size_t imageSize, unsigned long long loadBias,
+	void (*insert)(const char*, size_t, void*, bool), void (*addFunction)(const char*, size_t, void*, unsigned long long, bool))
+{
+	const ElfHeader* header = (const ElfHeader*)image;
+
+	if (header->e_shoff == 0 || header->e_shoff + (unsigned long long)header->e_shnum * sizeof(SectionHeader) > imageSize)
+	{
+		return;
+	}
+
+	const SectionHeader* sections = (const SectionHeader*)(image + header->e_shoff);
+
+	for (int sectionIndex = 0; sectionIndex < header->e_shnum; sectionIndex++)
+	{
+		const SectionHeader& section = sections[sectionIndex];
+
+		if ((section.sh_type != SHT_SYMTAB && section.sh_type != SHT_DYNSYM) || section.sh_link >= header->e_shnum)
+		{
+			continue;
+		}
+
+		const SectionHeader& stringSection = sections[section.sh_link];
+
+		if (section.sh_offset + section.sh_size > imageSize || stringSection.sh_offset + stringSection.sh_size > imageSize)
+		{
+			continue;
+		}
+
+		const Symbol* symbols = (const Symbol*)(image + section.sh_offset);
+		const char* strings = (const char*)(image + stringSection.sh_offset);
+		size_t symbolCount = section.sh_size / sizeof(Symbol);
+
+		for (size_t symbolIndex = 0; symbolIndex < symbolCount; symbolIndex++)
+		{
+			const Symbol& symbol = symbols[symbolIndex];
+			unsigned char type = SymbolType(symbol.st_info);
+
+			if ((type != STT_FUNC && type != STT_OBJECT) || symbol.st_shndx == SHN_UNDEF || symbol.st_value == 0 || symbol.st_name >= stringSection.sh_size)
+			{
+				continue;
+			}
+
+			const char* name = strings + symbol.st_name;
+			void* address = (void*)(uintptr_t)(loadBias + symbol.st_value);
+
+			insert(name, strlen(name), address, false);
+
+			if (type == STT_FUNC)
+			{
+				addFunction(name, strlen(name), address, symbol.st_size, name[0] != '_' || name[1] != 'Z');
+			}
+
+			// Also index free functions by their plain name so patches can 'call applyBuff' rather than 'call _Z9applyBuffv'
+			if (type == STT_FUNC && name[0] == '_' && name[1] == 'Z')
+			{
+				int status = 0;
+				char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+
+				if (status == 0 && demangled != nullptr)
+				{
+					size_t plainLength = strcspn(demangled, "(<");
+
+					if (plainLength > 0 && memchr(demangled, ':', plainLength) == nullptr)
+					{
+						insert(demangled, plainLength, address, false);
+						addFunction(demangled, plainLength, address, symbol.st_size, true);
+					}
+				}
+
+				free(demangled);
+			}
+		}
+	}
+}
+
+static unsigned char getElf32SymbolType(unsigned char info)
+{
+	return ELF32_ST_TYPE(info);
+}
+
+static unsigned char getElf64SymbolType(unsigned char info)
+{
+	return ELF64_ST_TYPE(info);
+}
+#endif
+
+void SymbolTable::loadModuleSymbols()
+{
+	std::lock_guard<std::mutex> lock(SymbolTable::TableMutex);
+
+#ifdef __linux__
+	// Section headers (and so .symtab) are not mapped at runtime, so each module is read back from disk
+	dl_iterate_phdr([](struct dl_phdr_info* info, size_t, void*) -> int
+	{
+		const char* path = (info->dlpi_name == nullptr || info->dlpi_name[0] == '\0') ? "/proc/self/exe" : info->dlpi_name;
+		int fileDescriptor = open(path, O_RDONLY);
+		struct stat fileStat;
+
+		if (fileDescriptor < 0)
+		{
+			return 0;
+		}
+
+		if (fstat(fileDescriptor, &fileStat) == 0 && fileStat.st_size >= (off_t)sizeof(Elf32_Ehdr))
+		{
+			void* image = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+
+			if (image != MAP_FAILED)
+			{
+				const unsigned char* identity = (const unsigned char*)image;
+
+				if (memcmp(identity, ELFMAG, SELFMAG) == 0 && identity[EI_CLASS] == ELFCLASS64 && fileStat.st_size >= (off_t)sizeof(Elf64_Ehdr))
+				{
+					loadElfSymbols<Elf64_Ehdr, Elf64_Shdr, Elf64_Sym, getElf64SymbolType>(identity, fileStat.st_size, info->dlpi_addr, SymbolTable::insertSymbol, SymbolTable::addFunction);
+				}
+				else if (memcmp(identity, ELFMAG, SELFMAG) == 0 && identity[EI_CLASS] == ELFCLASS32)
+				{
+					loadElfSymbols<Elf32_Ehdr, Elf32_Shdr, Elf32_Sym, getElf32SymbolType>(identity, fileStat.st_size, info->dlpi_addr, SymbolTable::insertSymbol, SymbolTable::addFunction);
+				}
+
+				munmap(image, fileStat.st_size);
+			}
+		}
+
+		close(fileDescriptor);
+
+		return 0;
+	}, nullptr);
+
+	SymbolTable::buildFunctionLayout();
+#endif
+}
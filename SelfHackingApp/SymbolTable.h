@@ -0,0 +1,61 @@
+#pragma once
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Name -> address lookup for globals and functions that patches may reference (ie 'mov eax, [g_playerHealth]' or 'call applyBuff').
+// Backed by an open-addressing hash table filled from the ELF .symtab/.dynsym of every loaded module plus user-registered symbols.
+// The reverse address -> function lookup used to symbolise disassembly searches the module functions laid out in Eytzinger order.
+class SymbolTable
+{
+public:
+	static void registerSymbol(std::string name, void* address);
+	static void* resolveSymbol(const char* name, size_t length);
+	static void* resolveSymbol(std::string name);
+	static const char* findFunction(void* address, long long* offset);
+	static bool findFunctionRange(void* address, void** outStart, void** outEnd);
+	static void getFunctionRanges(void* rangeStart, void* rangeEnd, std::vector<std::pair<void*, void*>>& outRanges);
+
+private:
+	struct SymbolEntry
+	{
+		unsigned int hash;
+		unsigned int nameOffset;
+		unsigned int nameLength;
+		void* address;
+
+		SymbolEntry() : hash(0), nameOffset(0), nameLength(0), address(nullptr) { }
+		SymbolEntry(unsigned int hash, unsigned int nameOffset, unsigned int nameLength, void* address)
+			: hash(hash), nameOffset(nameOffset), nameLength(nameLength), address(address) { }
+	};
+
+	struct FunctionSymbol
+	{
+		unsigned long long start;
+		unsigned long long size;
+		unsigned int nameOffset;
+		bool isPlainName;
+
+		FunctionSymbol() : start(0), size(0), nameOffset(0), isPlainName(false) { }
+		FunctionSymbol(unsigned long long start, unsigned long long size, unsigned int nameOffset, bool isPlainName)
+			: start(start), size(size), nameOffset(nameOffset), isPlainName(isPlainName) { }
+	};
+
+	static const FunctionSymbol* findFunctionSymbol(void* address);
+	static void loadModuleSymbols();
+	static void addFunction(const char* name, size_t length, void* address, unsigned long long size, bool isPlainName);
+	static void buildFunctionLayout();
+	static size_t fillFunctionLayout(const std::vector<FunctionSymbol>& sortedFunctions, size_t sortedIndex, size_t layoutIndex);
+	static void insertSymbol(const char* name, size_t length, void* address, bool replaceExisting);
+	static void growTable();
+	static SymbolEntry* findEntry(const char* name, size_t length, unsigned int hash);
+	static unsigned int hashName(const char* name, size_t length);
+
+	static std::vector<SymbolEntry> Entries;
+	static std::string NameStorage;
+	static size_t SymbolCount;
+	static std::vector<FunctionSymbol> FunctionLayout;
+	static std::string FunctionNames;
+	static std::once_flag ModuleSymbolsLoaded;
+	static std::mutex TableMutex;
+};
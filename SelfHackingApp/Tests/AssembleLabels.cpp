@@ -0,0 +1,61 @@
+// Regression check for labels in patches, which broke when unresolved names stopped falling through to asmtk's own labels.
+#include <string>
+
+#include "HackUtils.h"
+#include "TestUtils.h"
+
+static void expectAssembles(const std::string& assembly, int expectedSize)
+{
+	HackUtils::CompileResult compileResult = HackUtils::assemble(assembly, nullptr);
+	HackUtils::CompileResult validateResult = HackUtils::validate(assembly, nullptr);
+	std::vector<HackUtils::PeepholeRewrite> rewrites;
+	HackUtils::CompileResult optimizedResult = HackUtils::assembleOptimized(assembly, nullptr, true, rewrites);
+
+	for (const HackUtils::CompileResult& result : { compileResult, validateResult, optimizedResult })
+	{
+		if (result.hasError || result.byteCount != expectedSize)
+		{
+			TestUtils::fail("'" + assembly + "': " + (result.hasError ? result.errorData.message : std::to_string(result.byteCount) + " bytes"));
+			return;
+		}
+	}
+
+	TestUtils::pass("'" + assembly + "'");
+}
+
+static void expectFails(const std::string& assembly)
+{
+	HackUtils::CompileResult compileResult = HackUtils::assemble(assembly, nullptr);
+	HackUtils::CompileResult validateResult = HackUtils::validate(assembly, nullptr);
+	std::vector<HackUtils::PeepholeRewrite> rewrites;
+	HackUtils::CompileResult optimizedResult = HackUtils::assembleOptimized(assembly, nullptr, true, rewrites);
+
+	for (const HackUtils::CompileResult& result : { compileResult, validateResult, optimizedResult })
+	{
+		if (!result.hasError)
+		{
+			TestUtils::fail("'" + assembly + "': assembled to " + std::to_string(result.byteCount) + " bytes");
+			return;
+		}
+	}
+
+	TestUtils::pass("'" + assembly + "' fails");
+}
+
+int main()
+{
+	// Forward jumps are encoded before their label is bound, so asmjit gives them the rel32 form
+	expectAssembles("L1:\nnop", 1);
+	expectAssembles("jmp L2\nL2:\nnop", 6);
+	expectAssembles("L3:\nnop\njnz L3", 3);
+	expectAssembles("test eax, eax\njz skip\ninc eax\nskip:\nnop", 11);
+
+	// Labels named like a loaded symbol are still labels when the snippet defines them, even before they are bound
+	expectAssembles("test eax, eax\njz exit\ninc eax\nexit:\nnop", 11);
+	expectAssembles("jmp abort\nabort:\nnop", 6);
+
+	// A label that is never defined must not be left as a branch to the next instruction
+	expectFails("jmp nowhere\nnop");
+
+	return TestUtils::exitCode();
+}
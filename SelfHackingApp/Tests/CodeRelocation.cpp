@@ -0,0 +1,111 @@
+// Checks of CodeRelocator, which hook patches use to move a region's original instructions into a code cave, plus hooks applied
+// end to end on a hackable. Relocated branches have to reach the same targets from the new address, branches into the copied
+// range follow it, and anything that can't be relocated fails instead of being copied as is.
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "CodeRelocator.h"
+#include "HackableCode.h"
+#include "TestUtils.h"
+
+static void expectRelocation(const std::string& name, std::vector<unsigned char> code, long long moveBy, bool skipNops, const std::vector<unsigned char>& expected)
+{
+	// The copy is decoded as if it ran at a made up address, nothing is executed
+	void* originalAddress = (void*)(uintptr_t)0x10000000;
+	void* newAddress = (void*)(uintptr_t)(0x10000000 + moveBy);
+	std::vector<unsigned char> relocatedBytes;
+	bool relocated = CodeRelocator::relocate(code.data(), (int)code.size(), originalAddress, newAddress, skipNops, relocatedBytes);
+	int relocatedSize = CodeRelocator::getRelocatedSize(code.data(), (int)code.size(), skipNops);
+
+	if (expected.empty() ? (relocated || relocatedSize != -1) : (!relocated || relocatedBytes != expected || relocatedSize != (int)expected.size()))
+	{
+		TestUtils::fail(name + (relocated ? ", relocated to:" : ", not relocated"));
+
+		if (relocated)
+		{
+			std::cout << HackUtils::disassemble(relocatedBytes.data(), (int)relocatedBytes.size(), newAddress);
+		}
+
+		return;
+	}
+
+	TestUtils::pass(name);
+}
+
+NO_OPTIMIZE
+int hackableRoutineAddValues(int value, int increment)
+{
+	static volatile int valueLocal;
+	static volatile int incrementLocal;
+
+	valueLocal = value;
+	incrementLocal = increment;
+
+	ASM_MOV_REG_VAR(ZAX, valueLocal);
+	ASM_MOV_REG_VAR(ZCX, incrementLocal);
+
+	HACKABLE_CODE_BEGIN()
+	ASM(add ZAX, ZCX)
+	ASM_NOP16()
+	HACKABLE_CODE_END();
+
+	ASM_MOV_VAR_REG(valueLocal, ZAX);
+
+	HACKABLES_STOP_SEARCH();
+
+	return valueLocal;
+}
+END_NO_OPTIMIZE
+
+static void expectHook(const std::string& hookAssembly, HackableCode::HookPosition position, int expected)
+{
+	auto functionPointer = &hackableRoutineAddValues;
+	std::vector<HackableCode*> hackables = HackableCode::create((void*&)functionPointer);
+	std::string description = "'" + hookAssembly + "' " + (position == HackableCode::HookPosition::Before ? "before" : "after") + " the region";
+
+	if (hackables.empty() || !hackables[0]->applyHook(hookAssembly, position))
+	{
+		TestUtils::fail(description + ": " + (hackables.empty() ? "no hackable section" : "hook not applied"));
+		return;
+	}
+
+	int result = hackableRoutineAddValues(5, 3);
+
+	hackables[0]->restoreState();
+
+	TestUtils::expect(description + " gives " + std::to_string(result), result == expected && hackableRoutineAddValues(5, 3) == 8);
+}
+
+int main()
+{
+	// test ecx, ecx / jz to the end / add eax, ecx. The jz widens to rel32 and still lands on the end of the relocated code.
+	expectRelocation("jcc to the end of the range", { 0x85, 0xC9, 0x74, 0x02, 0x01, 0xC8 }, 0x1000, false,
+		{ 0x85, 0xC9, 0x0F, 0x84, 0x02, 0x00, 0x00, 0x00, 0x01, 0xC8 });
+
+	// jmp rel32 to 0x100 past the start, moved 0x40 closer to it
+	expectRelocation("jmp out of the range", { 0xE9, 0xFB, 0x00, 0x00, 0x00 }, 0x40, false, { 0xE9, 0xBB, 0x00, 0x00, 0x00 });
+
+	// jmp rel8 to 0x12 past the start, moved 0x1000 past it
+	expectRelocation("short jmp widened", { 0xEB, 0x10 }, 0x1000, false, { 0xE9, 0x0D, 0xF0, 0xFF, 0xFF });
+
+	expectRelocation("NOPs skipped", { 0x90, 0x01, 0xC8, 0x90, 0x90 }, 0x1000, true, { 0x01, 0xC8 });
+
+	// loop has no rel32 form
+	expectRelocation("loop fails", { 0xE2, 0x10 }, 0x1000, false, { });
+
+	if (sizeof(void*) == 8)
+	{
+		// mov rax, [rip+0x10] moved 0x100 further from what it reads
+		expectRelocation("rip-relative operand", { 0x48, 0x8B, 0x05, 0x10, 0x00, 0x00, 0x00 }, 0x100, false, { 0x48, 0x8B, 0x05, 0x10, 0xFF, 0xFF, 0xFF });
+	}
+
+	std::string ax = sizeof(void*) == 8 ? "rax" : "eax";
+
+	// (5 + 3) * 2 after the original add, (5 * 2) + 3 before it
+	expectHook("imul " + ax + ", " + ax + ", 2", HackableCode::HookPosition::After, 16);
+	expectHook("imul " + ax + ", " + ax + ", 2", HackableCode::HookPosition::Before, 13);
+
+	return TestUtils::exitCode();
+}
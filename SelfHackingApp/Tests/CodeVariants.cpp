@@ -0,0 +1,105 @@
+// Checks of HackableCodeVariants: the first variant whose requirements the host CPU meets is the one applied, adding a variant
+// redoes the choice, and a patch with no runnable variant isn't applied. The variants give different results, so the check can
+// tell which one ran.
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "HackableCode.h"
+#include "HackableCodeVariants.h"
+#include "TestUtils.h"
+
+typedef HackableCodeVariants::CpuFeature CpuFeature;
+
+NO_OPTIMIZE
+int hackableRoutineCombineValues(int value, int operand)
+{
+	static volatile int valueLocal;
+	static volatile int operandLocal;
+
+	valueLocal = value;
+	operandLocal = operand;
+
+	ASM_MOV_REG_VAR(ZAX, valueLocal);
+	ASM_MOV_REG_VAR(ZCX, operandLocal);
+
+	HACKABLE_CODE_BEGIN()
+	ASM(add ZAX, ZCX)
+	ASM_NOP16()
+	HACKABLE_CODE_END();
+
+	ASM_MOV_VAR_REG(valueLocal, ZAX);
+
+	HACKABLES_STOP_SEARCH();
+
+	return valueLocal;
+}
+END_NO_OPTIMIZE
+
+static bool isRunnable(const std::vector<CpuFeature>& requirements)
+{
+	for (CpuFeature feature : requirements)
+	{
+		if (!HackableCodeVariants::isSupported(feature))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int main()
+{
+	auto functionPointer = &hackableRoutineCombineValues;
+	std::vector<HackableCode*> hackables = HackableCode::create((void*&)functionPointer);
+
+	if (hackables.empty())
+	{
+		TestUtils::fail("no hackable section");
+		return TestUtils::exitCode();
+	}
+
+	std::string ax = sizeof(void*) == 8 ? "rax" : "eax";
+	std::string cx = sizeof(void*) == 8 ? "rcx" : "ecx";
+	std::vector<std::vector<CpuFeature>> requirements = { { CpuFeature::AVX512, CpuFeature::BMI2 }, { CpuFeature::BMI2 }, { CpuFeature::SSE4_2 }, { } };
+	std::vector<std::string> assembly = { "shlx " + ax + ", " + ax + ", " + cx + "\nadd " + ax + ", 1", "shlx " + ax + ", " + ax + ", " + cx, "sub " + ax + ", " + cx, "add " + ax + ", " + cx };
+	std::vector<int> results = { 41, 40, 2, 8 };
+	int expectedVariant = 0;
+
+	while (!isRunnable(requirements[expectedVariant]))
+	{
+		expectedVariant++;
+	}
+
+	std::cout << "SSE4.2 " << HackableCodeVariants::isSupported(CpuFeature::SSE4_2) << ", AVX2 " << HackableCodeVariants::isSupported(CpuFeature::AVX2)
+		<< ", AVX512 " << HackableCodeVariants::isSupported(CpuFeature::AVX512) << ", BMI2 " << HackableCodeVariants::isSupported(CpuFeature::BMI2) << std::endl;
+
+	// Everything but the last variant goes in first, the plain one is added after the choice was made once
+	HackableCodeVariants* variants = HackableCodeVariants::create(hackables[0]);
+
+	for (size_t index = 0; index + 1 < assembly.size(); index++)
+	{
+		variants->addVariant(assembly[index], requirements[index]);
+	}
+
+	if (expectedVariant + 1 < (int)assembly.size())
+	{
+		TestUtils::expect("the first runnable variant is picked", variants->getSelectedVariant() == expectedVariant);
+	}
+	else
+	{
+		TestUtils::expect("no variant is picked when none can run", variants->getSelectedVariant() == -1 && !variants->apply());
+	}
+
+	variants->addVariant(assembly.back(), requirements.back());
+
+	TestUtils::expect("adding a variant redoes the choice", variants->getSelectedVariant() == expectedVariant);
+	TestUtils::expect("the picked variant is applied", variants->apply() && hackableRoutineCombineValues(5, 3) == results[expectedVariant]);
+
+	hackables[0]->restoreState();
+
+	TestUtils::expect("restoreState undoes the variant", hackableRoutineCombineValues(5, 3) == 8);
+
+	return TestUtils::exitCode();
+}
@@ -0,0 +1,80 @@
+// Checks that HackUtils::disassemble never returns stale text from its cache: writes through writeMemory and writes made behind
+// its back both show up, evicted regions decode again, and threads hitting the same regions all get the right text.
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HackUtils.h"
+#include "TestUtils.h"
+
+static const int RegionCount = 8192;
+static const int ThreadCount = 4;
+
+int main()
+{
+	// nop / inc eax / ret, one region per 16 bytes so the regions spread over every shard
+	std::vector<unsigned char> code = std::vector<unsigned char>(RegionCount * 16, 0xCC);
+
+	for (int region = 0; region < RegionCount; region++)
+	{
+		code[region * 16] = 0x90;
+		code[region * 16 + 1] = 0xFF;
+		code[region * 16 + 2] = 0xC0;
+		code[region * 16 + 3] = 0xC3;
+	}
+
+	unsigned char* first = code.data();
+	std::string original = HackUtils::disassemble(first, 4);
+	unsigned char incEcx[] = { 0xFF, 0xC1 };
+
+	TestUtils::expect("a second call gives the same text", HackUtils::disassemble(first, 4) == original);
+
+	HackUtils::writeMemory(first + 1, incEcx, sizeof(incEcx));
+
+	TestUtils::expect("a write through writeMemory shows up", HackUtils::disassemble(first, 4) == "nop\ninc ecx\nret\n");
+
+	// Left to the checksum, since the cache never hears about this write
+	first[2] = 0xC2;
+
+	TestUtils::expect("a write behind the cache's back shows up", HackUtils::disassemble(first, 4) == "nop\ninc edx\nret\n");
+
+	first[1] = 0xFF;
+	first[2] = 0xC0;
+
+	// Twice as many regions as the cache holds, so the early ones are evicted before they are asked for again
+	bool allMatch = true;
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (int region = 0; region < RegionCount; region++)
+		{
+			allMatch &= HackUtils::disassemble(code.data() + region * 16, 4) == original;
+		}
+	}
+
+	TestUtils::expect("evicted regions decode again", allMatch);
+
+	std::atomic<int> mismatches(0);
+	std::vector<std::thread> threads;
+
+	for (int threadIndex = 0; threadIndex < ThreadCount; threadIndex++)
+	{
+		threads.push_back(std::thread([&]()
+		{
+			for (int region = 0; region < RegionCount; region += 3)
+			{
+				mismatches += HackUtils::disassemble(code.data() + region * 16, 4) == original ? 0 : 1;
+			}
+		}));
+	}
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	TestUtils::expect("threads sharing the cache get the right text", mismatches == 0);
+
+	return TestUtils::exitCode();
+}
@@ -0,0 +1,46 @@
+// Checks of HackableFunction: a function keeps one object however often it is looked up, including after its entry has been
+// redirected, and swapping and restoring versions changes what callers get.
+#include <string>
+
+#include "HackableCode.h"
+#include "HackableFunction.h"
+#include "TestUtils.h"
+
+NO_OPTIMIZE
+int swappableAddValues(int value, int increment)
+{
+	return value + increment;
+}
+END_NO_OPTIMIZE
+
+int main()
+{
+	// Called through a volatile pointer so the calls can't be inlined or folded
+	int (*volatile functionPointer)(int, int) = &swappableAddValues;
+	HackableFunction* hackableFunction = HackableFunction::create((void*)functionPointer);
+
+	if (hackableFunction == nullptr)
+	{
+		TestUtils::fail("the function can't be redirected");
+		return TestUtils::exitCode();
+	}
+
+	std::string version = sizeof(void*) == 8 ? "lea eax, [rdi + rsi * 2]\nret" : "mov eax, [esp + 4]\nmov ecx, [esp + 8]\nlea eax, [eax + ecx * 2]\nret";
+	int versionIndex = hackableFunction->addVersion(version);
+
+	TestUtils::expect("a second lookup gives the same object", HackableFunction::create((void*)functionPointer) == hackableFunction);
+	TestUtils::expect("the version is applied", versionIndex >= 0 && hackableFunction->applyVersion(versionIndex));
+	TestUtils::expect("callers run the version", functionPointer(5, 3) == 11);
+
+	// The entry is a jmp to the stub now, which must not be followed to a second object over the stub
+	HackableFunction* redirectedLookup = HackableFunction::create((void*)functionPointer);
+
+	TestUtils::expect("a lookup after the redirect gives the same object", redirectedLookup == hackableFunction);
+	TestUtils::expect("the object still points at the function", hackableFunction->getPointer() == (void*)functionPointer);
+
+	hackableFunction->restoreState();
+
+	TestUtils::expect("restoreState brings back the original", functionPointer(5, 3) == 8 && hackableFunction->getActiveVersion() == -1);
+
+	return TestUtils::exitCode();
+}
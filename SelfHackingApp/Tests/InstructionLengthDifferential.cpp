@@ -0,0 +1,185 @@
+// Differential check of InstructionLength against udis86, over random byte sequences in 32 and 64-bit mode and over every function
+// of this program. Every instruction udis86 decodes as valid has to get the same length, apart from three known udis86 decoding
+// errors where InstructionLength returns the hardware length instead:
+//   - 66 followed by REX.W, where udis86 lets 66 shrink the immediate or branch displacement (ie glibc's 66 66 48 e8 call padding)
+//   - 67 with REX.B and a [disp32] or [rip+disp32] operand, where udis86 misses the displacement
+//   - VEX encoded 0F 71-73 shifts, where udis86 drops the imm8
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "ImageDisassembler.h"
+#include "InstructionLength.h"
+#include "TestUtils.h"
+#include "External/libudis86/udis86.h"
+
+static const int RandomSequences = 2000000;
+static const int MaxReportedMismatches = 20;
+
+enum class Outcome
+{
+	Match,
+	KnownUdisError,
+	Mismatch,
+};
+
+static long long compared = 0;
+static long long knownUdisErrors = 0;
+static long long mismatches = 0;
+
+static bool isKnownUdisError(const unsigned char* bytes, int available, int mode, int udisLength, int length)
+{
+	bool hasOperandSize = false;
+	bool hasAddressSize = false;
+	int rex = 0;
+	int offset = 0;
+
+	// Legacy prefixes, and a REX that only counts if nothing but the opcode follows it
+	for (; offset < available; offset++)
+	{
+		unsigned char next = bytes[offset];
+
+		if (mode == 64 && (next & 0xF0) == 0x40)
+		{
+			rex = next;
+			continue;
+		}
+
+		if (next != 0x26 && next != 0x2E && next != 0x36 && next != 0x3E && next != 0x64 && next != 0x65
+			&& next != 0x66 && next != 0x67 && next != 0xF0 && next != 0xF2 && next != 0xF3)
+		{
+			break;
+		}
+
+		hasOperandSize |= next == 0x66;
+		hasAddressSize |= next == 0x67;
+		rex = 0;
+	}
+
+	if (hasOperandSize && (rex & 0x08) && length == udisLength + 2)
+	{
+		return true;
+	}
+
+	if (hasAddressSize && (rex & 0x01) && length == udisLength + 4)
+	{
+		return true;
+	}
+
+	// 0F map shifts with an immediate, from both the two and three byte VEX forms
+	if (offset + 3 < available && (bytes[offset] == 0xC5 || bytes[offset] == 0xC4) && (mode == 64 || (bytes[offset + 1] & 0xC0) == 0xC0))
+	{
+		bool isMap1 = bytes[offset] == 0xC5 || (bytes[offset + 1] & 0x1F) == 1;
+		unsigned char opcode = bytes[offset + (bytes[offset] == 0xC5 ? 2 : 3)];
+
+		return isMap1 && opcode >= 0x71 && opcode <= 0x73 && length == udisLength + 1;
+	}
+
+	return false;
+}
+
+static Outcome compare(const unsigned char* bytes, int available, int mode, const std::string& source)
+{
+	ud_t ud_obj;
+
+	ud_init(&ud_obj);
+	ud_set_mode(&ud_obj, (uint8_t)mode);
+	ud_set_input_buffer(&ud_obj, bytes, available);
+
+	int udisLength = (int)ud_decode(&ud_obj);
+
+	if (udisLength == 0 || ud_obj.mnemonic == UD_Iinvalid)
+	{
+		return Outcome::Match;
+	}
+
+	int length = InstructionLength::getLength(bytes, available, mode);
+
+	compared++;
+
+	if (length == udisLength)
+	{
+		return Outcome::Match;
+	}
+
+	if (isKnownUdisError(bytes, available, mode, udisLength, length))
+	{
+		knownUdisErrors++;
+		return Outcome::KnownUdisError;
+	}
+
+	if (mismatches++ < MaxReportedMismatches)
+	{
+		std::string hex = "";
+		char byteText[4];
+
+		for (int index = 0; index < std::max(udisLength, length) && index < available; index++)
+		{
+			snprintf(byteText, sizeof(byteText), "%02X ", bytes[index]);
+			hex += byteText;
+		}
+
+		std::cout << "  " << source << " " << mode << "-bit: " << hex << "udis86 " << udisLength << ", InstructionLength " << length << std::endl;
+	}
+
+	return Outcome::Mismatch;
+}
+
+int main()
+{
+	std::mt19937 random = std::mt19937(1);
+	unsigned char bytes[InstructionLength::MaxLength];
+
+	for (int mode : { 32, 64 })
+	{
+		for (int sequence = 0; sequence < RandomSequences; sequence++)
+		{
+			for (unsigned char& next : bytes)
+			{
+				next = (unsigned char)random();
+			}
+
+			compare(bytes, InstructionLength::MaxLength, mode, "random");
+		}
+	}
+
+	long long randomCompared = compared;
+
+	// Walks each function, past known udis86 errors by the hardware length so the rest of the function stays in sync
+	ImageDisassembler::ImageDisassembly image = ImageDisassembler::disassembleImage((void*)&main, 1);
+	int mode = (int)sizeof(void*) * 8;
+
+	for (const ImageDisassembler::FunctionDisassembly& function : image.functions)
+	{
+		const unsigned char* code = (const unsigned char*)function.address;
+
+		for (size_t offset = 0; offset < function.length;)
+		{
+			int available = (int)std::min(function.length - offset, (size_t)InstructionLength::MaxLength);
+			Outcome outcome = compare(code + offset, available, mode, "image");
+			int length = outcome == Outcome::KnownUdisError ? InstructionLength::getLength(code + offset, available, mode) : 0;
+
+			if (length == 0)
+			{
+				ud_t ud_obj;
+
+				ud_init(&ud_obj);
+				ud_set_mode(&ud_obj, (uint8_t)mode);
+				ud_set_input_buffer(&ud_obj, code + offset, available);
+				length = std::max((int)ud_decode(&ud_obj), 1);
+			}
+
+			offset += length;
+		}
+	}
+
+	std::cout << randomCompared << " random and " << compared - randomCompared << " image instructions (" << image.functions.size() << " functions) compared, "
+		<< knownUdisErrors << " known udis86 errors, " << mismatches << " mismatches" << std::endl;
+
+	TestUtils::expect("InstructionLength agrees with udis86", mismatches == 0);
+	TestUtils::expect("the image has instructions to compare", compared > randomCompared);
+
+	return TestUtils::exitCode();
+}
@@ -0,0 +1,60 @@
+// Checks of the peephole pass that HackUtils::assembleOptimized runs over patches: each patch has to encode to the same bytes as the
+// expected rewrite, and rewrites that change the flags may only happen while the flags are dead.
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "HackUtils.h"
+#include "TestUtils.h"
+
+static void expectRewrite(const std::string& assembly, bool flagsLiveAtEnd, const std::string& expected)
+{
+	std::vector<HackUtils::PeepholeRewrite> rewrites;
+	HackUtils::CompileResult optimizedResult = HackUtils::assembleOptimized(assembly, nullptr, flagsLiveAtEnd, rewrites);
+	HackUtils::CompileResult expectedResult = HackUtils::assemble(expected, nullptr);
+	std::string description = "'" + assembly + "'" + (flagsLiveAtEnd ? " (flags live)" : "");
+
+	if (optimizedResult.hasError || expectedResult.hasError)
+	{
+		TestUtils::fail(description + ": " + (optimizedResult.hasError ? optimizedResult.errorData.message : expectedResult.errorData.message));
+		return;
+	}
+
+	if (optimizedResult.compiledBytes != expectedResult.compiledBytes)
+	{
+		TestUtils::fail(description + ", expected:");
+		std::cout << expected << std::endl << "got:" << std::endl << HackUtils::disassemble(optimizedResult.compiledBytes.data(), optimizedResult.byteCount);
+		return;
+	}
+
+	// Every rewrite is reported, and none are reported for a patch that is left alone
+	TestUtils::expect(description + ", " + std::to_string(rewrites.size()) + " rewrites reported", rewrites.empty() == (assembly == expected));
+}
+
+int main()
+{
+	std::string ax = sizeof(void*) == 8 ? "rax" : "eax";
+	std::string bx = sizeof(void*) == 8 ? "rbx" : "ebx";
+
+	expectRewrite("mov " + ax + ", " + ax + "\nnop", false, "nop");
+	expectRewrite("mov " + ax + ", 5\nmov " + ax + ", " + bx, false, "mov " + ax + ", " + bx);
+	expectRewrite("push " + ax + "\npop " + ax + "\nnop", false, "nop");
+	expectRewrite("push " + ax + "\npop " + bx, false, "mov " + bx + ", " + ax);
+
+	// add 0 and shl still write the flags
+	expectRewrite("add " + ax + ", 0\nnop", false, "nop");
+	expectRewrite("add " + ax + ", 0\nnop", true, "add " + ax + ", 0\nnop");
+	expectRewrite("imul " + ax + ", " + ax + ", 8", false, "shl " + ax + ", 3");
+	expectRewrite("imul " + ax + ", " + ax + ", 8", true, "imul " + ax + ", " + ax + ", 8");
+
+	// Nothing moves across a label
+	expectRewrite("mov " + ax + ", 5\nL1:\nmov " + ax + ", " + bx, false, "mov " + ax + ", 5\nL1:\nmov " + ax + ", " + bx);
+
+	if (sizeof(void*) == 8)
+	{
+		// A 32-bit move to itself zero extends, so it isn't a no-op
+		expectRewrite("mov eax, eax", false, "mov eax, eax");
+	}
+
+	return TestUtils::exitCode();
+}
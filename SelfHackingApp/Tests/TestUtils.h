@@ -0,0 +1,47 @@
+#pragma once
+#include <iostream>
+#include <string>
+
+// Reporting shared by the checks and benchmarks. Every case prints one 'ok' or 'FAIL' line, and main returns exitCode() so
+// ctest sees any failure.
+class TestUtils
+{
+public:
+	static void pass(const std::string& description)
+	{
+		std::cout << "ok   " << description << std::endl;
+	}
+
+	static void fail(const std::string& description)
+	{
+		std::cout << "FAIL " << description << std::endl;
+		TestUtils::getFailureCount()++;
+	}
+
+	static bool expect(const std::string& description, bool condition)
+	{
+		if (condition)
+		{
+			TestUtils::pass(description);
+		}
+		else
+		{
+			TestUtils::fail(description);
+		}
+
+		return condition;
+	}
+
+	static int exitCode()
+	{
+		return TestUtils::getFailureCount() == 0 ? 0 : 1;
+	}
+
+private:
+	static int& getFailureCount()
+	{
+		static int failureCount = 0;
+
+		return failureCount;
+	}
+};
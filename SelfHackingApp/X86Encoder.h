@@ -0,0 +1,374 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <utility>
+
+// Compile-time encoder for the handful of instructions that most patches are made of. These skip the runtime assembler entirely:
+//
+//   using namespace shc::x86;
+//   hackableCode->applyCustomCode(encode<Add<Reg::eax, Imm<5>>, Inc<Reg::ebx>>());
+//
+// Supported: nop, mov/add/sub/imul reg,reg and reg,imm, inc/dec reg, jmp rel (relative to the end of the jmp).
+namespace shc
+{
+	namespace x86
+	{
+		template<unsigned char Id, bool Is64>
+		struct Register
+		{
+			static constexpr unsigned char id = Id & 0x7;
+			static constexpr bool isExtended = Id > 0x7;
+			static constexpr bool is64 = Is64;
+
+			static_assert(sizeof(void*) == 8 || (!Is64 && Id <= 0x7), "64-bit registers are not available in 32-bit code");
+		};
+
+		struct Reg
+		{
+			typedef Register<0, false> eax;
+			typedef Register<1, false> ecx;
+			typedef Register<2, false> edx;
+			typedef Register<3, false> ebx;
+			typedef Register<4, false> esp;
+			typedef Register<5, false> ebp;
+			typedef Register<6, false> esi;
+			typedef Register<7, false> edi;
+			typedef Register<8, false> r8d;
+			typedef Register<9, false> r9d;
+			typedef Register<10, false> r10d;
+			typedef Register<11, false> r11d;
+			typedef Register<12, false> r12d;
+			typedef Register<13, false> r13d;
+			typedef Register<14, false> r14d;
+			typedef Register<15, false> r15d;
+
+			typedef Register<0, true> rax;
+			typedef Register<1, true> rcx;
+			typedef Register<2, true> rdx;
+			typedef Register<3, true> rbx;
+			typedef Register<4, true> rsp;
+			typedef Register<5, true> rbp;
+			typedef Register<6, true> rsi;
+			typedef Register<7, true> rdi;
+			typedef Register<8, true> r8;
+			typedef Register<9, true> r9;
+			typedef Register<10, true> r10;
+			typedef Register<11, true> r11;
+			typedef Register<12, true> r12;
+			typedef Register<13, true> r13;
+			typedef Register<14, true> r14;
+			typedef Register<15, true> r15;
+		};
+
+		template<long long Value>
+		struct Imm
+		{
+			static constexpr long long value = Value;
+		};
+
+		template<long long Value>
+		struct Rel
+		{
+			static constexpr long long value = Value;
+		};
+
+		template<std::size_t Size>
+		struct ByteWriter
+		{
+			unsigned char bytes[Size == 0 ? 1 : Size];
+			std::size_t count;
+
+			constexpr ByteWriter() : bytes(), count(0) { }
+
+			constexpr void emit8(unsigned char value)
+			{
+				this->bytes[this->count++] = value;
+			}
+
+			constexpr void emit32(long long value)
+			{
+				for (int index = 0; index < 4; index++)
+				{
+					this->emit8((unsigned char)((unsigned long long)value >> (index * 8)));
+				}
+			}
+
+			constexpr void emit64(long long value)
+			{
+				this->emit32(value);
+				this->emit32((long long)((unsigned long long)value >> 32));
+			}
+
+			// REX is only emitted when it carries information
+			constexpr void emitRex(bool w, bool r, bool b)
+			{
+				if (w || r || b)
+				{
+					this->emit8((unsigned char)(0x40 | (w ? 0x8 : 0) | (r ? 0x4 : 0) | (b ? 0x1 : 0)));
+				}
+			}
+
+			constexpr void emitModRm(unsigned char reg, unsigned char rm)
+			{
+				this->emit8((unsigned char)(0xC0 | ((reg & 0x7) << 3) | (rm & 0x7)));
+			}
+		};
+
+		constexpr bool isInt8(long long value)
+		{
+			return value >= -128 && value <= 127;
+		}
+
+		constexpr bool isInt32(long long value)
+		{
+			return value >= -2147483648LL && value <= 2147483647LL;
+		}
+
+		constexpr bool isUInt32(long long value)
+		{
+			return value >= 0 && value <= 4294967295LL;
+		}
+
+		constexpr std::size_t rexSize(bool w, bool r, bool b)
+		{
+			return (w || r || b) ? 1 : 0;
+		}
+
+		struct Nop
+		{
+			static constexpr std::size_t size = 1;
+
+			template<std::size_t Size>
+			static constexpr void write(ByteWriter<Size>& writer)
+			{
+				writer.emit8(0x90);
+			}
+		};
+
+		// Shared encoder for 'op r/m, reg' and 'op r/m, imm' ALU forms (81 /ext id, 83 /ext ib)
+		template<unsigned char RegRegOpcode, unsigned char Extension, typename Dst, typename Src>
+		struct AluInstruction
+		{
+			static_assert(Dst::is64 == Src::is64, "Operand size mismatch");
+
+			static constexpr std::size_t size = rexSize(Dst::is64, Src::isExtended, Dst::isExtended) + 2;
+
+			template<std::size_t Size>
+			static constexpr void write(ByteWriter<Size>& writer)
+			{
+				writer.emitRex(Dst::is64, Src::isExtended, Dst::isExtended);
+				writer.emit8(RegRegOpcode);
+				writer.emitModRm(Src::id, Dst::id);
+			}
+		};
+
+		template<unsigned char RegRegOpcode, unsigned char Extension, typename Dst, long long Value>
+		struct AluInstruction<RegRegOpcode, Extension, Dst, Imm<Value>>
+		{
+			static_assert(isInt32(Value) || (!Dst::is64 && isUInt32(Value)), "Immediate does not fit in 32 bits");
+
+			static constexpr std::size_t size = rexSize(Dst::is64, false, Dst::isExtended) + 2 + (isInt8(Value) ? 1 : 4);
+
+			template<std::size_t Size>
+			static constexpr void write(ByteWriter<Size>& writer)
+			{
+				writer.emitRex(Dst::is64, false, Dst::isExtended);
+				writer.emit8(isInt8(Value) ? 0x83 : 0x81);
+				writer.emitModRm(Extension, Dst::id);
+
+				if (isInt8(Value))
+				{
+					writer.emit8((unsigned char)Value);
+				}
+				else
+				{
+					writer.emit32(Value);
+				}
+			}
+		};
+
+		template<typename Dst, typename Src>
+		struct Add : AluInstruction<0x01, 0, Dst, Src> { };
+
+		template<typename Dst, typename Src>
+		struct Sub : AluInstruction<0x29, 5, Dst, Src> { };
+
+		template<typename Dst, typename Src>
+		struct Mov
+		{
+			static_assert(Dst::is64 == Src::is64, "Operand size mismatch");
+
+			static constexpr std::size_t size = rexSize(Dst::is64, Src::isExtended, Dst::isExtended) + 2;
+
+			template<std::size_t Size>
+			static constexpr void write(ByteWriter<Size>& writer)
+			{
+				writer.emitRex(Dst::is64, Src::isExtended, Dst::isExtended);
+				writer.emit8(0x89);
+				writer.emitModRm(Src::id, Dst::id);
+			}
+		};
+
+		// 32-bit: B8+r id. 64-bit: REX.W C7 /0 id if sign-extension reaches the value, otherwise REX.W B8+r iq.
+		template<typename Dst, long long Value>
+		struct Mov<Dst, Imm<Value>>
+		{
+			static_assert(Dst::is64 || isInt32(Value) || isUInt32(Value), "Immediate does not fit in 32 bits");
+
+			static constexpr bool isSignExtended = Dst::is64 && isInt32(Value);
+			static constexpr std::size_t size = rexSize(Dst::is64, false, Dst::isExtended) + (isSignExtended ? 6 : (Dst::is64 ? 9 : 5));
+
+			template<std::size_t Size>
+			static constexpr void write(ByteWriter<Size>& writer)
+			{
+				writer.emitRex(Dst::is64, false, Dst::isExtended);
+
+				if (isSignExtended)
+				{
+					writer.emit8(0xC7);
+					writer.emitModRm(0, Dst::id);
+					writer.emit32(Value);
+				}
+				else if (Dst::is64)
+				{
+					writer.emit8((unsigned char)(0xB8 + Dst::id));
+					writer.emit64(Value);
+				}
+				else
+				{
+					writer.emit8((unsigned char)(0xB8 + Dst::id));
+					writer.emit32(Value);
+				}
+			}
+		};
+
+		template<typename Dst, typename Src>
+		struct Imul
+		{
+			static_assert(Dst::is64 == Src::is64, "Operand size mismatch");
+
+			static constexpr std::size_t size = rexSize(Dst::is64, Dst::isExtended, Src::isExtended) + 3;
+
+			template<std::size_t Size>
+			static constexpr void write(ByteWriter<Size>& writer)
+			{
+				writer.emitRex(Dst::is64, Dst::isExtended, Src::isExtended);
+				writer.emit8(0x0F);
+				writer.emit8(0xAF);
+				writer.emitModRm(Dst::id, Src::id);
+			}
+		};
+
+		// imul r, r/m, imm with the destination doubling as the source (6B /r ib, 69 /r id)
+		template<typename Dst, long long Value>
+		struct Imul<Dst, Imm<Value>>
+		{
+			static_assert(isInt32(Value), "Immediate does not fit in 32 bits");
+
+			static constexpr std::size_t size = rexSize(Dst::is64, Dst::isExtended, Dst::isExtended) + 2 + (isInt8(Value) ? 1 : 4);
+
+			template<std::size_t Size>
+			static constexpr void write(ByteWriter<Size>& writer)
+			{
+				writer.emitRex(Dst::is64, Dst::isExtended, Dst::isExtended);
+				writer.emit8(isInt8(Value) ? 0x6B : 0x69);
+				writer.emitModRm(Dst::id, Dst::id);
+
+				if (isInt8(Value))
+				{
+					writer.emit8((unsigned char)Value);
+				}
+				else
+				{
+					writer.emit32(Value);
+				}
+			}
+		};
+
+		// FF /0 and FF /1 rather than the one byte 40+r/48+r forms, which are REX prefixes in 64-bit code
+		template<unsigned char Extension, typename Dst>
+		struct IncDecInstruction
+		{
+			static constexpr std::size_t size = rexSize(Dst::is64, false, Dst::isExtended) + 2;
+
+			template<std::size_t Size>
+			static constexpr void write(ByteWriter<Size>& writer)
+			{
+				writer.emitRex(Dst::is64, false, Dst::isExtended);
+				writer.emit8(0xFF);
+				writer.emitModRm(Extension, Dst::id);
+			}
+		};
+
+		template<typename Dst>
+		struct Inc : IncDecInstruction<0, Dst> { };
+
+		template<typename Dst>
+		struct Dec : IncDecInstruction<1, Dst> { };
+
+		template<typename Target>
+		struct Jmp;
+
+		template<long long Value>
+		struct Jmp<Rel<Value>>
+		{
+			static_assert(isInt32(Value), "Jump displacement does not fit in 32 bits");
+
+			static constexpr std::size_t size = isInt8(Value) ? 2 : 5;
+
+			template<std::size_t Size>
+			static constexpr void write(ByteWriter<Size>& writer)
+			{
+				if (isInt8(Value))
+				{
+					writer.emit8(0xEB);
+					writer.emit8((unsigned char)Value);
+				}
+				else
+				{
+					writer.emit8(0xE9);
+					writer.emit32(Value);
+				}
+			}
+		};
+
+		template<typename... Instructions>
+		struct InstructionSequence
+		{
+			static constexpr std::size_t size()
+			{
+				std::size_t sizes[] = { 0, Instructions::size... };
+				std::size_t total = 0;
+
+				for (std::size_t next : sizes)
+				{
+					total += next;
+				}
+
+				return total;
+			}
+
+			static constexpr ByteWriter<size()> write()
+			{
+				ByteWriter<size()> writer;
+				int expand[] = { 0, (Instructions::write(writer), 0)... };
+
+				(void)expand;
+
+				return writer;
+			}
+		};
+
+		template<std::size_t Size, std::size_t... Indices>
+		constexpr std::array<unsigned char, Size> toArray(const ByteWriter<Size>& writer, std::index_sequence<Indices...>)
+		{
+			return std::array<unsigned char, Size>{ { writer.bytes[Indices]... } };
+		}
+
+		template<typename... Instructions>
+		constexpr std::array<unsigned char, InstructionSequence<Instructions...>::size()> encode()
+		{
+			return toArray(InstructionSequence<Instructions...>::write(), std::make_index_sequence<InstructionSequence<Instructions...>::size()>());
+		}
+	}
+}